@@ -0,0 +1,376 @@
+// wx #includes must come first to prevent secure function warning from wxcrt.h
+#include <wx/log.h>
+
+#include "AsyncLog.h"
+#include "Clock.h"
+#include "Diagnostic.h"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <fstream>
+#include <mutex>
+#include <thread>
+
+// Single producer (the owning thread), single consumer (the writer thread)
+struct AsyncLog::Ring
+{
+	enum { SIZE = 1 << 18 }; // bytes, power of two
+
+	std::vector<uint64_t> buffer; // uint64_t for Record alignment
+	std::atomic<uint64_t> head;   // written by the producer
+	std::atomic<uint64_t> tail;   // written by the consumer
+	std::atomic<bool> writing;    // the producer is between Reserve() and Commit() (or giving up)
+	uint64_t reserved;            // size of the record being written (producer only)
+	bool inUse;                   // guarded by mu
+
+	Ring() : buffer(SIZE / sizeof(uint64_t)), reserved(0), inUse(true) { head = 0; tail = 0; writing = false; }
+
+	uint8_t *At(uint64_t pos) { return reinterpret_cast<uint8_t *>(buffer.data()) + (pos & (SIZE - 1)); }
+};
+
+std::atomic<bool> AsyncLog::_running;
+std::atomic<wxLogLevel> AsyncLog::_maxLevel(wxLOG_Message);
+std::atomic<bool> AsyncLog::_blocking(false);
+std::atomic<uint64_t> AsyncLog::_dropped;
+HS_THREAD_LOCAL AsyncLog::Ring *AsyncLog::_ring = nullptr;
+
+namespace {
+	const size_t ALIGN = sizeof(uint64_t);
+	const auto FLUSH_INTERVAL = std::chrono::milliseconds(50);
+
+	std::mutex mu; // guards rings, sink, stopping
+	std::vector<std::unique_ptr<AsyncLog::Ring>> rings;
+	AsyncLog::Sink *sink = nullptr;
+	bool stopping = false;
+	std::condition_variable wake;
+
+	std::thread writer;
+	std::ofstream fout;
+
+	// Wall clock time at Clock::Now() == 0 (records only carry monotonic time)
+	int64_t wallOffset = 0;
+
+	uint64_t droppedReported = 0; // writer thread only
+}
+
+//-----------------------------------------------------------------------------
+// Producer side
+
+AsyncLog::Ring *AsyncLog::ThreadRing()
+{
+	if (!_ring) {
+		std::lock_guard<std::mutex> lock(mu);
+
+		// Reuse a ring released by an exited thread if it's been drained
+		for (auto &ring : rings) {
+			if (!ring->inUse && ring->head.load(std::memory_order_relaxed) == ring->tail.load(std::memory_order_acquire)) {
+				ring->inUse = true;
+				_ring = ring.get();
+				return _ring;
+			}
+		}
+
+		rings.emplace_back(new Ring());
+		_ring = rings.back().get();
+	}
+	return _ring;
+}
+
+uint8_t *AsyncLog::Reserve(size_t size, bool &stopped)
+{
+	auto ring = ThreadRing();
+	size = (size + ALIGN - 1) & ~(ALIGN - 1);
+
+	// Stop() clears _running and then waits for every ring to stop writing,
+	// so either the record is committed before the final drain or the caller
+	// sees the log has stopped (both sides are sequentially consistent)
+	ring->writing.store(true);
+	stopped = !_running.load();
+	if (stopped) {
+		ring->writing.store(false, std::memory_order_release);
+		return nullptr;
+	}
+
+	auto head = ring->head.load(std::memory_order_relaxed);
+	auto tail = ring->tail.load(std::memory_order_acquire);
+
+	// Records are never split, so pad to the end of the ring if it doesn't fit before wrapping
+	auto untilWrap = Ring::SIZE - (head & (Ring::SIZE - 1));
+	auto padding = untilWrap < size ? untilWrap : 0;
+
+	while (size + padding > Ring::SIZE - (head - tail)) {
+		// Nobody will make space once the writer has stopped
+		if (!_blocking.load(std::memory_order_relaxed) || !IsRunning()) {
+			_dropped.fetch_add(1, std::memory_order_relaxed);
+			ring->writing.store(false, std::memory_order_release);
+			return nullptr;
+		}
+
+		wake.notify_one();
+		std::this_thread::sleep_for(std::chrono::microseconds(100));
+		tail = ring->tail.load(std::memory_order_acquire);
+	}
+
+	if (padding) {
+		// Padding is published right away, the consumer just skips over it
+		reinterpret_cast<Record *>(ring->At(head))->size = 0;
+		head += padding;
+		ring->head.store(head, std::memory_order_release);
+	}
+
+	auto record = reinterpret_cast<Record *>(ring->At(head));
+	record->size = uint32_t(size);
+	record->nanotime = Clock::Now();
+	ring->reserved = size;
+	return ring->At(head);
+}
+
+void AsyncLog::Commit()
+{
+	auto ring = _ring;
+	auto head = ring->head.load(std::memory_order_relaxed) + ring->reserved;
+	ring->head.store(head, std::memory_order_release);
+	ring->writing.store(false, std::memory_order_release);
+
+	// Wake the writer early (once) when a burst fills half the ring
+	auto used = head - ring->tail.load(std::memory_order_relaxed);
+	if (used >= Ring::SIZE / 2 && used - ring->reserved < Ring::SIZE / 2) {
+		wake.notify_one();
+	}
+	ring->reserved = 0;
+}
+
+void AsyncLog::WriteText(wxLogLevel level, const wxString &text)
+{
+	if (!IsRunning()) {
+		return; // nowhere to write it (wx already showed it)
+	}
+
+	auto utf8 = text.utf8_str();
+	auto len = utf8.length();
+
+	bool stopped;
+	auto p = Reserve(sizeof(Record) + StringSize(len), stopped);
+	if (!p) {
+		return;
+	}
+
+	auto record = reinterpret_cast<Record *>(p);
+	record->level = uint32_t(level);
+	record->format = nullptr;
+	record->formatter = &FormatText;
+	record->toSink = false;
+
+	p += sizeof(Record);
+	PutString(p, utf8.data(), len);
+	Commit();
+}
+
+void AsyncLog::ReleaseThread()
+{
+	if (_ring) {
+		std::lock_guard<std::mutex> lock(mu);
+		_ring->inUse = false;
+		_ring = nullptr;
+	}
+}
+
+void AsyncLog::Fallback(wxLogLevel level, const wxString &text)
+{
+	wxLogGeneric(level, "%s", text);
+}
+
+void AsyncLog::FormatText(const char *, const uint8_t *args, wxString &out)
+{
+	auto s = GetString(args);
+	out = wxString::FromUTF8(s.data(), s.size());
+}
+
+void AsyncLog::Target::DoLogTextAtLevel(wxLogLevel level, const wxString &msg)
+{
+	AsyncLog::WriteText(level, msg);
+}
+
+//-----------------------------------------------------------------------------
+// Consumer side
+
+bool AsyncLog::Start(const std::string &file)
+{
+	wxCHECK(!IsRunning(), false);
+
+	fout.open(file.c_str(), std::ofstream::out);
+	if (!fout) {
+		return false;
+	}
+
+	auto wallNow = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count();
+	wallOffset = wallNow - Clock::Now();
+
+	{
+		std::lock_guard<std::mutex> lock(mu);
+		stopping = false;
+	}
+
+	_running.store(true, std::memory_order_release);
+	writer = std::thread(&AsyncLog::Run);
+	return true;
+}
+
+void AsyncLog::Stop()
+{
+	if (!IsRunning()) {
+		return;
+	}
+
+	// Late writers fall back to wx from now on, wait for any already past that check
+	_running.store(false);
+	std::vector<Ring *> snapshot;
+	{
+		std::lock_guard<std::mutex> lock(mu);
+		for (auto &ring : rings) {
+			snapshot.push_back(ring.get());
+		}
+	}
+	for (auto ring : snapshot) {
+		while (ring->writing.load()) {
+			std::this_thread::yield();
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(mu);
+		stopping = true;
+	}
+	wake.notify_one();
+	writer.join();
+
+	Drain(true);
+	fout.close();
+}
+
+void AsyncLog::SetSink(Sink *s)
+{
+	std::lock_guard<std::mutex> lock(mu);
+	sink = s;
+}
+
+void AsyncLog::Run()
+{
+	std::unique_lock<std::mutex> lock(mu);
+	while (!stopping) {
+		wake.wait_for(lock, FLUSH_INTERVAL);
+
+		lock.unlock();
+		if (IsRunning()) {
+			Diagnostic::Tick(); // its summaries go out with this batch
+		}
+		Drain(false);
+		lock.lock();
+	}
+}
+
+void AsyncLog::Drain(bool final)
+{
+	struct Pending
+	{
+		int64_t nanotime;
+		Ring *ring;
+		const Record *record;
+
+		bool operator<(const Pending &other) const { return nanotime < other.nanotime; }
+	};
+
+	// Snapshot the rings (the list only grows, and rings are never freed while running)
+	std::vector<Ring *> snapshot;
+	{
+		std::lock_guard<std::mutex> lock(mu);
+		for (auto &ring : rings) {
+			snapshot.push_back(ring.get());
+		}
+	}
+
+	// Collect everything committed so far from every ring
+	std::vector<Pending> pending;
+	std::vector<uint64_t> ends(snapshot.size());
+	for (size_t i = 0; i < snapshot.size(); i++) {
+		auto ring = snapshot[i];
+		auto pos = ring->tail.load(std::memory_order_relaxed);
+		auto end = ring->head.load(std::memory_order_acquire);
+
+		while (pos < end) {
+			auto record = reinterpret_cast<const Record *>(ring->At(pos));
+			if (record->size == 0) {
+				pos += Ring::SIZE - (pos & (Ring::SIZE - 1)); // padding
+				continue;
+			}
+
+			Pending p = { record->nanotime, ring, record };
+			pending.push_back(p);
+			pos += record->size;
+		}
+		ends[i] = end;
+	}
+
+	if (pending.empty() && !final) {
+		return;
+	}
+
+	// Each ring is already in order, merge them all by time
+	std::stable_sort(pending.begin(), pending.end());
+
+	Lines lines;
+	lines.reserve(pending.size());
+	std::string out;
+
+	for (auto &p : pending) {
+		auto record = p.record;
+
+		Line line;
+		line.level = record->level;
+		line.time = time_t((record->nanotime + wallOffset) / 1000000000);
+		if (record->formatter) {
+			record->formatter(record->format, reinterpret_cast<const uint8_t *>(record + 1), line.text);
+		} else {
+			line.text = record->format;
+		}
+
+		// Same layout as wxLogStream (which wx has already given its own messages)
+		if (record->formatter != &FormatText) {
+			char stamp[32];
+			strftime(stamp, sizeof(stamp), "%H:%M:%S: ", localtime(&line.time));
+			out += stamp;
+			if (line.level == wxLOG_Error || line.level == wxLOG_FatalError) {
+				out += "Error: ";
+			} else if (line.level == wxLOG_Warning) {
+				out += "Warning: ";
+			}
+		}
+		out += line.text.utf8_str().data();
+		out += '\n';
+
+		if (record->toSink) {
+			lines.push_back(std::move(line));
+		}
+	}
+
+	// Records have been copied out, so let the producers reuse the space
+	for (size_t i = 0; i < snapshot.size(); i++) {
+		snapshot[i]->tail.store(ends[i], std::memory_order_release);
+	}
+
+	auto dropped = _dropped.load(std::memory_order_relaxed);
+	if (dropped != droppedReported) {
+		out += "Warning: log buffer full, dropped " + std::to_string(dropped - droppedReported) + " messages\n";
+		droppedReported = dropped;
+	}
+
+	fout.write(out.data(), out.size());
+	fout.flush();
+
+	std::lock_guard<std::mutex> lock(mu);
+	if (sink && !lines.empty()) {
+		(*sink)(lines);
+	}
+}
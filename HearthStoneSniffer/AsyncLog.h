@@ -0,0 +1,291 @@
+#pragma once
+
+#include <wx/log.h>
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+// VS2013 has no thread_local, only the POD-only __declspec(thread)
+#ifdef _MSC_VER
+#define HS_THREAD_LOCAL __declspec(thread)
+#else
+#define HS_THREAD_LOCAL __thread
+#endif
+
+// Asynchronous logger for the packet path.
+//
+// A log statement copies its format string pointer and its arguments (in a
+// compact binary form) into a ring owned by the calling thread. Nothing is
+// formatted and no lock is taken; if the ring is full the record is dropped
+// and counted. A background thread drains all rings, orders the records by
+// time, formats them and writes them to the log file (and an optional Sink,
+// e.g. the log window) in batches.
+//
+// Use the AsyncLogVerbose/Message/Warning/Error macros, the level check is
+// done before any of the arguments are evaluated. The format must be a string
+// literal (only its address is stored).
+class AsyncLog
+{
+public:
+	struct Line
+	{
+		wxLogLevel level;
+		time_t time;
+		wxString text;
+	};
+	typedef std::vector<Line> Lines;
+
+	// Receives every batch of formatted lines (on the background thread)
+	struct Sink
+	{
+		virtual void operator()(const Lines &lines) = 0;
+		virtual ~Sink() { }
+	};
+
+	// Forwards messages logged through wx (wxLogError etc.) to the log file
+	class Target : public wxLog
+	{
+	protected:
+		virtual void DoLogTextAtLevel(wxLogLevel level, const wxString &msg);
+	};
+
+	static bool Start(const std::string &file);
+	static void Stop(); // writes everything still queued before returning
+	static bool IsRunning() { return _running.load(std::memory_order_acquire); }
+
+	// Not owned, pass nullptr to remove
+	static void SetSink(Sink *sink);
+
+	static void SetVerbose(bool verbose = true) { _maxLevel.store(verbose ? wxLOG_Info : wxLOG_Message, std::memory_order_relaxed); }
+	static bool IsEnabled(wxLogLevel level) { return level <= _maxLevel.load(std::memory_order_relaxed); }
+
+	// Wait for space instead of dropping messages when a thread's buffer is
+	// full (for offline processing, where the log is the output)
+	static void SetBlocking(bool blocking = true) { _blocking.store(blocking, std::memory_order_relaxed); }
+
+	template <size_t N, typename... Args>
+	static void Write(wxLogLevel level, const char (&format)[N], const Args &... args);
+
+	// Pre-formatted text (not passed to the Sink, it's already been shown)
+	static void WriteText(wxLogLevel level, const wxString &text);
+
+	// Hand the calling thread's ring back for reuse by another thread.
+	// Anything it wrote is still logged. Call before a logging thread exits.
+	static void ReleaseThread();
+
+	static uint64_t Dropped() { return _dropped.load(std::memory_order_relaxed); }
+
+	struct Ring; // per-thread record buffer (opaque)
+
+private:
+	AsyncLog() {}
+
+	typedef void (*Formatter)(const char *format, const uint8_t *args, wxString &out);
+
+	struct Record
+	{
+		uint32_t size;     // including this header, 0 marks padding to the end of the ring
+		uint32_t level;
+		int64_t nanotime;  // Clock::Now()
+		const char *format;
+		Formatter formatter;
+		bool toSink;
+	};
+
+	static Ring *ThreadRing();
+	// Fills in Record::size and Record::nanotime. Returns nullptr if the
+	// record was dropped, or (with <stopped> set) if Stop() has begun.
+	static uint8_t *Reserve(size_t size, bool &stopped);
+	static void Commit();
+	static void Fallback(wxLogLevel level, const wxString &text);
+
+	// Argument encoding: plain values are copied, strings are length prefixed
+	template <typename T, typename Enable = void> struct Arg
+	{
+		static_assert(std::is_trivially_copyable<T>::value, "AsyncLog can only copy plain values (and strings)");
+
+		typedef T Stored;
+		static size_t Size(const T &) { return sizeof(T); }
+		static void Put(uint8_t *&p, const T &v) { std::memcpy(p, &v, sizeof(T)); p += sizeof(T); }
+		static T Get(const uint8_t *&p) { T v; std::memcpy(&v, p, sizeof(T)); p += sizeof(T); return v; }
+	};
+
+	static size_t StringSize(size_t len) { return sizeof(uint32_t) + len; }
+	static void PutString(uint8_t *&p, const char *s, size_t len)
+	{
+		auto n = uint32_t(len);
+		std::memcpy(p, &n, sizeof(n));
+		std::memcpy(p + sizeof(n), s, n);
+		p += sizeof(n) + n;
+	}
+	static std::string GetString(const uint8_t *&p)
+	{
+		uint32_t n;
+		std::memcpy(&n, p, sizeof(n));
+		std::string s(reinterpret_cast<const char *>(p + sizeof(n)), n);
+		p += sizeof(n) + n;
+		return s;
+	}
+
+	template <typename... Args> struct Sizes;
+	template <typename... Args> struct Putter;
+	template <typename Tuple, size_t I, size_t N> struct Getter;
+	template <size_t... I> struct Indices { };
+	template <size_t N, size_t... I> struct MakeIndices : MakeIndices<N - 1, N - 1, I...> { };
+	template <size_t... I> struct MakeIndices<0, I...> { typedef Indices<I...> Type; };
+
+	template <typename... Args> struct FormatterOf;
+	template <typename... Args> static void Format(const char *format, const uint8_t *args, wxString &out);
+	template <typename Tuple, size_t... I> static wxString Apply(const char *format, const Tuple &t, Indices<I...>);
+	static void FormatText(const char *format, const uint8_t *args, wxString &out);
+
+	static void Run();
+	static void Drain(bool final);
+
+	static std::atomic<bool> _running;
+	static std::atomic<wxLogLevel> _maxLevel;
+	static std::atomic<bool> _blocking;
+	static std::atomic<uint64_t> _dropped;
+	static HS_THREAD_LOCAL Ring *_ring;
+};
+
+template <typename T> struct AsyncLog::Arg<T, typename std::enable_if<std::is_same<T, std::string>::value>::type>
+{
+	typedef std::string Stored;
+	static size_t Size(const std::string &s) { return StringSize(s.size()); }
+	static void Put(uint8_t *&p, const std::string &s) { PutString(p, s.data(), s.size()); }
+	static std::string Get(const uint8_t *&p) { return GetString(p); }
+};
+
+template <typename T> struct AsyncLog::Arg<T, typename std::enable_if<std::is_same<T, const char *>::value || std::is_same<T, char *>::value>::type>
+{
+	typedef std::string Stored;
+	static size_t Size(const char *s) { return StringSize(s ? std::strlen(s) : 0); }
+	static void Put(uint8_t *&p, const char *s) { PutString(p, s ? s : "", s ? std::strlen(s) : 0); }
+	static std::string Get(const uint8_t *&p) { return GetString(p); }
+};
+
+template <typename T> struct AsyncLog::Arg<T, typename std::enable_if<std::is_same<T, wxString>::value>::type>
+{
+	typedef wxString Stored;
+	static size_t Size(const wxString &s) { return StringSize(s.utf8_str().length()); }
+	static void Put(uint8_t *&p, const wxString &s) { auto utf8 = s.utf8_str(); PutString(p, utf8.data(), utf8.length()); }
+	static wxString Get(const uint8_t *&p) { auto s = GetString(p); return wxString::FromUTF8(s.data(), s.size()); }
+};
+
+template <> struct AsyncLog::Sizes<>
+{
+	static size_t Get() { return 0; }
+};
+template <typename T, typename... Rest> struct AsyncLog::Sizes<T, Rest...>
+{
+	static size_t Get(const T &v, const Rest &... rest)
+	{
+		return Arg<typename std::decay<T>::type>::Size(v) + Sizes<Rest...>::Get(rest...);
+	}
+};
+
+template <> struct AsyncLog::Putter<>
+{
+	static void Put(uint8_t *&) { }
+};
+template <typename T, typename... Rest> struct AsyncLog::Putter<T, Rest...>
+{
+	static void Put(uint8_t *&p, const T &v, const Rest &... rest)
+	{
+		Arg<typename std::decay<T>::type>::Put(p, v);
+		Putter<Rest...>::Put(p, rest...);
+	}
+};
+
+template <typename Tuple, size_t I, size_t N> struct AsyncLog::Getter
+{
+	static void Get(Tuple &t, const uint8_t *&p)
+	{
+		typedef typename std::tuple_element<I, Tuple>::type Stored;
+		std::get<I>(t) = Arg<Stored>::Get(p);
+		Getter<Tuple, I + 1, N>::Get(t, p);
+	}
+};
+template <typename Tuple, size_t N> struct AsyncLog::Getter<Tuple, N, N>
+{
+	static void Get(Tuple &, const uint8_t *&) { }
+};
+
+// No formatter for plain text (wxString::Format needs at least one argument)
+template <typename... Args> struct AsyncLog::FormatterOf
+{
+	static Formatter Get() { return &Format<Args...>; }
+};
+template <> struct AsyncLog::FormatterOf<>
+{
+	static Formatter Get() { return nullptr; }
+};
+
+template <typename Tuple, size_t... I>
+wxString AsyncLog::Apply(const char *format, const Tuple &t, Indices<I...>)
+{
+	return wxString::Format(format, std::get<I>(t)...);
+}
+
+template <typename... Args>
+void AsyncLog::Format(const char *format, const uint8_t *args, wxString &out)
+{
+	typedef std::tuple<typename Arg<typename std::decay<Args>::type>::Stored...> Tuple;
+	Tuple t;
+	Getter<Tuple, 0, sizeof...(Args)>::Get(t, args);
+	out = Apply(format, t, typename MakeIndices<sizeof...(Args)>::Type());
+}
+
+template <size_t N, typename... Args>
+void AsyncLog::Write(wxLogLevel level, const char (&format)[N], const Args &... args)
+{
+	auto size = sizeof(Record) + Sizes<Args...>::Get(args...);
+	auto formatter = FormatterOf<Args...>::Get();
+
+	bool stopped = true;
+	if (IsRunning()) {
+		auto p = Reserve(size, stopped);
+		if (p) {
+			auto record = reinterpret_cast<Record *>(p);
+			record->level = uint32_t(level);
+			record->format = format;
+			record->formatter = formatter;
+			record->toSink = true;
+
+			p += sizeof(Record);
+			Putter<Args...>::Put(p, args...);
+			Commit();
+			return;
+		}
+		if (!stopped) {
+			return; // dropped (and counted)
+		}
+	}
+
+	// Nowhere to queue it, so just format it now
+	std::vector<uint8_t> buffer(size);
+	auto p = buffer.data();
+	Putter<Args...>::Put(p, args...);
+
+	wxString text = format;
+	if (formatter) {
+		formatter(format, buffer.data(), text);
+	}
+	Fallback(level, text);
+}
+
+#define AsyncLogAt(level, ...) \
+	do { if (AsyncLog::IsEnabled(level)) { AsyncLog::Write(level, __VA_ARGS__); } } while (0)
+
+#define AsyncLogError(...)   AsyncLogAt(wxLOG_Error, __VA_ARGS__)
+#define AsyncLogWarning(...) AsyncLogAt(wxLOG_Warning, __VA_ARGS__)
+#define AsyncLogMessage(...) AsyncLogAt(wxLOG_Message, __VA_ARGS__)
+#define AsyncLogVerbose(...) AsyncLogAt(wxLOG_Info, __VA_ARGS__)
@@ -0,0 +1,175 @@
+// wx #includes must come first to prevent secure function warning from wxcrt.h
+#include <wx/filename.h>
+#include <wx/log.h>
+
+#include "Batch.h"
+#include "AsyncLog.h"
+#include "Clock.h"
+#include "Metrics.h"
+
+#include <algorithm>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace {
+	struct Queue
+	{
+		std::mutex lock;
+		std::deque<size_t> files; // indexes into the results, largest first
+		uint64_t bytes;           // total size of <files> (guarded by lock)
+
+		Queue() : bytes(0) { }
+	};
+
+	// What the current worker thread is processing (read by the callbacks Run() creates)
+	HS_THREAD_LOCAL Batch::Result *current = nullptr;
+	HS_THREAD_LOCAL PacketCapture::Callback::Factory currentFactory = nullptr;
+
+	// Counts what goes into the real callback for the file's result
+	class Counting : public PacketCapture::Callback
+	{
+	public:
+		Counting(Batch::Result &result, Callback::Ptr callback)
+			: _result(result),
+			  _callback(std::move(callback))
+		{
+		}
+
+		virtual void operator()(int64_t nanotime, std::range<const uint8_t*> data)
+		{
+			_result.packets++;
+			_result.bytes += data.size();
+			(*_callback)(nanotime, data);
+		}
+
+		virtual void Flush()
+		{
+			_callback->Flush();
+		}
+
+		virtual void SetLinkType(int linkType)
+		{
+			_callback->SetLinkType(linkType);
+		}
+
+		static Callback::Ptr New()
+		{
+			return std::make_unique<Counting>(*current, currentFactory());
+		}
+
+	private:
+		Batch::Result &_result;
+		const Callback::Ptr _callback;
+	};
+
+	// Next file for worker <self>: its own largest, or the smallest of whoever has the most left
+	bool Take(size_t self, std::vector<Queue> &queues, Batch::Results &results, size_t &file)
+	{
+		auto &own = queues[self];
+		{
+			std::lock_guard<std::mutex> lock(own.lock);
+			if (!own.files.empty()) {
+				file = own.files.front();
+				own.files.pop_front();
+				own.bytes -= results[file].size;
+				return true;
+			}
+		}
+
+		// Files are never added once the workers start, so this only fails when everything's been taken
+		while (true) {
+			size_t victim = queues.size();
+			uint64_t most = 0;
+			for (size_t i = 0; i < queues.size(); i++) {
+				std::lock_guard<std::mutex> lock(queues[i].lock);
+				if (!queues[i].files.empty() && (victim == queues.size() || queues[i].bytes > most)) {
+					victim = i;
+					most = queues[i].bytes;
+				}
+			}
+			if (victim == queues.size()) {
+				return false;
+			}
+
+			std::lock_guard<std::mutex> lock(queues[victim].lock);
+			auto &other = queues[victim];
+			if (!other.files.empty()) {
+				file = other.files.back();
+				other.files.pop_back();
+				other.bytes -= results[file].size;
+				results[file].stolen = true;
+				return true;
+			}
+			// Emptied meanwhile, look again
+		}
+	}
+
+	void Work(size_t self, const std::string &filter, PacketCapture::Callback::Factory callbackFactory,
+		std::vector<Queue> &queues, Batch::Results &results)
+	{
+		currentFactory = callbackFactory;
+
+		size_t file;
+		while (Take(self, queues, results, file)) {
+			auto &result = results[file];
+			result.worker = int(self);
+
+			current = &result;
+			auto start = Clock::Now();
+			result.ok = PacketCapture::Run(filter, result.file, &Counting::New);
+			result.nanos = Clock::Now() - start;
+			current = nullptr;
+		}
+
+		AsyncLog::ReleaseThread();
+		Metrics::ReleaseThread();
+	}
+}
+
+Batch::Results Batch::Run(const std::string &filter, const std::vector<std::string> &files,
+	PacketCapture::Callback::Factory callbackFactory, unsigned workers)
+{
+	Results results(files.size());
+	wxCHECK(callbackFactory, results);
+
+	if (workers == 0) {
+		workers = std::max(1u, std::thread::hardware_concurrency());
+	}
+	workers = unsigned(std::min<size_t>(workers, std::max<size_t>(files.size(), 1)));
+
+	std::vector<size_t> order(files.size());
+	for (size_t i = 0; i < files.size(); i++) {
+		auto &result = results[i];
+		result.file = files[i];
+		auto size = wxFileName::GetSize(files[i]);
+		result.size = size == wxInvalidSize ? 0 : size.GetValue();
+		result.ok = false;
+		result.packets = 0;
+		result.bytes = 0;
+		result.nanos = 0;
+		result.worker = -1;
+		result.stolen = false;
+		order[i] = i;
+	}
+
+	// Deal the files out largest first, so every queue starts with its biggest file
+	std::stable_sort(order.begin(), order.end(), [&results](size_t a, size_t b) { return results[a].size > results[b].size; });
+
+	std::vector<Queue> queues(workers);
+	for (size_t i = 0; i < order.size(); i++) {
+		auto &queue = queues[i % workers];
+		queue.files.push_back(order[i]);
+		queue.bytes += results[order[i]].size;
+	}
+
+	std::vector<std::thread> threads;
+	for (unsigned i = 0; i < workers; i++) {
+		threads.emplace_back(&Work, i, std::cref(filter), callbackFactory, std::ref(queues), std::ref(results));
+	}
+	for (auto &thread : threads) {
+		thread.join();
+	}
+
+	return results;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "PacketCapture.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Runs many capture files through PacketCapture::Run() on a fixed pool of
+// worker threads.
+//
+// Every file gets its own parsing stack (a new callback from the factory), so
+// no stream or decoder state is shared between files or workers. Each worker
+// has its own queue, seeded largest file first, and a worker that runs out of
+// files steals from the worker with the most bytes left. The big files start
+// early and the small ones fill in the gaps at the end of the run.
+class Batch
+{
+public:
+	struct Result
+	{
+		std::string file;
+		uint64_t size;    // file size in bytes
+		bool ok;          // PacketCapture::Run() succeeded
+		uint64_t packets; // passed to the callback
+		uint64_t bytes;   // captured bytes passed to the callback
+		int64_t nanos;    // time spent processing the file
+		int worker;       // which worker processed it
+		bool stolen;      // taken from another worker's queue
+	};
+	typedef std::vector<Result> Results;
+
+	// Blocks until every file is done. The results are in the same order as
+	// <files>. <workers> == 0 uses one per hardware thread.
+	static Results Run(const std::string &filter, const std::vector<std::string> &files,
+		PacketCapture::Callback::Factory callbackFactory, unsigned workers = 0);
+
+private:
+	Batch() {}
+};
@@ -0,0 +1,560 @@
+// wx #includes must come first to prevent secure function warning from wxcrt.h
+#include <wx/log.h>
+#include <wx/string.h>
+
+#include "CaptureFile.h"
+#include "AsyncLog.h"
+
+#include <pcap.h>
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Captures past 2 GB need 64-bit file offsets (CMakeLists.txt sets _FILE_OFFSET_BITS for 32-bit Linux)
+static_assert(sizeof(off_t) >= 8, "off_t can't address large captures, build with _FILE_OFFSET_BITS=64");
+#endif
+
+namespace {
+
+// How much of the file is mapped at once (much less on 32-bit, it has to fit in the address space)
+const uint64_t WINDOW_SIZE = sizeof(void *) == 8 ? (uint64_t(1) << 30) : (uint64_t(64) << 20);
+
+// Read only mapping of a file, a window at a time
+class Mapping
+{
+public:
+	Mapping();
+	~Mapping();
+
+	bool Open(const std::string &file);
+	const std::string &Name() const { return _name; }
+	uint64_t Size() const { return _size; }
+
+	// [offset, offset + length) of the file, or nullptr if that's past the end.
+	// Only valid until the next call.
+	const uint8_t *Get(uint64_t offset, size_t length);
+
+private:
+	bool Map(uint64_t offset, size_t length);
+	void Unmap();
+
+	std::string _name;
+	uint64_t _size;
+	uint64_t _granularity; // window offsets must be a multiple of this
+
+	const uint8_t *_view;
+	uint64_t _viewOffset;
+	size_t _viewLength;
+
+#ifdef _WIN32
+	HANDLE _file;
+	HANDLE _mapping;
+#else
+	int _fd;
+#endif
+
+	Mapping(const Mapping &);
+	Mapping &operator=(const Mapping &);
+};
+
+const uint8_t *Mapping::Get(uint64_t offset, size_t length)
+{
+	if (offset > _size || length > _size - offset) {
+		return nullptr;
+	}
+
+	if (!_view || offset < _viewOffset || offset + length > _viewOffset + _viewLength) {
+		// Slide the window forward (it's at least big enough for this record)
+		Unmap();
+		auto start = offset - offset % _granularity;
+		auto end = std::min(_size, std::max(start + WINDOW_SIZE, offset + length));
+		if (!Map(start, size_t(end - start))) {
+			return nullptr;
+		}
+	}
+
+	return _view + (offset - _viewOffset);
+}
+
+#ifdef _WIN32
+Mapping::Mapping()
+	: _size(0), _granularity(1), _view(nullptr), _viewOffset(0), _viewLength(0),
+	  _file(INVALID_HANDLE_VALUE), _mapping(NULL)
+{
+}
+
+Mapping::~Mapping()
+{
+	Unmap();
+	if (_mapping) {
+		CloseHandle(_mapping);
+	}
+	if (_file != INVALID_HANDLE_VALUE) {
+		CloseHandle(_file);
+	}
+}
+
+bool Mapping::Open(const std::string &file)
+{
+	_name = file;
+
+	// The sequential scan flag is the hint for the cache manager (there's no madvise)
+	_file = CreateFileW(wxString(file).wc_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (_file == INVALID_HANDLE_VALUE) {
+		wxLogError("CreateFile(%s): %d", file, GetLastError());
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(_file, &size)) {
+		wxLogError("GetFileSizeEx(%s): %d", file, GetLastError());
+		return false;
+	}
+	_size = uint64_t(size.QuadPart);
+	if (_size == 0) {
+		return true; // can't map an empty file, but there's nothing to read either
+	}
+
+	_mapping = CreateFileMapping(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!_mapping) {
+		wxLogError("CreateFileMapping(%s): %d", file, GetLastError());
+		return false;
+	}
+
+	SYSTEM_INFO info;
+	GetSystemInfo(&info);
+	_granularity = info.dwAllocationGranularity;
+	return true;
+}
+
+bool Mapping::Map(uint64_t offset, size_t length)
+{
+	auto view = MapViewOfFile(_mapping, FILE_MAP_READ, DWORD(offset >> 32), DWORD(offset), length);
+	if (!view) {
+		wxLogError("MapViewOfFile(%s): %d", _name, GetLastError());
+		return false;
+	}
+
+	_view = static_cast<const uint8_t *>(view);
+	_viewOffset = offset;
+	_viewLength = length;
+	return true;
+}
+
+void Mapping::Unmap()
+{
+	if (_view) {
+		UnmapViewOfFile(_view);
+		_view = nullptr;
+	}
+}
+#else
+Mapping::Mapping()
+	: _size(0), _granularity(1), _view(nullptr), _viewOffset(0), _viewLength(0),
+	  _fd(-1)
+{
+}
+
+Mapping::~Mapping()
+{
+	Unmap();
+	if (_fd != -1) {
+		close(_fd);
+	}
+}
+
+bool Mapping::Open(const std::string &file)
+{
+	_name = file;
+
+	_fd = open(file.c_str(), O_RDONLY);
+	if (_fd == -1) {
+		wxLogError("open(%s): %s", file, strerror(errno));
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(_fd, &st) == -1) {
+		wxLogError("fstat(%s): %s", file, strerror(errno));
+		return false;
+	}
+	_size = uint64_t(st.st_size);
+	_granularity = uint64_t(sysconf(_SC_PAGESIZE));
+
+#ifdef POSIX_FADV_SEQUENTIAL
+	posix_fadvise(_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+	return true;
+}
+
+bool Mapping::Map(uint64_t offset, size_t length)
+{
+	auto view = mmap(nullptr, length, PROT_READ, MAP_PRIVATE, _fd, off_t(offset));
+	if (view == MAP_FAILED) {
+		wxLogError("mmap(%s): %s", _name, strerror(errno));
+		return false;
+	}
+
+	// Read ahead aggressively, and drop the pages once they've been passed
+	madvise(view, length, MADV_SEQUENTIAL);
+
+	_view = static_cast<const uint8_t *>(view);
+	_viewOffset = offset;
+	_viewLength = length;
+	return true;
+}
+
+void Mapping::Unmap()
+{
+	if (_view) {
+		munmap(const_cast<uint8_t *>(_view), _viewLength);
+		_view = nullptr;
+	}
+}
+#endif
+
+// Little or big endian fields, depending on who wrote the file
+struct Endian
+{
+	bool swapped;
+
+	uint16_t U16(const uint8_t *p) const
+	{
+		uint16_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return swapped ? uint16_t(v >> 8 | v << 8) : v;
+	}
+
+	uint32_t U32(const uint8_t *p) const
+	{
+		uint32_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return swapped ? (v >> 24 | (v >> 8 & 0xff00) | (v << 8 & 0xff0000) | v << 24) : v;
+	}
+
+	uint64_t U64(const uint8_t *p) const
+	{
+		uint64_t v;
+		std::memcpy(&v, p, sizeof(v));
+		if (swapped) {
+			uint64_t r = 0;
+			for (int i = 0; i < 8; i++, v >>= 8) {
+				r = r << 8 | (v & 0xff);
+			}
+			v = r;
+		}
+		return v;
+	}
+};
+
+const int64_t NSEC_PER_SEC = 1000000000;
+
+// Link layer type and timestamp units of a capture interface, and the filter compiled for it
+class Interface
+{
+public:
+	Interface(int linktype, uint32_t snaplen) : _linktype(linktype), _snaplen(snaplen), _filtered(false), _decimal(true), _exponent(6), _offset(0) { }
+	~Interface() { if (_filtered) pcap_freecode(&_bpf); }
+
+	int Linktype() const { return _linktype; }
+
+	// pcapng if_tsresol: 10^-n or 2^-n seconds per tick
+	void SetResolution(uint8_t resolution)
+	{
+		_decimal = !(resolution & 0x80);
+		_exponent = resolution & 0x7f;
+	}
+
+	// pcapng if_tsoffset
+	void SetOffset(int64_t seconds) { _offset = seconds * NSEC_PER_SEC; }
+
+	int64_t ToNanoTime(uint64_t ticks) const
+	{
+		if (!_decimal) {
+			if (_exponent >= 64) {
+				return _offset;
+			}
+			auto mask = (uint64_t(1) << _exponent) - 1;
+			return _offset + int64_t((ticks >> _exponent) * NSEC_PER_SEC + (((ticks & mask) * NSEC_PER_SEC) >> _exponent));
+		}
+
+		if (_exponent <= 9) {
+			int64_t multiplier = 1;
+			for (int i = _exponent; i < 9; i++) {
+				multiplier *= 10;
+			}
+			return _offset + int64_t(ticks) * multiplier;
+		}
+
+		uint64_t divisor = 1;
+		for (int i = 9; i < _exponent && i < 27; i++) {
+			divisor *= 10;
+		}
+		return _offset + int64_t(ticks / divisor);
+	}
+
+	bool Compile(const std::string &filter)
+	{
+		if (filter.empty()) {
+			return true;
+		}
+
+		// A dead handle just to get a filter for this link type
+		auto pcap = pcap_open_dead(_linktype, _snaplen ? _snaplen : 65535);
+		if (!pcap) {
+			wxLogError("pcap_open_dead(%d)", _linktype);
+			return false;
+		}
+		_filtered = pcap_compile(pcap, &_bpf, filter.c_str(), 1, 0) != -1;
+		if (!_filtered) {
+			wxLogError("pcap_compile(%s): %s", filter, pcap_geterr(pcap));
+		}
+		pcap_close(pcap);
+		return _filtered;
+	}
+
+	bool Matches(const uint8_t *data, uint32_t caplen, uint32_t len)
+	{
+		if (!_filtered) {
+			return true;
+		}
+
+		pcap_pkthdr header;
+		header.ts.tv_sec = 0;
+		header.ts.tv_usec = 0;
+		header.caplen = caplen;
+		header.len = len;
+		return pcap_offline_filter(&_bpf, &header, data) != 0;
+	}
+
+private:
+	const int _linktype;
+	const uint32_t _snaplen;
+	bpf_program _bpf;
+	bool _filtered;
+	bool _decimal;
+	int _exponent;
+	int64_t _offset;
+
+	Interface(const Interface &);
+	Interface &operator=(const Interface &);
+};
+
+// <linkType> is what the callback was last told the link type is
+void Deliver(PacketCapture::Callback &callback, int &linkType, Interface &iface, uint64_t ticks, const uint8_t *data, uint32_t caplen, uint32_t len)
+{
+	if (!iface.Matches(data, caplen, len)) {
+		return;
+	}
+
+	// A pcapng file can mix interfaces of different types
+	if (iface.Linktype() != linkType) {
+		linkType = iface.Linktype();
+		callback.SetLinkType(linkType);
+	}
+
+	if (caplen < len) {
+		AsyncLogWarning("truncated packet (%d of %d bytes)", caplen, len);
+		// Will likely fail during packet parsing (truncated payload)
+	}
+
+	callback(iface.ToNanoTime(ticks), std::make_range(data, data + caplen));
+}
+
+//-----------------------------------------------------------------------------
+// Classic pcap: a file header followed by (header, data) records
+
+const uint32_t PCAP_MAGIC_USEC = 0xa1b2c3d4;
+const uint32_t PCAP_MAGIC_NSEC = 0xa1b23c4d;
+const size_t PCAP_FILE_HEADER = 24;
+const size_t PCAP_RECORD_HEADER = 16;
+
+CaptureFile::Status ReadPcap(Mapping &file, const std::string &filter, PacketCapture::Callback &callback)
+{
+	auto header = file.Get(0, PCAP_FILE_HEADER);
+	if (!header) {
+		return CaptureFile::UNSUPPORTED;
+	}
+
+	Endian endian = { false };
+	auto magic = endian.U32(header);
+	endian.swapped = magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC;
+	magic = endian.U32(header);
+	if ((magic != PCAP_MAGIC_USEC && magic != PCAP_MAGIC_NSEC) || endian.U16(header + 4) != 2) {
+		return CaptureFile::UNSUPPORTED;
+	}
+
+	// The upper bits of the link type may hold FCS information
+	Interface iface(int(endian.U32(header + 20) & 0x03ffffff), endian.U32(header + 16));
+	if (magic == PCAP_MAGIC_NSEC) {
+		iface.SetResolution(9);
+	}
+	if (!iface.Compile(filter)) {
+		return CaptureFile::FAILED;
+	}
+
+	// Ticks are combined from seconds and fractions, so convert the fraction to the same units
+	uint64_t perSecond = magic == PCAP_MAGIC_NSEC ? NSEC_PER_SEC : 1000000;
+
+	int linkType = -1;
+	uint64_t offset = PCAP_FILE_HEADER;
+	while (offset < file.Size()) {
+		auto record = file.Get(offset, PCAP_RECORD_HEADER);
+		if (!record) {
+			wxLogWarning("%s: truncated record header at offset %llu", file.Name(), (unsigned long long)offset);
+			break;
+		}
+
+		auto seconds = endian.U32(record);
+		auto fraction = endian.U32(record + 4);
+		auto caplen = endian.U32(record + 8);
+		auto len = endian.U32(record + 12);
+
+		auto data = file.Get(offset + PCAP_RECORD_HEADER, caplen);
+		if (!data) {
+			wxLogWarning("%s: truncated record at offset %llu", file.Name(), (unsigned long long)offset);
+			break;
+		}
+
+		Deliver(callback, linkType, iface, uint64_t(seconds) * perSecond + fraction, data, caplen, len);
+		offset += PCAP_RECORD_HEADER + caplen;
+	}
+	return CaptureFile::READ;
+}
+
+//-----------------------------------------------------------------------------
+// pcapng: a sequence of (type, length, body, length) blocks
+
+const uint32_t BLOCK_SECTION_HEADER = 0x0a0d0d0a;
+const uint32_t BLOCK_INTERFACE = 1;
+const uint32_t BLOCK_SIMPLE_PACKET = 3;
+const uint32_t BLOCK_ENHANCED_PACKET = 6;
+const uint32_t BYTE_ORDER_MAGIC = 0x1a2b3c4d;
+const uint16_t OPTION_END = 0;
+const uint16_t OPTION_TSRESOL = 9;
+const uint16_t OPTION_TSOFFSET = 14;
+const size_t BLOCK_OVERHEAD = 12; // type and both lengths
+
+uint32_t Pad4(uint32_t n) { return (n + 3) & ~3u; }
+
+CaptureFile::Status ReadPcapng(Mapping &file, const std::string &filter, PacketCapture::Callback &callback)
+{
+	auto first = file.Get(0, 12);
+	Endian endian = { false };
+	if (!first || endian.U32(first) != BLOCK_SECTION_HEADER) {
+		return CaptureFile::UNSUPPORTED;
+	}
+
+	std::vector<std::unique_ptr<Interface>> interfaces; // of the current section
+	int linkType = -1;
+
+	uint64_t offset = 0;
+	while (offset < file.Size()) {
+		auto block = file.Get(offset, 12);
+		if (!block) {
+			wxLogWarning("%s: truncated block header at offset %llu", file.Name(), (unsigned long long)offset);
+			break;
+		}
+
+		// A section header sets the byte order of everything up to the next one
+		if (endian.U32(block) == BLOCK_SECTION_HEADER) {
+			endian.swapped = false;
+			if (endian.U32(block + 8) != BYTE_ORDER_MAGIC) {
+				endian.swapped = true;
+				if (endian.U32(block + 8) != BYTE_ORDER_MAGIC) {
+					wxLogError("%s: bad section header at offset %llu", file.Name(), (unsigned long long)offset);
+					return CaptureFile::FAILED;
+				}
+			}
+			interfaces.clear();
+		}
+
+		auto type = endian.U32(block);
+		auto length = endian.U32(block + 4);
+		if (length < BLOCK_OVERHEAD || length % 4) {
+			wxLogError("%s: bad block length %u at offset %llu", file.Name(), length, (unsigned long long)offset);
+			return CaptureFile::FAILED;
+		}
+
+		block = file.Get(offset, length);
+		if (!block) {
+			wxLogWarning("%s: truncated block at offset %llu", file.Name(), (unsigned long long)offset);
+			break;
+		}
+		auto body = block + 8;
+		auto bodyLength = length - uint32_t(BLOCK_OVERHEAD);
+
+		if (type == BLOCK_INTERFACE && bodyLength >= 8) {
+			std::unique_ptr<Interface> iface(new Interface(endian.U16(body), endian.U32(body + 4)));
+
+			// Options are (code, length, value padded to 4 bytes)
+			for (uint32_t pos = 8; pos + 4 <= bodyLength;) {
+				auto code = endian.U16(body + pos);
+				auto optionLength = endian.U16(body + pos + 2);
+				if (code == OPTION_END || pos + 4 + optionLength > bodyLength) {
+					break;
+				}
+				auto value = body + pos + 4;
+				if (code == OPTION_TSRESOL && optionLength >= 1) {
+					iface->SetResolution(value[0]);
+				} else if (code == OPTION_TSOFFSET && optionLength >= 8) {
+					iface->SetOffset(int64_t(endian.U64(value)));
+				}
+				pos += 4 + Pad4(optionLength);
+			}
+
+			if (!iface->Compile(filter)) {
+				return CaptureFile::FAILED;
+			}
+			interfaces.push_back(std::move(iface));
+		} else if (type == BLOCK_ENHANCED_PACKET && bodyLength >= 20) {
+			auto id = endian.U32(body);
+			auto ticks = uint64_t(endian.U32(body + 4)) << 32 | endian.U32(body + 8);
+			auto caplen = endian.U32(body + 12);
+			auto len = endian.U32(body + 16);
+			if (id >= interfaces.size() || caplen > bodyLength - 20) {
+				wxLogError("%s: bad packet block at offset %llu", file.Name(), (unsigned long long)offset);
+				return CaptureFile::FAILED;
+			}
+			Deliver(callback, linkType, *interfaces[id], ticks, body + 20, caplen, len);
+		} else if (type == BLOCK_SIMPLE_PACKET && bodyLength >= 4) {
+			// Always from the first interface, and no timestamp
+			if (interfaces.empty()) {
+				wxLogError("%s: packet block before any interface at offset %llu", file.Name(), (unsigned long long)offset);
+				return CaptureFile::FAILED;
+			}
+			auto len = endian.U32(body);
+			Deliver(callback, linkType, *interfaces[0], 0, body + 4, std::min(len, bodyLength - 4), len);
+		}
+		// Anything else (statistics, name resolution, ...) is skipped
+
+		offset += length;
+	}
+	return CaptureFile::READ;
+}
+
+} // namespace
+
+CaptureFile::Status CaptureFile::Read(const std::string &filter, const std::string &file, PacketCapture::Callback &callback)
+{
+	Mapping mapping;
+	if (!mapping.Open(file)) {
+		return FAILED;
+	}
+
+	auto status = ReadPcap(mapping, filter, callback);
+	if (status == UNSUPPORTED) {
+		status = ReadPcapng(mapping, filter, callback);
+	}
+	return status;
+}
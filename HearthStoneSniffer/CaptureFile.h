@@ -0,0 +1,29 @@
+#pragma once
+
+#include "PacketCapture.h"
+
+#include <string>
+
+// Reader for classic pcap and pcapng capture files.
+//
+// The file is memory mapped and the record headers are walked in place, every
+// packet is passed to the callback as a range pointing into the mapping, so
+// nothing is copied and there's no read() per record. The file is mapped a
+// window at a time with sequential access hints, so it can be much larger than
+// the address space (or RAM).
+class CaptureFile
+{
+public:
+	enum Status
+	{
+		READ,        // every packet in the file was passed to the callback
+		FAILED,      // couldn't be opened, filtered or parsed (logged)
+		UNSUPPORTED, // not a (known version of a) pcap or pcapng file
+	};
+
+	// Pass every packet in <file> matching <filter> (BPF syntax, empty for all) to <callback>
+	static Status Read(const std::string &filter, const std::string &file, PacketCapture::Callback &callback);
+
+private:
+	CaptureFile() {}
+};
@@ -0,0 +1,90 @@
+// wx #includes must come first to prevent secure function warning from wxcrt.h
+#include <wx/log.h>
+
+#include "CaptureFilter.h"
+#include "AsyncLog.h"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <vector>
+
+std::atomic<uint64_t> CaptureFilter::_generation(0);
+std::atomic<size_t> CaptureFilter::_count(0);
+
+namespace {
+	std::mutex mu; // guards rejected, sequence
+	std::map<tcp::EndpointPair, uint64_t> rejected; // by the lower endpoint first, to the order rejected
+	uint64_t sequence = 0;
+
+	// One key for both directions
+	tcp::EndpointPair Key(const tcp::EndpointPair &endpoints)
+	{
+		return endpoints.Dst() < endpoints.Src() ? endpoints.Reversed() : endpoints;
+	}
+
+	std::string Match(const tcp::EndpointPair &endpoints)
+	{
+		auto &a = endpoints.Src();
+		auto &b = endpoints.Dst();
+		return "(host " + a.Ip().ToString() + " and port " + std::to_string(a.Port()) +
+			" and host " + b.Ip().ToString() + " and port " + std::to_string(b.Port()) + ")";
+	}
+}
+
+void CaptureFilter::Reject(const tcp::EndpointPair &endpoints)
+{
+	std::lock_guard<std::mutex> lock(mu);
+	if (rejected.insert(std::make_pair(Key(endpoints), ++sequence)).second) {
+		// Only the most recent make it into the program, so there's no need to
+		// remember more (the oldest may never be released, e.g. an IPv6
+		// connection whose FIN was filtered out too)
+		if (rejected.size() > MAX_REJECTED) {
+			rejected.erase(std::min_element(rejected.begin(), rejected.end(),
+				[](const std::pair<const tcp::EndpointPair, uint64_t> &a, const std::pair<const tcp::EndpointPair, uint64_t> &b) { return a.second < b.second; }));
+		}
+		_count.store(rejected.size(), std::memory_order_relaxed);
+		_generation.fetch_add(1, std::memory_order_release);
+		AsyncLogVerbose("%s is not a game, filtering it out", endpoints.SrcToDst());
+	}
+}
+
+void CaptureFilter::Release(const tcp::EndpointPair &endpoints)
+{
+	if (_count.load(std::memory_order_relaxed) == 0) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> lock(mu);
+	if (rejected.erase(Key(endpoints))) {
+		_count.store(rejected.size(), std::memory_order_relaxed);
+		_generation.fetch_add(1, std::memory_order_release);
+	}
+}
+
+std::string CaptureFilter::Build(const std::string &base)
+{
+	// Most recently rejected first
+	std::vector<std::pair<uint64_t, tcp::EndpointPair>> recent;
+	{
+		std::lock_guard<std::mutex> lock(mu);
+		for (auto &entry : rejected) {
+			recent.push_back(std::make_pair(entry.second, entry.first));
+		}
+	}
+	if (recent.empty()) {
+		return base;
+	}
+
+	auto count = std::min<size_t>(recent.size(), MAX_REJECTED);
+	std::partial_sort(recent.begin(), recent.begin() + count, recent.end(),
+		[](const std::pair<uint64_t, tcp::EndpointPair> &a, const std::pair<uint64_t, tcp::EndpointPair> &b) { return a.first > b.first; });
+
+	std::string flows;
+	for (size_t i = 0; i < count; i++) {
+		flows += i ? " or " : "";
+		flows += Match(recent[i].second);
+	}
+
+	return "(" + base + ") and not ((" + flows + ") and not (ip and tcp[tcpflags] & (tcp-fin|tcp-rst) != 0))";
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "tcp/Endpoint.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Connections on the game ports that turned out not to be games (e.g.
+// Battle.net traffic on 1119), so live capture can stop the kernel copying
+// them to us at all.
+//
+// Decoders reject a connection once its data shows it isn't a game, and
+// release it when the stream goes away. Live capture compiles the list into
+// its BPF program (see PacketCapture::Dispatch()), so the filter only ever
+// gets narrower than the base one; new connections are always let through
+// until they've been looked at.
+class CaptureFilter
+{
+public:
+	// Either direction of the connection
+	static void Reject(const tcp::EndpointPair &endpoints);
+	static void Release(const tcp::EndpointPair &endpoints);
+
+	// Changes whenever the list does
+	static uint64_t Generation() { return _generation.load(std::memory_order_acquire); }
+
+	// <base> without the rejected connections (only the most recent MAX_REJECTED
+	// are kept).
+	// FIN and RST segments of IPv4 connections still pass so their streams
+	// can end (libpcap can't index TCP headers over IPv6).
+	static std::string Build(const std::string &base);
+
+	// Keeps the BPF program well under the kernel's instruction limit
+	enum { MAX_REJECTED = 64 };
+
+	// Least time between swapping in a new program on a handle
+	enum { MIN_SWAP_MILLISECONDS = 1000 };
+
+private:
+	CaptureFilter() {}
+
+	static std::atomic<uint64_t> _generation;
+	static std::atomic<size_t> _count; // lets Release() skip the lock when nothing's rejected
+};
@@ -0,0 +1,306 @@
+// wx #includes must come first to prevent secure function warning from wxcrt.h
+#include <wx/log.h>
+
+#include "CaptureSupervisor.h"
+#include "AsyncLog.h"
+#include "Metrics.h"
+
+#include <pcap.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace {
+	// Linux pseudo-device that captures from every device
+	const char *const ANY_DEVICE = "any";
+}
+
+struct CaptureSupervisor::Device
+{
+	std::string name;
+	std::string description;
+	unsigned slot;      // for CPU placement
+	pcap_t *pcap;       // while in the capture loop (to break out of it)
+	bool active;        // the thread is running
+	bool listed;        // found by the last scan
+	unsigned failures;  // in a row
+	TimePoint started;
+	TimePoint retryAt;
+	std::thread thread;
+
+	Device() : slot(0), pcap(nullptr), active(false), listed(true), failures(0) { }
+};
+
+CaptureSupervisor::CaptureSupervisor(const std::string &filter, PacketCapture::Callback::Factory callbackFactory, const Options &options)
+	: _filter(filter),
+	  _callbackFactory(callbackFactory),
+	  _options(options),
+	  _running(false),
+	  _rescan(false),
+	  _exited(false),
+	  _nextSlot(0),
+	  _changed(*this)
+{
+}
+
+CaptureSupervisor::~CaptureSupervisor()
+{
+	Stop();
+}
+
+void CaptureSupervisor::Start()
+{
+	wxCHECK2(_callbackFactory, return);
+
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		wxCHECK2(!_running && !_scanner.joinable(), return);
+
+		_running = true;
+		_rescan = true;
+	}
+
+	// Watch first so nothing that changes during the first scan is missed
+	_watcher.reset(new DeviceWatcher(_changed));
+	bool watching = _watcher->IsWatching();
+	if (!watching) {
+		wxLogMessage("scanning for network devices every %d s", _options.rescanInterval);
+	}
+
+	// Decided here, Stop() may reset the watcher before the scanner gets going
+	auto interval = watching ? _options.watchedRescanInterval : _options.rescanInterval;
+
+	std::lock_guard<std::mutex> lock(_lock);
+	_scanner = std::thread(&CaptureSupervisor::Scan, this, interval);
+}
+
+void CaptureSupervisor::Stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		if (!_running) {
+			return;
+		}
+		_running = false;
+
+		// Devices see this when their read returns (within the capture timeout)
+		for (auto &device : _devices) {
+			if (device->pcap) {
+				pcap_breakloop(device->pcap);
+			}
+		}
+	}
+	_wake.notify_all();
+
+	// Stop the events before what they wake up
+	_watcher.reset();
+
+	// No new device threads are started once the scanner is gone, and only it
+	// changes the device list, so that can be walked without the lock now
+	_scanner.join();
+	for (auto &device : _devices) {
+		if (device->thread.joinable()) {
+			device->thread.join();
+		}
+	}
+	_devices.clear();
+	_rescan = false;
+
+	wxLogMessage("stopped capturing");
+}
+
+void CaptureSupervisor::Rescan()
+{
+	{
+		std::lock_guard<std::mutex> lock(_lock);
+		_rescan = true;
+	}
+	_wake.notify_all();
+}
+
+std::vector<std::string> CaptureSupervisor::Devices() const
+{
+	std::lock_guard<std::mutex> lock(_lock);
+
+	std::vector<std::string> names;
+	for (auto &device : _devices) {
+		if (device->active) {
+			names.push_back(device->name);
+		}
+	}
+	return names;
+}
+
+void CaptureSupervisor::Scan(int rescanInterval)
+{
+	auto nextScan = std::chrono::steady_clock::now();
+	auto interval = std::chrono::seconds(rescanInterval);
+
+	std::unique_lock<std::mutex> lock(_lock);
+	while (_running) {
+		auto now = std::chrono::steady_clock::now();
+		bool retry = _rescan;
+		bool scan = _rescan || now >= nextScan;
+		_exited = false;
+
+		// List the devices without holding up Stop() or the device threads
+		pcap_if_t *alldevs = nullptr;
+		if (scan) {
+			_rescan = false;
+			nextScan = now + interval;
+
+			lock.unlock();
+			char errbuf[PCAP_ERRBUF_SIZE];
+			if (pcap_findalldevs(&alldevs, errbuf) == -1) {
+				wxLogError("pcap_findalldevs: %s", errbuf);
+				alldevs = nullptr;
+				scan = false; // keep capturing on what we have
+			}
+			lock.lock();
+		}
+
+		auto wake = std::min(nextScan, Update(now, alldevs, scan, retry));
+
+		if (alldevs) {
+			pcap_freealldevs(alldevs);
+		}
+
+		_wake.wait_until(lock, wake, [this]() { return !_running || _rescan || _exited; });
+	}
+}
+
+CaptureSupervisor::TimePoint CaptureSupervisor::Update(TimePoint now, pcap_if_t *found, bool scanned, bool retry)
+{
+	// Called with _lock held
+	if (scanned) {
+		for (auto &device : _devices) {
+			device->listed = false;
+		}
+
+		bool any = false;
+		for (auto dev = found; dev != nullptr && _options.anyDevice; dev = dev->next) {
+			any = any || std::strcmp(dev->name, ANY_DEVICE) == 0;
+		}
+
+		for (auto dev = found; dev != nullptr; dev = dev->next) {
+			if (any && std::strcmp(dev->name, ANY_DEVICE) != 0) {
+				continue; // the others are all seen through it
+			}
+
+			auto it = std::find_if(_devices.begin(), _devices.end(),
+				[dev](const std::unique_ptr<Device> &device) { return device->name == dev->name; });
+			if (it != _devices.end()) {
+				(*it)->listed = true;
+				continue;
+			}
+
+			std::unique_ptr<Device> device(new Device());
+			device->name = dev->name;
+			device->description = dev->description ? dev->description : "";
+			device->slot = _nextSlot++;
+			device->retryAt = now;
+			_devices.push_back(std::move(device));
+		}
+	}
+
+	auto wake = TimePoint::max();
+	for (auto it = _devices.begin(); it != _devices.end();) {
+		auto &device = **it;
+
+		// The thread has finished with everything but returning
+		if (!device.active && device.thread.joinable()) {
+			device.thread.join();
+		}
+
+		if (device.active) {
+			// Gone, stop capturing (it's forgotten once the thread has finished)
+			if (!device.listed && device.pcap) {
+				wxLogMessage("%s has gone, stopping capture", device.name);
+				pcap_breakloop(device.pcap);
+				device.pcap = nullptr;
+			}
+			++it;
+		} else if (!device.listed) {
+			// Gone (unplugged, VPN disconnected), a later scan starts it again if it comes back
+			it = _devices.erase(it);
+		} else if (retry || now >= device.retryAt) {
+			wxLogMessage("listening to %s (%s)", device.name, device.description);
+			device.active = true;
+			device.started = now;
+			device.thread = std::thread(&CaptureSupervisor::Run, this, std::ref(device));
+			++it;
+		} else {
+			wake = std::min(wake, device.retryAt);
+			++it;
+		}
+	}
+	return wake;
+}
+
+void CaptureSupervisor::Run(Device &device)
+{
+	if (_options.firstCpu >= 0) {
+		Threads::PinCurrent(unsigned(_options.firstCpu) + device.slot);
+	}
+	if (_options.priority != Threads::PRIORITY_NORMAL) {
+		Threads::SetPriority(_options.priority);
+	}
+
+	bool stopped = false;
+	pcap_t *pcap = PacketCapture::OpenLive(device.name);
+	if (pcap && PacketCapture::SetFilter(pcap, _filter)) {
+		auto callback = _callbackFactory();
+
+		bool running;
+		{
+			std::lock_guard<std::mutex> lock(_lock);
+			running = _running;
+			device.pcap = running ? pcap : nullptr;
+		}
+
+		if (running) {
+			stopped = PacketCapture::Dispatch(pcap, *callback, _options.narrowFilter ? _filter : std::string());
+
+			std::lock_guard<std::mutex> lock(_lock);
+			device.pcap = nullptr;
+		} else {
+			stopped = true;
+		}
+
+		// Process anything held back (e.g. partially filled FlowSharder chunks)
+		// before destroying the parsing stack, which may still log
+		callback->Flush();
+		callback.reset();
+	}
+
+	if (pcap) {
+		pcap_close(pcap);
+	}
+	AsyncLog::ReleaseThread();
+	Metrics::ReleaseThread();
+
+	std::lock_guard<std::mutex> lock(_lock);
+	device.active = false;
+	_exited = true;
+
+	if (!stopped) {
+		// Start the backoff over if it had been running for a good while
+		auto now = std::chrono::steady_clock::now();
+		if (now - device.started >= std::chrono::seconds(_options.maxRestartDelay)) {
+			device.failures = 0;
+		}
+
+		auto delay = _options.restartDelay;
+		for (unsigned i = 0; i < device.failures && delay < _options.maxRestartDelay; i++) {
+			delay *= 2;
+		}
+		delay = std::min(delay, _options.maxRestartDelay);
+		device.failures++;
+		device.retryAt = now + std::chrono::seconds(delay);
+
+		wxLogWarning("capture on %s stopped, retrying in %d s", device.name, delay);
+	}
+
+	// Let the scanner join this thread (and schedule the retry)
+	_wake.notify_all();
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "DeviceWatcher.h"
+#include "PacketCapture.h"
+#include "Threads.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Runs live capture on every network device, one thread per device.
+//
+// A scanner thread lists the devices and starts capturing on any new ones,
+// and stops capturing on any that have gone. Where device changes can be
+// watched (DeviceWatcher) that happens as soon as they're reported, with a
+// slow periodic scan as a fallback, otherwise the scan is just periodic. A
+// device whose capture fails (e.g. the adapter went away while the
+// machine slept) is reopened after a delay that doubles with every failure in
+// a row. Every thread is owned here: Stop() stops the scanner, breaks each
+// device out of its capture loop and waits for its callback to be destroyed,
+// so whatever the parsing stack still holds has been processed once it
+// returns.
+class CaptureSupervisor
+{
+public:
+	struct Options
+	{
+		// Seconds between device scans, when device changes can't be watched
+		// and when they can (in case an event is missed)
+		int rescanInterval;
+		int watchedRescanInterval;
+
+		// Seconds before reopening a failed device, doubling up to maxRestartDelay
+		int restartDelay;
+		int maxRestartDelay;
+
+		// Pin device thread i (in the order found) to CPU firstCpu + i (-1 to leave them unpinned)
+		int firstCpu;
+
+		Threads::Priority priority;
+
+		// Capture everything through the Linux "any" device (one thread) when
+		// it's there, instead of a thread per device
+		bool anyDevice;
+
+		// Stop the kernel passing on connections found not to be games (CaptureFilter)
+		bool narrowFilter;
+
+		Options() : rescanInterval(60), watchedRescanInterval(600), restartDelay(1), maxRestartDelay(60), firstCpu(-1), priority(Threads::PRIORITY_NORMAL), anyDevice(true), narrowFilter(true) { }
+	};
+
+	CaptureSupervisor(const std::string &filter, PacketCapture::Callback::Factory callbackFactory, const Options &options = Options());
+
+	// Stops everything first
+	~CaptureSupervisor();
+
+	void Start();
+	void Stop();
+
+	// Scan for devices now instead of waiting for the next scan (e.g. they
+	// changed), and retry failed devices without waiting for their delay
+	void Rescan();
+
+	// Names of the devices being captured
+	std::vector<std::string> Devices() const;
+
+private:
+	struct Device;
+
+	struct Changed : DeviceWatcher::Callback
+	{
+		CaptureSupervisor &supervisor;
+
+		explicit Changed(CaptureSupervisor &supervisor) : supervisor(supervisor) { }
+		virtual void operator()() { supervisor.Rescan(); }
+	};
+	typedef std::chrono::steady_clock::time_point TimePoint;
+
+	void Scan(int rescanInterval); // seconds
+	TimePoint Update(TimePoint now, pcap_if_t *found, bool scanned, bool retry);
+	void Run(Device &device);
+
+	const std::string _filter;
+	const PacketCapture::Callback::Factory _callbackFactory;
+	const Options _options;
+
+	mutable std::mutex _lock; // guards everything below
+	std::condition_variable _wake;
+	bool _running;
+	bool _rescan;
+	bool _exited; // a device thread has finished
+	unsigned _nextSlot; // CPU placement of the next new device
+	std::vector<std::unique_ptr<Device>> _devices;
+	std::thread _scanner;
+
+	Changed _changed;
+	std::unique_ptr<DeviceWatcher> _watcher; // owned by Start()/Stop()
+
+	CaptureSupervisor(const CaptureSupervisor &);
+	CaptureSupervisor &operator=(const CaptureSupervisor &);
+};
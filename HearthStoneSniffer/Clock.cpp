@@ -0,0 +1,61 @@
+#include "Clock.h"
+
+#ifdef _WIN32
+#include <windows.h>
+
+// Initialized at startup (function local statics aren't thread safe on VS2013)
+static const int64_t frequency = []() {
+	LARGE_INTEGER f;
+	QueryPerformanceFrequency(&f);
+	return f.QuadPart;
+}();
+
+int64_t Clock::Now()
+{
+	LARGE_INTEGER counter;
+	QueryPerformanceCounter(&counter);
+
+	// Split the conversion to avoid overflowing the multiplication
+	const int64_t NSEC_PER_SEC = 1000000000;
+	auto seconds = counter.QuadPart / frequency;
+	auto remainder = counter.QuadPart % frequency;
+	return seconds * NSEC_PER_SEC + remainder * NSEC_PER_SEC / frequency;
+}
+
+// The system time only ticks every few milliseconds before Windows 8, so the
+// wall clock is the performance counter plus the offset between them at startup
+static const int64_t wallOffset = []() {
+	FILETIME ft;
+	GetSystemTimeAsFileTime(&ft);
+
+	// 100ns intervals since 1601
+	const int64_t EPOCH_DIFFERENCE = 116444736000000000LL;
+	auto intervals = int64_t(ft.dwHighDateTime) << 32 | ft.dwLowDateTime;
+	return (intervals - EPOCH_DIFFERENCE) * 100 - Clock::Now();
+}();
+
+int64_t Clock::Wall()
+{
+	return Now() + wallOffset;
+}
+#else
+#include <time.h>
+
+int64_t Clock::Now()
+{
+	const int64_t NSEC_PER_SEC = 1000000000;
+
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+int64_t Clock::Wall()
+{
+	const int64_t NSEC_PER_SEC = 1000000000;
+
+	timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+#endif
@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstdint>
+
+// Monotonic high resolution clock. std::chrono::steady_clock isn't usable for
+// this on VS2013 (it's backed by the low resolution system clock).
+class Clock
+{
+public:
+	// Nanoseconds since an arbitrary (but fixed) point
+	static int64_t Now();
+
+	// Nanoseconds since the Unix epoch, comparable with capture timestamps
+	static int64_t Wall();
+
+private:
+	Clock() {}
+};
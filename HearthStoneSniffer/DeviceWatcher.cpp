@@ -0,0 +1,137 @@
+// wx #includes must come first to prevent secure function warning from wxcrt.h
+#include <wx/log.h>
+
+#include "DeviceWatcher.h"
+#include "AsyncLog.h"
+
+#include <cstdint>
+
+#ifdef __linux__
+#include <asm/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+DeviceWatcher::DeviceWatcher(Callback &callback)
+	: _callback(callback),
+	  _socket(-1)
+{
+	_stop[0] = _stop[1] = -1;
+
+	_socket = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+	if (_socket == -1) {
+		wxLogWarning("rtnetlink socket: %d", errno);
+		return;
+	}
+
+	sockaddr_nl addr = {};
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR;
+	if (bind(_socket, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == -1) {
+		wxLogWarning("rtnetlink bind: %d", errno);
+		return;
+	}
+
+	if (pipe2(_stop, O_CLOEXEC) == -1) {
+		wxLogWarning("pipe: %d", errno);
+		return;
+	}
+
+	_thread = std::thread(&DeviceWatcher::Run, this);
+}
+
+DeviceWatcher::~DeviceWatcher()
+{
+	if (_thread.joinable()) {
+		char stop = 0;
+		while (write(_stop[1], &stop, 1) == -1 && errno == EINTR) {
+		}
+		_thread.join();
+	}
+
+	for (auto fd : { _socket, _stop[0], _stop[1] }) {
+		if (fd != -1) {
+			close(fd);
+		}
+	}
+}
+
+void DeviceWatcher::Run()
+{
+	// Big enough for a burst of link messages (a full one is reported as ENOBUFS)
+	static const size_t BUFFER_SIZE = 16 * 1024;
+	std::unique_ptr<uint8_t[]> buffer(new uint8_t[BUFFER_SIZE]);
+
+	pollfd fds[2] = {
+		{ _socket, POLLIN, 0 },
+		{ _stop[0], POLLIN, 0 },
+	};
+
+	while (true) {
+		if (poll(fds, 2, -1) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			AsyncLogWarning("rtnetlink poll: %d", errno);
+			break;
+		}
+		if (fds[1].revents) {
+			break;
+		}
+
+		// Read everything queued, one callback for the whole burst
+		bool changed = false;
+		while (true) {
+			auto len = recv(_socket, buffer.get(), BUFFER_SIZE, MSG_DONTWAIT);
+			if (len == -1) {
+				if (errno == ENOBUFS) {
+					changed = true; // missed some, so assume the worst
+					continue;
+				} else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+					AsyncLogWarning("rtnetlink recv: %d", errno);
+				}
+				break;
+			}
+
+			auto header = reinterpret_cast<nlmsghdr *>(buffer.get());
+			for (auto left = int(len); NLMSG_OK(header, left); header = NLMSG_NEXT(header, left)) {
+				switch (header->nlmsg_type) {
+				case RTM_NEWLINK:
+				case RTM_DELLINK:
+				case RTM_NEWADDR:
+				case RTM_DELADDR:
+					changed = true;
+					break;
+				}
+			}
+		}
+
+		if (changed) {
+			_callback();
+		}
+	}
+
+	AsyncLog::ReleaseThread();
+}
+#else
+DeviceWatcher::DeviceWatcher(Callback &callback)
+	: _callback(callback),
+	  _socket(-1)
+{
+	_stop[0] = _stop[1] = -1;
+}
+
+DeviceWatcher::~DeviceWatcher()
+{
+}
+
+void DeviceWatcher::Run()
+{
+}
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <memory>
+#include <thread>
+
+// Tells its owner when network devices or their addresses change, so capture
+// can start on a new device (e.g. after resume or when a VPN connects) right
+// away instead of at the next periodic scan.
+//
+// Linux subscribes to rtnetlink link and address events. Elsewhere nothing is
+// watched (IsWatching() is false) and the owner has to keep polling.
+class DeviceWatcher
+{
+public:
+	struct Callback
+	{
+		// Called on the watcher's thread, keep it short
+		virtual void operator()() = 0;
+		virtual ~Callback() { }
+	};
+
+	// Starts watching, <callback> must outlive this
+	explicit DeviceWatcher(Callback &callback);
+	~DeviceWatcher();
+
+	bool IsWatching() const { return _thread.joinable(); }
+
+private:
+	void Run();
+
+	Callback &_callback;
+	int _socket;     // rtnetlink
+	int _stop[2];    // pipe, written to stop Run()
+	std::thread _thread;
+
+	DeviceWatcher(const DeviceWatcher &);
+	DeviceWatcher &operator=(const DeviceWatcher &);
+};
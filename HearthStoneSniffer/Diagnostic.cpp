@@ -0,0 +1,94 @@
+// wx #includes must come first to prevent secure function warning from wxcrt.h
+#include <wx/log.h>
+
+#include "Diagnostic.h"
+#include "Clock.h"
+#include "Metrics.h"
+
+// Zero initialized before any constructor runs
+Diagnostic *Diagnostic::_first;
+
+Diagnostic::Diagnostic(wxLogLevel level, const char *what, uint32_t burst, int intervalSeconds)
+	: _level(level),
+	  _what(what),
+	  _burst(burst),
+	  _interval(intervalSeconds * int64_t(1000000000)),
+	  _next(_first)
+{
+	_count = 0;
+	_suppressed = 0;
+	_windowStart = 0;
+	_windowCount = 0;
+
+	// Only called during static initialization, so no locking
+	_first = this;
+}
+
+bool Diagnostic::Hit()
+{
+	_count.fetch_add(1, std::memory_order_relaxed);
+
+	Close(Clock::Now());
+
+	if (_windowCount.fetch_add(1, std::memory_order_relaxed) < _burst) {
+		return true;
+	}
+
+	_suppressed.fetch_add(1, std::memory_order_relaxed);
+	return false;
+}
+
+void Diagnostic::Close(int64_t now)
+{
+	// Only one thread wins the exchange
+	auto start = _windowStart.load(std::memory_order_relaxed);
+	if (now - start >= _interval && _windowStart.compare_exchange_strong(start, now, std::memory_order_relaxed)) {
+		Summarize(now - start);
+	}
+}
+
+void Diagnostic::Summarize(int64_t elapsed)
+{
+	auto count = _windowCount.exchange(0, std::memory_order_relaxed);
+	if (count > _burst) {
+		auto seconds = (long long)(elapsed / 1000000000);
+		AsyncLogAt(_level, "%u %s in last %llds", count, _what, seconds);
+	}
+}
+
+void Diagnostic::Flush()
+{
+	auto now = Clock::Now();
+	auto start = _windowStart.exchange(now, std::memory_order_relaxed);
+	Summarize(now - start);
+}
+
+void Diagnostic::FlushAll()
+{
+	for (auto diag = _first; diag; diag = diag->_next) {
+		diag->Flush();
+	}
+}
+
+void Diagnostic::Tick()
+{
+	auto now = Clock::Now();
+	for (auto diag = _first; diag; diag = diag->_next) {
+		// Quiet ones start their next interval at their next hit
+		if (diag->_windowCount.load(std::memory_order_relaxed)) {
+			diag->Close(now);
+		}
+	}
+}
+
+// Every call site's count, labelled by its description
+static struct DiagnosticCollector : Metrics::Collector
+{
+	void operator()(std::string &out)
+	{
+		Metrics::Header(out, "hs_diagnostics_total", "counter", "Occurrences of each diagnostic (logged or suppressed).");
+		for (auto diag = Diagnostic::First(); diag; diag = diag->Next()) {
+			out += wxString::Format("hs_diagnostics_total{what=\"%s\"} %llu\n", Metrics::Escape(diag->What()), (unsigned long long)diag->Count()).ToStdString();
+		}
+	}
+} diagnosticCollector;
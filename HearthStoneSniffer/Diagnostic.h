@@ -0,0 +1,68 @@
+#pragma once
+
+#include "AsyncLog.h"
+
+#include <atomic>
+#include <cstdint>
+
+// Counter and rate limiter for one diagnostic call site on the packet path.
+//
+// Every occurrence is counted, but only the first few in each interval are
+// logged. When an interval with suppressed messages ends, a single summary
+// ("1532 truncated IPv4 headers in last 10s") is logged instead. Intervals
+// are closed by Tick() (the AsyncLog writer calls it), or by the next Hit()
+// when nothing ticks. Instances
+// are meant to be file scope statics (function local statics aren't thread
+// safe on VS2013), they register themselves so the counts can be reported.
+class Diagnostic
+{
+public:
+	// <what> is a plural description used in summaries, e.g. "truncated IPv4 headers"
+	Diagnostic(wxLogLevel level, const char *what, uint32_t burst = 5, int intervalSeconds = 10);
+
+	wxLogLevel Level() const { return _level; }
+	const char *What() const { return _what; }
+
+	// Count an occurrence, returns whether it should be logged
+	bool Hit();
+
+	uint64_t Count() const { return _count.load(std::memory_order_relaxed); }
+	uint64_t Suppressed() const { return _suppressed.load(std::memory_order_relaxed); }
+
+	// Log the summary for the current interval now (e.g. at shutdown)
+	void Flush();
+
+	// All instances, in no particular order
+	static Diagnostic *First() { return _first; }
+	Diagnostic *Next() const { return _next; }
+
+	static void FlushAll();
+
+	// Summarize every interval that has ended (called periodically)
+	static void Tick();
+
+private:
+	// Start a new interval if this one is over at <now>
+	void Close(int64_t now);
+	void Summarize(int64_t elapsed);
+
+	const wxLogLevel _level;
+	const char *const _what;
+	const uint32_t _burst;
+	const int64_t _interval; // nanoseconds
+
+	std::atomic<uint64_t> _count;
+	std::atomic<uint64_t> _suppressed;
+	std::atomic<int64_t> _windowStart;
+	std::atomic<uint32_t> _windowCount;
+
+	Diagnostic *_next;
+	static Diagnostic *_first;
+
+	Diagnostic(const Diagnostic &);
+	Diagnostic &operator=(const Diagnostic &);
+};
+
+// Log through <diag> (a Diagnostic) if it isn't being rate limited
+#define DiagnosticLog(diag, ...) \
+	do { if ((diag).Hit()) { AsyncLogAt((diag).Level(), __VA_ARGS__); } } while (0)
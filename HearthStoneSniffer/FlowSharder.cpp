@@ -0,0 +1,271 @@
+// wx #includes must come first to prevent secure function warning from wxcrt.h
+#include <wx/log.h>
+
+#include "FlowSharder.h"
+#include "AsyncLog.h"
+#include "Clock.h"
+#include "Metrics.h"
+#include "Threads.h"
+#include "tcp/Segment.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <limits>
+#include <mutex>
+#include <thread>
+
+namespace {
+	// A chunk is handed over when it holds this much
+	const size_t CHUNK_BYTES = 256 * 1024;
+	const size_t CHUNK_PACKETS = 2048;
+
+	// Chunks waiting for each shard before the caller has to wait
+	const size_t QUEUED_CHUNKS = 8;
+
+	const int64_t NO_PACKETS = std::numeric_limits<int64_t>::max();
+	const int64_t NSEC_PER_SEC = 1000000000;
+}
+
+static Metrics::Counter sharderStalls("hs_sharder_stalls_total", "Times the capture thread waited for a full shard queue.");
+static Metrics::Counter sharderChunks("hs_sharder_chunks_total", "Chunks of packets parsed by shard threads.");
+
+struct FlowSharder::Chunk
+{
+	struct Packet
+	{
+		int64_t nanotime;
+		uint32_t offset; // into data
+		uint32_t size;
+	};
+
+	int linkType;
+	std::vector<uint8_t> data;
+	std::vector<Packet> packets;
+};
+
+struct FlowSharder::Shard
+{
+	std::mutex lock; // guards everything up to <filling>
+	std::condition_variable ready; // a chunk was queued (or done was set)
+	std::condition_variable space; // a chunk was taken off the queue
+	std::deque<std::unique_ptr<Chunk>> queue;
+	std::vector<std::unique_ptr<Chunk>> spare;
+	bool done;
+	uint64_t maxQueued;
+
+	std::unique_ptr<Chunk> filling; // caller only
+
+	// Written by one thread each, read by anyone
+	std::atomic<uint64_t> packets;
+	std::atomic<uint64_t> bytes;
+	std::atomic<uint64_t> stalls;
+	std::atomic<uint64_t> chunks;
+	std::atomic<int64_t> busy;
+
+	std::thread thread;
+
+	Shard() : done(false), maxQueued(0) { packets = 0; bytes = 0; stalls = 0; chunks = 0; busy = 0; }
+};
+
+FlowSharder::FlowSharder(unsigned shards, Callback::Factory callbackFactory, const Options &options)
+	: _options(options),
+	  _start(Clock::Now()),
+	  _linkType(tcp::LinkLayer::ETHERNET),
+	  _link(&tcp::LinkLayer::Ethernet),
+	  _oldest(NO_PACKETS),
+	  _lastReport(_start)
+{
+	wxCHECK2(callbackFactory, return);
+
+	for (unsigned i = 0; i < std::max(shards, 1u); i++) {
+		_shards.emplace_back(new Shard());
+	}
+	for (size_t i = 0; i < _shards.size(); i++) {
+		auto cpu = _options.firstCpu >= 0 ? _options.firstCpu + int(i) : -1;
+		_shards[i]->thread = std::thread(&FlowSharder::Work, std::ref(*_shards[i]), callbackFactory, cpu);
+	}
+}
+
+FlowSharder::~FlowSharder()
+{
+	Flush();
+
+	for (auto &shard : _shards) {
+		std::lock_guard<std::mutex> lock(shard->lock);
+		shard->done = true;
+		shard->ready.notify_one();
+	}
+	for (auto &shard : _shards) {
+		shard->thread.join();
+	}
+
+	if (_options.reportInterval > 0) {
+		Report();
+	}
+}
+
+void FlowSharder::operator()(int64_t nanotime, std::range<const uint8_t*> data)
+{
+	if (_shards.empty()) {
+		return;
+	}
+
+	// Frames without a connection (not TCP, or malformed) all go to the first shard
+	uint32_t hash;
+	auto &shard = *_shards[tcp::Segment::FlowHash(data, hash, _link) ? hash % _shards.size() : 0];
+	shard.packets.fetch_add(1, std::memory_order_relaxed);
+	shard.bytes.fetch_add(data.size(), std::memory_order_relaxed);
+
+	auto &chunk = shard.filling;
+	if (!chunk) {
+		std::lock_guard<std::mutex> lock(shard.lock);
+		if (!shard.spare.empty()) {
+			chunk = std::move(shard.spare.back());
+			shard.spare.pop_back();
+		} else {
+			chunk.reset(new Chunk());
+			chunk->data.reserve(CHUNK_BYTES + 65536);
+			chunk->packets.reserve(CHUNK_PACKETS);
+		}
+		chunk->linkType = _linkType;
+	}
+
+	Chunk::Packet packet = { nanotime, uint32_t(chunk->data.size()), uint32_t(data.size()) };
+	chunk->data.insert(chunk->data.end(), data.begin(), data.end());
+	chunk->packets.push_back(packet);
+	_oldest = std::min(_oldest, nanotime);
+
+	if (chunk->data.size() >= CHUNK_BYTES || chunk->packets.size() >= CHUNK_PACKETS) {
+		Push(shard);
+	}
+
+	// Don't let a slow trickle of packets sit in partial chunks
+	if (_options.maxDelay > 0 && nanotime - _oldest >= _options.maxDelay) {
+		Flush();
+	}
+}
+
+void FlowSharder::Flush()
+{
+	for (auto &shard : _shards) {
+		if (shard->filling) {
+			Push(*shard);
+		}
+	}
+	_oldest = NO_PACKETS;
+
+	if (_options.reportInterval > 0) {
+		auto now = Clock::Now();
+		if (now - _lastReport >= _options.reportInterval * NSEC_PER_SEC) {
+			_lastReport = now;
+			Report();
+		}
+	}
+}
+
+void FlowSharder::SetLinkType(int linkType)
+{
+	// Chunks only hold one link type
+	Flush();
+
+	_linkType = linkType;
+	_link = tcp::LinkLayer::ForLinkType(linkType);
+}
+
+FlowSharder::Stats FlowSharder::GetStats(unsigned shard) const
+{
+	Stats stats = {};
+	if (shard < _shards.size()) {
+		auto &s = *_shards[shard];
+		stats.packets = s.packets.load(std::memory_order_relaxed);
+		stats.bytes = s.bytes.load(std::memory_order_relaxed);
+		stats.chunks = s.chunks.load(std::memory_order_relaxed);
+		stats.stalls = s.stalls.load(std::memory_order_relaxed);
+		stats.busy = s.busy.load(std::memory_order_relaxed);
+
+		std::lock_guard<std::mutex> lock(s.lock);
+		stats.maxQueued = s.maxQueued;
+	}
+	return stats;
+}
+
+void FlowSharder::Report() const
+{
+	uint64_t total = 0;
+	for (unsigned i = 0; i < Shards(); i++) {
+		total += GetStats(i).packets;
+	}
+
+	auto elapsed = double(std::max<int64_t>(Clock::Now() - _start, 1));
+	for (unsigned i = 0; i < Shards(); i++) {
+		auto stats = GetStats(i);
+		AsyncLogMessage("shard %u: %llu packets (%.1f%%), %.1f MB, %.1f%% busy, %llu stalls, at most %llu chunks queued",
+			i, (unsigned long long)stats.packets, total ? 100.0 * stats.packets / total : 0.0,
+			double(stats.bytes) / (1024 * 1024), 100.0 * stats.busy / elapsed,
+			(unsigned long long)stats.stalls, (unsigned long long)stats.maxQueued);
+	}
+}
+
+void FlowSharder::Push(Shard &shard)
+{
+	std::unique_lock<std::mutex> lock(shard.lock);
+	if (shard.queue.size() >= QUEUED_CHUNKS) {
+		shard.stalls.fetch_add(1, std::memory_order_relaxed);
+		sharderStalls.Add();
+		while (shard.queue.size() >= QUEUED_CHUNKS) {
+			shard.space.wait(lock);
+		}
+	}
+	shard.queue.push_back(std::move(shard.filling));
+	shard.maxQueued = std::max<uint64_t>(shard.maxQueued, shard.queue.size());
+	shard.ready.notify_one();
+}
+
+void FlowSharder::Work(Shard &shard, Callback::Factory callbackFactory, int cpu)
+{
+	if (cpu >= 0) {
+		Threads::PinCurrent(unsigned(cpu));
+	}
+
+	Callback::Ptr callback = callbackFactory();
+	int linkType = -1;
+
+	std::unique_lock<std::mutex> lock(shard.lock);
+	while (true) {
+		while (shard.queue.empty() && !shard.done) {
+			shard.ready.wait(lock);
+		}
+		if (shard.queue.empty()) {
+			break; // done, and nothing left
+		}
+
+		auto chunk = std::move(shard.queue.front());
+		shard.queue.pop_front();
+		shard.space.notify_one();
+		lock.unlock();
+
+		auto start = Clock::Now();
+		if (chunk->linkType != linkType) {
+			linkType = chunk->linkType;
+			callback->SetLinkType(linkType);
+		}
+
+		const uint8_t *base = chunk->data.data();
+		for (auto &packet : chunk->packets) {
+			(*callback)(packet.nanotime, std::make_range(base + packet.offset, base + packet.offset + packet.size));
+		}
+		chunk->data.clear();
+		chunk->packets.clear();
+		shard.busy.fetch_add(Clock::Now() - start, std::memory_order_relaxed);
+		shard.chunks.fetch_add(1, std::memory_order_relaxed);
+		sharderChunks.Add();
+
+		lock.lock();
+		shard.spare.push_back(std::move(chunk));
+	}
+	lock.unlock();
+
+	PacketCapture::EndThread(callback);
+}
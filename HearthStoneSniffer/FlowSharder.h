@@ -0,0 +1,87 @@
+#pragma once
+
+#include "PacketCapture.h"
+#include "tcp/LinkLayer.h"
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Spreads one stream of packets over several worker threads by connection.
+//
+// Packets are hashed with tcp::Segment::FlowHash(), so both directions of a
+// connection always go to the same shard, and each shard has its own callback
+// (e.g. a tcp::Parser) created on its own thread. The packets are copied into
+// chunks which are handed over a whole chunk at a time, and a shard's packets
+// are processed in the order they were passed in, so every connection is seen
+// exactly as it would be by a single callback. The queue for each shard is
+// bounded; the caller blocks if a shard falls too far behind.
+class FlowSharder : public PacketCapture::Callback
+{
+public:
+	struct Options
+	{
+		// Hand partial chunks over once they hold a packet this old (capture
+		// time, in nanoseconds). 0 only hands over full chunks, which is fine
+		// offline but adds latency to a quiet live capture.
+		int64_t maxDelay;
+
+		// Pin shard i to CPU firstCpu + i (-1 to leave them unpinned)
+		int firstCpu;
+
+		// Log the load of each shard this often, and when done (seconds, 0 for never)
+		int reportInterval;
+
+		Options() : maxDelay(0), firstCpu(-1), reportInterval(0) { }
+	};
+
+	// Load statistics for one shard
+	struct Stats
+	{
+		uint64_t packets;
+		uint64_t bytes;
+		uint64_t chunks;    // handed to the worker
+		uint64_t stalls;    // times the caller waited for space in the queue
+		uint64_t maxQueued; // most chunks waiting at once
+		int64_t busy;       // nanoseconds the worker spent in its callback
+	};
+
+	FlowSharder(unsigned shards, Callback::Factory callbackFactory, const Options &options = Options());
+
+	// Processes everything already passed in, then stops the workers
+	virtual ~FlowSharder();
+
+	virtual void operator()(int64_t nanotime, std::range<const uint8_t*> data);
+
+	// Hand over partially filled chunks now (e.g. when a live capture goes quiet)
+	virtual void Flush();
+
+	// Passed on to every shard's callback (in order with the packets)
+	virtual void SetLinkType(int linkType);
+
+	unsigned Shards() const { return unsigned(_shards.size()); }
+
+	Stats GetStats(unsigned shard) const;
+
+	// Log the load of every shard
+	void Report() const;
+
+private:
+	struct Chunk;
+	struct Shard;
+
+	void Push(Shard &shard);
+	static void Work(Shard &shard, Callback::Factory callbackFactory, int cpu);
+
+	const Options _options;
+	const int64_t _start;        // Clock::Now()
+	int _linkType;
+	tcp::LinkLayer::Strip _link; // for the flow hash
+	int64_t _oldest;             // capture time of the oldest packet in any partial chunk
+	int64_t _lastReport;         // Clock::Now()
+
+	std::vector<std::unique_ptr<Shard>> _shards;
+
+	FlowSharder(const FlowSharder &);
+	FlowSharder &operator=(const FlowSharder &);
+};
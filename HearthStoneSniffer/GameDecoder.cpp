@@ -3,8 +3,10 @@
 #include <wx/wfstream.h>
 #include <wx/zstream.h>
 
-#include "HSSnifferApp.h"
-#include "Helper.h"
+#include "AsyncLog.h"
+#include "CaptureFilter.h"
+#include "LatencyTrace.h"
+#include "Metrics.h"
 
 #include "StartGameState.pb.h"
 #include "PowerHistory.pb.h"
@@ -12,32 +14,85 @@
 #include "GameDecoder.h"
 
 #include <algorithm>
+#include <cstring>
 #include <iomanip>
 #include <iostream>
 
+static Metrics::Counter canceledLogs("hs_decoder_canceled_total", "Game logs canceled (bad header or stream closed mid-message).");
+static Metrics::Counter framedMessages("hs_decoder_framed_messages_total", "Messages framed from reassembled streams.");
+static Metrics::Distribution responseTimes("hs_decoder_response_seconds", "Time from a CHOOSE_OPTION to the next POWER_HISTORY.", 1e-9);
+
+// Messages and bytes decoded for each packet type (kept by PacketDispatch)
+static struct PacketCollector : Metrics::Collector
+{
+	void operator()(std::string &out)
+	{
+		Metrics::Header(out, "hs_decoder_messages_total", "counter", "Messages decoded, by packet type.");
+		for (int slot = 0; slot < PACKET_SLOT_COUNT; slot++) {
+			out += wxString::Format("hs_decoder_messages_total{type=\"%s\"} %llu\n", PacketSlotName(slot),
+				(unsigned long long)GameDecoder::Stats(slot).messages.load(std::memory_order_relaxed)).ToStdString();
+		}
+
+		Metrics::Header(out, "hs_decoder_bytes_total", "counter", "Message bytes decoded, by packet type.");
+		for (int slot = 0; slot < PACKET_SLOT_COUNT; slot++) {
+			out += wxString::Format("hs_decoder_bytes_total{type=\"%s\"} %llu\n", PacketSlotName(slot),
+				(unsigned long long)GameDecoder::Stats(slot).bytes.load(std::memory_order_relaxed)).ToStdString();
+		}
+	}
+} packetCollector;
+
 template <typename T> void swap_clear(T &v) { if (!v.empty()) { T x; v.swap(x); } }
 
+// Whether <header> has a known type and a plausible size
+static bool plausibleHeader(const uint8_t *header, uint32_t &size)
+{
+	uint32_t fields[2];
+	std::memcpy(fields, header, sizeof(fields));
+	size = fields[1];
+	return IsKnownPacketType(fields[0]) && size <= GameDecoder::MAX_MESSAGE_SIZE;
+}
+
 class GameDecoder::Decode
 {
-	typedef std::vector<byte> Bytes;
+	typedef std::vector<uint8_t> Bytes;
 	typedef std::pair<int64_t, Bytes> Message;
 	typedef std::vector<Message> MessageList;
 
 public:
-	Decode(std::string name, int64_t nanotime)
-		: _name(std::move(name))
+	Decode(const tcp::EndpointPair &endpoints, int64_t nanotime)
+		: _endpoints(endpoints),
+		  _name(),
+		  _partial(false),
+		  _choseAt(0),
+		  _responseTimes()
 	{
-		wxLogVerbose("%lld %s logging", nanotime, _name);
+		AsyncLogVerbose("%lld %s logging", nanotime, Name());
 		_messages.emplace_back(nanotime, Bytes());
 	}
 
 	~Decode()
 	{
+		if (_responseTimes) {
+			auto &times = *_responseTimes;
+			AsyncLogVerbose("%s response time %llu samples (p50 %llu us, p99 %llu us, max %llu us)", Name(),
+				times.Count(), times.Percentile(0.5) / 1000, times.Percentile(0.99) / 1000, times.Max() / 1000);
+			GameDecoder::_responseTimes.Merge(times);
+		}
+
 		if (_messages.size() <= 1) {
 			return;
 		}
 	}
 
+	// A stream was picked up mid-game, so the earlier state is missing
+	void Attach(int64_t nanotime)
+	{
+		if (_messages.size() == 1 && !_partial) {
+			AsyncLogVerbose("%lld %s attached mid-game, waiting for POWER_HISTORY", nanotime, Name());
+			_partial = true;
+		}
+	}
+
 	void Add(int64_t nanotime, std::vector<uint8_t> message)
 	{
 
@@ -46,13 +101,39 @@ public:
 			return;
 		}
 
+		auto header = reinterpret_cast<int32_t *>(message.data());
+
+		// Nothing before the next POWER_HISTORY can be made sense of
+		if (_partial) {
+			if (header[0] != POWER_HISTORY) {
+				return;
+			}
+			AsyncLogVerbose("%lld %s building partial state", nanotime, Name());
+			_partial = false;
+		}
+
 		_messages.emplace_back(nanotime, message);
 
-		auto header = reinterpret_cast<int32_t *>(message.data());
-		wxLogVerbose("%lld %s (%d, %d)", nanotime, _name, header[0], header[1]);
+		if (_observer) {
+			(*_observer)(Name(), nanotime, header[0], std::make_range<const uint8_t *>(message.data() + PACKET_HEADER_SIZE, message.data() + message.size()));
+		}
 
+		AsyncLogVerbose("%lld %s (%d, %d)", nanotime, Name(), header[0], header[1]);
+
+		// From the client's choice to the server playing it out
+		if (header[0] == CHOOSE_OPTION && !_choseAt) {
+			_choseAt = nanotime;
+		} else if (header[0] == POWER_HISTORY && _choseAt) {
+			if (!_responseTimes) {
+				_responseTimes.reset(new Histogram());
+			}
+			_responseTimes->RecordSigned(nanotime - _choseAt);
+			responseTimes.RecordSigned(nanotime - _choseAt);
+			_choseAt = 0;
+		}
 
-		HSPacketType type = static_cast<HSPacketType>(header[0]);
+
+		uint32_t type = header[0];
 		int len = header[1];
 
 		if (len > 0)
@@ -63,112 +144,44 @@ public:
 			decodePacket(type, len, NULL);
 		}
 
+		if (LatencyTrace::IsEnabled()) {
+			LatencyTrace::Mark(LatencyTrace::PUBLISHED);
+		}
+
 	}
 
-	void decodePacket(HSPacketType type, int len, uint8_t* data)
+	void decodePacket(uint32_t type, int len, const uint8_t *data);
+
+	// Handlers for each packet type, bound by PacketDispatch (specialized below)
+	template <int Type> void Handle(uint32_t type, const uint8_t *data, int len)
 	{
-		switch (type){
-		case GET_GAME_STATE:
-			wxLogVerbose("GET_GAME_STATE packet");
-			break;
-		case CHOOSE_OPTION:
-			wxLogVerbose("CHOOSE_OPTION packet");
-			break;
-		case CHOOSE_ENTITIES:
-			wxLogVerbose("CHOOSE_ENTITIES packet");
-			break;
-		case PRE_CAST:
-			wxLogVerbose("PRE_CAST packet");
-			break;
-		case DEBUG_MESSAGE:
-			wxLogVerbose("DEBUG_MESSAGE packet");
-			break;
-		case CLIENT_PACKET:
-			wxLogVerbose("CLIENT_PACKET packet");
-			break;
-		case START_GAME_STATE:
-			wxLogVerbose("START_GAME_STATE packet");
-			decodeStartGameState(data, len);
-			break;
-		case FINISH_GAME_STATE:
-			wxLogVerbose("FINISH_GAME_STATE packet");
-			break;
-		case TURN_TIMER:
-			wxLogVerbose("TURN_TIMER packet");
-			break;
-		case NACK_OPTION:
-			wxLogVerbose("NACK_OPTION packet");
-			break;
-		case GIVE_UP:
-			wxLogVerbose("GIVE_UP packet");
-			break;
-		case GAME_CANCELLED:
-			wxLogVerbose("GAME_CANCELLED packet");
-			break;
-		case ALL_OPTIONS:
-			wxLogVerbose("ALL_OPTIONS packet");
-			break;
-		case USER_UI:
-			wxLogVerbose("USER_UI packet");
-			break;
-		case GAME_SETUP:
-			wxLogVerbose("GAME_SETUP packet");
-			break;
-		case ENTITY_CHOICE:
-			wxLogVerbose("ENTITY_CHOICE packet");
-			break;
-		case PRE_LOAD:
-			wxLogVerbose("PRE_LOAD packet");
-			break;
-		case POWER_HISTORY:
-			wxLogVerbose("POWER_HISTORY packet");
-			decodePowerHistory(data, len);
-			break;
-		case NOTIFICATION:
-			wxLogVerbose("NOTIFICATION packet");
-			break;
-		case AUTO_LOGIN:
-			wxLogVerbose("AUTO_LOGIN packet");
-			break;
-		case BEGIN_PLAYING:
-			wxLogVerbose("BEGIN_PLAYING packet");
-			break;
-		case GAME_STARTING:
-			wxLogVerbose("GAME_STARTING packet");
-			break;
-		case DEBUG_CONSOLE_COMMAND:
-			wxLogVerbose("DEBUG_CONSOLE_COMMAND packet");
-			break;
-		case DEBUG_CONSOLE_RESPONSE:
-			wxLogVerbose("DEBUG_CONSOLE_RESPONSE packet");
-			break;
-		case AURORA_HANDSHAKE:
-			wxLogVerbose("AURORA_HANDSHAKE packet");
-			break;
-		default:
-			wxLogVerbose("UNKNOWN packet");
-			break;
-		}
+		AsyncLogVerbose("%s packet", PacketInfo<Type>::Name());
 	}
 
-	void decodeStartGameState(uint8_t* data, int len)
+	void decodeStartGameState(const uint8_t* data, int len)
 	{
 		StartGameState state;
 		state.ParseFromArray(data, len);
-		wxLogVerbose(state.DebugString().c_str());
+		if (LatencyTrace::IsEnabled()) {
+			LatencyTrace::Mark(LatencyTrace::PARSED);
+		}
+		AsyncLogVerbose("%s", state.DebugString());
 	}
 
-	void decodePowerHistory(uint8_t* data, int len)
+	void decodePowerHistory(const uint8_t* data, int len)
 	{
 		PowerHistory history;
 		history.ParseFromArray(data, len);
+		if (LatencyTrace::IsEnabled()) {
+			LatencyTrace::Mark(LatencyTrace::PARSED);
+		}
 		auto iter = history.list().begin();
 		for (; iter != history.list().end(); iter++)
 		{
 			PowerHistoryEntity entity = iter->show_entity();
 			if (entity.IsInitialized())
 			{
-				wxLogVerbose(entity.DebugString().c_str());
+				AsyncLogVerbose("%s", entity.DebugString());
 			}
 		}
 		// wxLogVerbose(history.DebugString().c_str());
@@ -176,6 +189,9 @@ public:
 
 	void Cancel()
 	{
+		if (!WasCanceled()) {
+			canceledLogs.Add();
+		}
 		swap_clear(_messages); // clear and release memory
 	}
 
@@ -186,40 +202,109 @@ public:
 
 
 private:
+	// Built the first time it's logged (or observed), the packet path has no use for it otherwise
+	const std::string &Name()
+	{
+		if (_name.empty()) {
+			_name = _endpoints.SrcToDst();
+		}
+		return _name;
+	}
+
+	tcp::EndpointPair _endpoints;
 	std::string _name;
 	MessageList _messages;
+	bool _partial; // attached, nothing decoded yet
+	int64_t _choseAt; // the CHOOSE_OPTION waiting for a POWER_HISTORY (0 if none)
+	std::unique_ptr<Histogram> _responseTimes;
 };
 
+Histogram GameDecoder::_responseTimes;
+GameDecoder::Observer *GameDecoder::_observer = nullptr;
+
+template <> void GameDecoder::Decode::Handle<START_GAME_STATE>(uint32_t type, const uint8_t *data, int len)
+{
+	AsyncLogVerbose("START_GAME_STATE packet");
+	decodeStartGameState(data, len);
+}
+
+template <> void GameDecoder::Decode::Handle<POWER_HISTORY>(uint32_t type, const uint8_t *data, int len)
+{
+	AsyncLogVerbose("POWER_HISTORY packet");
+	decodePowerHistory(data, len);
+}
+
+// Defined after the specializations above so they're the ones bound into the dispatch table
+void GameDecoder::Decode::decodePacket(uint32_t type, int len, const uint8_t *data)
+{
+	PacketDispatch<Decode>::Dispatch(*this, type, data, len);
+}
+
+const PacketStats &GameDecoder::Stats(int slot)
+{
+	return PacketDispatch<Decode>::Stats(slot);
+}
+
+bool GameDecoder::Classify(std::range<const uint8_t *> data)
+{
+	if (data.size() < PACKET_HEADER_SIZE) {
+		return true; // can't tell until the decoder has the whole header
+	}
+
+	uint32_t size;
+	return plausibleHeader(data.begin(), size);
+}
+
 GameDecoder::GameDecoder(int64_t nanotime, tcp::Stream *stream)
 	: _stream(stream),
 	_header(),
 	_message(),
 	_buffer(_header.data(), _header.data() + _header.size()),
+	_syncing(stream->Attached()),
+	_scanned(0),
 	_decode()
 {
 	if (_stream->Other()) {
 		_decode = reinterpret_cast<GameDecoder*>(_stream->Other()->Callback())->_decode;
 	} else {
-		_decode = std::make_shared<Decode>(_stream->Endpoints().SrcToDst(), nanotime);
+		_decode = std::make_shared<Decode>(_stream->Endpoints(), nanotime);
+	}
+
+	if (_syncing) {
+		_decode->Attach(nanotime);
 	}
 }
 
 GameDecoder::~GameDecoder()
 {
 	if (_buffer.begin() != _header.data()) {
-		wxLogWarning("%s canceling log (stream closed mid-packet)", _stream->Endpoints().SrcToDst());
+		AsyncLogWarning("%s canceling log (stream closed mid-packet)", _stream->Endpoints().SrcToDst());
 		_decode->Cancel();
 	}
 	//wxLogVerbose("stream closed: (%s)", _stream->Endpoints().SrcToDst());
+
+	CaptureFilter::Release(_stream->Endpoints());
 }
 
-void GameDecoder::operator()(int64_t nanotime, std::range<const uint8_t *> data)
+void GameDecoder::operator()(int64_t nanotime, int64_t captured, std::range<const uint8_t *> data)
 {
+	if (LatencyTrace::IsEnabled()) {
+		LatencyTrace::Delivered(captured);
+	}
+
 	if (_decode->WasCanceled()) {
 		swap_clear(_message);
 		return;
 	}
 
+	std::vector<uint8_t> rest;
+	if (_syncing) {
+		if (!Synchronize(data, rest)) {
+			return;
+		}
+		data = std::make_range<const uint8_t *>(rest.data(), rest.data() + rest.size());
+	}
+
 	while (!data.empty()) {
 		auto toCopy = std::min(_buffer.size(), data.size());
 
@@ -235,9 +320,10 @@ void GameDecoder::operator()(int64_t nanotime, std::range<const uint8_t *> data)
 				auto size = ptr[1];
 
 				// Sanity check the values
-				if (type > 1000 || size > 8000) {
-					wxLogVerbose("%s canceling log (bad header: %d, %d)", _stream->Endpoints().SrcToDst(), type, size);
+				if (type > 1000 || size > MAX_MESSAGE_SIZE) {
+					AsyncLogVerbose("%s canceling log (bad header: %d, %d)", _stream->Endpoints().SrcToDst(), type, size);
 					_decode->Cancel();
+					CaptureFilter::Reject(_stream->Endpoints());
 					swap_clear(_message);
 					_buffer = std::make_range(_header.data(), _header.data() + _header.size());
 					return;
@@ -251,6 +337,10 @@ void GameDecoder::operator()(int64_t nanotime, std::range<const uint8_t *> data)
 			}
 			else {
 				// Done reading message, add it to the log
+				if (LatencyTrace::IsEnabled()) {
+					LatencyTrace::Mark(LatencyTrace::FRAMED);
+				}
+				framedMessages.Add();
 				_decode->Add(nanotime, std::move(_message));
 
 				// Setup for another header next
@@ -259,4 +349,47 @@ void GameDecoder::operator()(int64_t nanotime, std::range<const uint8_t *> data)
 		}
 	}
 	// wxLogVerbose("packet: %d (%s)", data.size(), _stream->Endpoints().SrcToDst());
-}
\ No newline at end of file
+}
+
+// Buffers the data of an attached stream until two headers in a row line up
+// (either alone is too easy to find by chance), then passes back the data
+// from the first one on. Each call carries on from where the last one
+// stopped, the offsets before that have already been ruled out.
+bool GameDecoder::Synchronize(std::range<const uint8_t *> data, std::vector<uint8_t> &rest)
+{
+	_message.insert(_message.end(), data.begin(), data.end());
+
+	auto offset = _scanned;
+	for (; offset + PACKET_HEADER_SIZE <= _message.size(); offset++) {
+		uint32_t size;
+		if (!plausibleHeader(&_message[offset], size)) {
+			continue;
+		}
+
+		auto next = offset + PACKET_HEADER_SIZE + size;
+		if (next + PACKET_HEADER_SIZE > _message.size()) {
+			_scanned = offset;
+			return false; // wait for the next header to check this one
+		}
+		if (!plausibleHeader(&_message[next], size)) {
+			continue;
+		}
+
+		AsyncLogVerbose("%s found a message boundary after %d bytes", _stream->Endpoints().SrcToDst(), offset);
+		rest.assign(_message.begin() + offset, _message.end());
+		swap_clear(_message);
+		_syncing = false;
+		_scanned = 0;
+		return true;
+	}
+	_scanned = offset;
+
+	if (_message.size() > MAX_SYNC_BYTES) {
+		AsyncLogVerbose("%s canceling log (no message boundary)", _stream->Endpoints().SrcToDst());
+		_decode->Cancel();
+		CaptureFilter::Reject(_stream->Endpoints());
+		swap_clear(_message);
+		_scanned = 0;
+	}
+	return false;
+}
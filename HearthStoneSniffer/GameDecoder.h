@@ -1,57 +1,66 @@
 #pragma once
+#include "PacketDispatch.h"
 #include "tcp/Parser.h"
 #include "tcp/Stream.h"
 
 #include <array>
 #include <memory>
 #include "range.h"
+#include <string>
 #include <vector>
 
 class GameDecoder :
 	public tcp::Parser::Callback
 {
-	typedef enum {
-		GET_GAME_STATE = 1,
-		CHOOSE_OPTION,
-		CHOOSE_ENTITIES,
-		PRE_CAST,
-		DEBUG_MESSAGE,
-		CLIENT_PACKET,
-		START_GAME_STATE,
-		FINISH_GAME_STATE,
-		TURN_TIMER,
-		NACK_OPTION,
-		GIVE_UP,
-		GAME_CANCELLED,
-		ALL_OPTIONS = 14,
-		USER_UI,
-		GAME_SETUP,
-		ENTITY_CHOICE,
-		PRE_LOAD,
-		POWER_HISTORY,
-		NOTIFICATION = 21,
-		AUTO_LOGIN = 103,
-		BEGIN_PLAYING = 113,
-		GAME_STARTING = 114,
-		DEBUG_CONSOLE_COMMAND = 123,
-		DEBUG_CONSOLE_RESPONSE = 124,
-		AURORA_HANDSHAKE = 168,
-	} HSPacketType;
-
 public:
 	GameDecoder(int64_t nanotime, tcp::Stream *stream);
 	virtual ~GameDecoder();
 
-	virtual void operator()(int64_t nanotime, std::range<const uint8_t *> data);
+	virtual void operator()(int64_t nanotime, int64_t captured, std::range<const uint8_t *> data);
+
+	// Totals for all decoders, indexed by PacketSlot
+	static const PacketStats &Stats(int slot);
+
+	// Nanoseconds from a CHOOSE_OPTION to the next POWER_HISTORY, for every
+	// game so far (games add theirs when they end)
+	static const Histogram &ResponseTimes() { return _responseTimes; }
+
+	// Whether <data> could be the start of a game stream, i.e. a message
+	// header of a known type (a tcp::Parser::Classifier)
+	static bool Classify(std::range<const uint8_t *> data);
+
+	// Larger sizes in a header mean the stream isn't a game (or is corrupt)
+	enum { MAX_MESSAGE_SIZE = 8000 };
+
+	// Sees every message as it's added to a game log (e.g. to check that two
+	// builds decode a capture the same way). Called on the parsing threads.
+	struct Observer
+	{
+		virtual void operator()(const std::string &game, int64_t nanotime, uint32_t type, std::range<const uint8_t *> payload) = 0;
+		virtual ~Observer() { }
+	};
+
+	// Set before capture starts (nullptr for none)
+	static void SetObserver(Observer *observer) { _observer = observer; }
 
 private:
+	// Give up looking for a message boundary in an attached stream after this much data
+	enum { MAX_SYNC_BYTES = 64 * 1024 };
+
+	bool Synchronize(std::range<const uint8_t *> data, std::vector<uint8_t> &rest);
+
 	tcp::Stream * const _stream;
 
 	std::array<uint8_t, 8> _header;
 	std::vector<uint8_t> _message;
 	std::range<uint8_t *> _buffer;
+	bool _syncing; // attached mid-stream, _message holds the data until a boundary is found
+	size_t _scanned; // while syncing, where in _message to look for the first header next
 
 	class Decode;
 	std::shared_ptr<Decode> _decode;
+
+	static Histogram _responseTimes;
+	static Observer *_observer;
 };
 
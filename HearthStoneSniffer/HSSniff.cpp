@@ -0,0 +1,161 @@
+// wx #includes must come first to prevent secure function warning from wxcrt.h
+#include <wx/cmdline.h>
+#include <wx/crt.h>
+#include <wx/init.h>
+#include <wx/log.h>
+
+#include "AsyncLog.h"
+#include "Batch.h"
+#include "Clock.h"
+#include "Diagnostic.h"
+#include "GameDecoder.h"
+#include "LatencyTrace.h"
+#include "Metrics.h"
+#include "PacketCapture.h"
+#include "ParsingStack.h"
+#include "tcp/Stream.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+// hssniff: runs capture files through the same parsing stack as the app
+// (PacketCapture -> tcp::Parser -> GameDecoder) without any GUI, and reports
+// the throughput so offline processing can be measured.
+
+namespace {
+	const wxCmdLineEntryDesc COMMAND_LINE[] = {
+		{ wxCMD_LINE_SWITCH, "h", "help", "show this help", wxCMD_LINE_VAL_NONE, wxCMD_LINE_OPTION_HELP },
+		{ wxCMD_LINE_OPTION, "f", "filter", "capture filter (default: the game ports)" },
+		{ wxCMD_LINE_OPTION, "l", "log", "write the decoder log to this file" },
+		{ wxCMD_LINE_SWITCH, "v", "verbose", "log every decoded message" },
+		{ wxCMD_LINE_OPTION, "j", "jobs", "number of files processed at once (default: one per core)", wxCMD_LINE_VAL_NUMBER },
+		{ wxCMD_LINE_OPTION, "s", "shards", "split each file's connections over this many threads", wxCMD_LINE_VAL_NUMBER },
+		{ wxCMD_LINE_SWITCH, "p", "per-file", "report every file (and shard)" },
+		{ wxCMD_LINE_SWITCH, NULL, "pin", "pin each shard's thread to a CPU" },
+		{ wxCMD_LINE_SWITCH, "t", "trace", "report the latency of each stage of the parsing stack" },
+		{ wxCMD_LINE_SWITCH, NULL, "attach", "pick up games already in progress when the capture started" },
+		{ wxCMD_LINE_SWITCH, "m", "metrics", "print every metric (as the app serves them) at the end" },
+		{ wxCMD_LINE_PARAM, NULL, NULL, "capture file", wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_MULTIPLE },
+		{ wxCMD_LINE_NONE }
+	};
+}
+
+int main(int argc, char **argv)
+{
+	wxInitializer initializer(argc, argv);
+	if (!initializer.IsOk()) {
+		fprintf(stderr, "hssniff: failed to initialize wxWidgets\n");
+		return 1;
+	}
+
+	wxCmdLineParser commandLine(COMMAND_LINE, argc, argv);
+	switch (commandLine.Parse()) {
+	case -1:
+		return 0; // help
+	case 0:
+		break;
+	default:
+		return 2;
+	}
+
+	wxString filter = ParsingStack::FILTER;
+	commandLine.Found("f", &filter);
+
+	// Without a log file the decoder log goes to stderr (through wx)
+	wxString logFile;
+	if (commandLine.Found("l", &logFile) && !AsyncLog::Start(logFile.ToStdString())) {
+		wxLogError("error opening log file: %s", logFile);
+		return 1;
+	}
+
+	bool verbose = commandLine.Found("v");
+	wxLog::SetVerbose(verbose);
+	AsyncLog::SetVerbose(verbose);
+
+	// The log is the output here, so slow down rather than lose any of it
+	AsyncLog::SetBlocking();
+
+	long jobs = 0;
+	commandLine.Found("j", &jobs);
+
+	// A separate parsing stack for every file (or every shard of a file)
+	ParsingStack::Options stackOptions;
+	long shardCount = 0;
+	commandLine.Found("s", &shardCount);
+	stackOptions.shards = unsigned(std::max(shardCount, 0L));
+	stackOptions.sharder.firstCpu = commandLine.Found("pin") ? 0 : -1;
+	stackOptions.sharder.reportInterval = commandLine.Found("p") ? 10 : 0;
+	stackOptions.attach = commandLine.Found("attach");
+	ParsingStack::SetOptions(stackOptions);
+	if (commandLine.Found("t")) {
+		LatencyTrace::Enable(false);
+	}
+
+	std::vector<std::string> files;
+	for (size_t i = 0; i < commandLine.GetParamCount(); i++) {
+		files.push_back(commandLine.GetParam(i).ToStdString());
+	}
+
+	// Process the files in parallel
+	auto start = Clock::Now();
+	auto results = Batch::Run(filter.ToStdString(), files, &ParsingStack::New, unsigned(std::max(jobs, 0L)));
+	auto seconds = double(Clock::Now() - start) / 1e9;
+
+	Diagnostic::FlushAll();
+	AsyncLog::Stop();
+
+	// Merge the per-file results (in command line order)
+	size_t failed = 0;
+	size_t stolen = 0;
+	uint64_t packets = 0;
+	uint64_t bytes = 0;
+	for (auto &result : results) {
+		failed += result.ok ? 0 : 1;
+		stolen += result.stolen ? 1 : 0;
+		packets += result.packets;
+		bytes += result.bytes;
+
+		if (commandLine.Found("p")) {
+			wxPrintf("%s: %s%llu packets, %.1f MB in %.3f s (worker %d%s)\n",
+				result.file, result.ok ? "" : "FAILED, ",
+				(unsigned long long)result.packets, double(result.bytes) / (1024 * 1024),
+				double(result.nanos) / 1e9, result.worker, result.stolen ? ", stolen" : "");
+		}
+	}
+
+	// Every game starts with a START_GAME_STATE from the server
+	auto megabytes = double(bytes) / (1024 * 1024);
+	auto games = GameDecoder::Stats(PACKET_SLOT_START_GAME_STATE).messages.load();
+	auto perSecond = [seconds](double n) { return seconds > 0 ? n / seconds : 0.0; };
+
+	wxPrintf("%u files (%u failed, %u stolen): %llu packets, %.1f MB, %llu games in %.3f s\n",
+		unsigned(results.size()), unsigned(failed), unsigned(stolen),
+		(unsigned long long)packets, megabytes, (unsigned long long)games, seconds);
+	wxPrintf("%.1f MB/s, %.0f packets/s, %.2f games/s\n",
+		perSecond(megabytes), perSecond(double(packets)), perSecond(double(games)));
+
+	auto latency = [](const char *what, const Histogram &times) {
+		if (times.Count()) {
+			wxPrintf("%llu %s: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n", (unsigned long long)times.Count(), what,
+				times.Percentile(0.5) / 1e6, times.Percentile(0.99) / 1e6, times.Max() / 1e6);
+		}
+	};
+
+	// Time lost waiting for missing segments (as opposed to decoding), and the network and server delays
+	latency("segments held for reassembly", tcp::Stream::HoldTimes());
+	latency("round trips", tcp::Stream::RttTimes());
+	latency("server responses (CHOOSE_OPTION to POWER_HISTORY)", GameDecoder::ResponseTimes());
+
+	if (LatencyTrace::IsEnabled()) {
+		wxPrintf("%s", LatencyTrace::Report().c_str());
+	}
+
+	if (commandLine.Found("m")) {
+		wxPrintf("%s", Metrics::Scrape().c_str());
+	}
+
+	return failed ? 1 : 0;
+}
@@ -2,23 +2,30 @@
 #include <wx/config.h>
 #include <wx/fileconf.h>
 
-#include <fstream>
+#include <algorithm>
 #include <memory>
 
 #include "HSSnifferApp.h"
 
+#include "AsyncLog.h"
+#include "CaptureSupervisor.h"
+#include "Diagnostic.h"
 #include "Helper.h"
+#include "LatencyTrace.h"
 #include "LogWindow.h"
+#include "MetricsServer.h"
+#include "ParsingStack.h"
 #include "TaskBarIcon.h"
-#include "PacketCapture.h"
-#include "tcp/Parser.h"
-#include "GameDecoder.h"
 
 IMPLEMENT_APP(HSSnifferApp);
 
 TaskBarIcon *icon;
 
-std::ofstream fout;
+// Runs capture on every device (stopped before the log on exit)
+static std::unique_ptr<CaptureSupervisor> capture;
+
+// Serves the packet path metrics to a local Prometheus (only when a port is configured)
+static std::unique_ptr<MetricsServer> metricsServer;
 
 bool HSSnifferApp::OnInit()
 {
@@ -33,32 +40,84 @@ bool HSSnifferApp::OnInit()
 		return false;
 	}
 
-	// Open a file for logging
-	fout.open(file.GetFullPath().c_str().AsChar(), std::ofstream::out);
+	// Open a file for logging (written from a background thread)
+	if (!AsyncLog::Start(file.GetFullPath().c_str().AsChar())) {
+		wxLogError("error opening log file: %s", file.GetFullPath());
+		return false;
+	}
 
 	// Setup the log file
-	auto logFile = new wxLogStream(&fout);
+	auto logFile = new AsyncLog::Target();
 	wxLog::SetActiveTarget(logFile);
 
-	// Wrap the log file with a GUI window
+	// Wrap the log file with a GUI window, which also shows the asynchronous messages
 	auto logWindow = new LogWindow(NULL, _("Log"), false, true);
 	wxLog::SetActiveTarget(logWindow);
+	AsyncLog::SetSink(logWindow);
 
 	// Start logging
 	wxLog::SetVerbose();
+	AsyncLog::SetVerbose();
 	wxLogMessage(_("Hearth Log %s"), Helper::AppVersion());
 
 	// Create the GUI bits
 	icon = new TaskBarIcon();
 
+	// Time every stage from capture to decoded event (reported on exit)
+	if (Helper::ReadConfig("LatencyTrace", false)) {
+		LatencyTrace::Enable(true);
+	}
+
+	// Metrics for scraping, loopback only
+	auto metricsPort = Helper::ReadConfig("MetricsPort", 0L);
+	if (metricsPort > 0 && metricsPort < 65536) {
+		metricsServer.reset(new MetricsServer(uint16_t(metricsPort)));
+		if (!metricsServer->IsServing()) {
+			metricsServer.reset();
+		}
+	}
+
+	ParsingStack::Options stackOptions;
+
+	// Games already in progress (e.g. after a restart) are only picked up when asked for
+	stackOptions.attach = Helper::ReadConfig("CaptureAttachMidStream", false);
+
+	// Busy links (e.g. a SPAN port) can be parsed on several cores
+	stackOptions.shards = unsigned(std::max(Helper::ReadConfig("CaptureShards", 0L), 0L));
+	stackOptions.sharder.maxDelay = 10 * 1000000; // 10ms
+	stackOptions.sharder.firstCpu = int(Helper::ReadConfig("CaptureFirstCpu", -1L));
+	stackOptions.sharder.reportInterval = 60;
+	ParsingStack::SetOptions(stackOptions);
+
+	// Where the capture threads run (e.g. keep them off the cores the game uses)
+	CaptureSupervisor::Options captureOptions;
+	captureOptions.firstCpu = int(Helper::ReadConfig("CaptureThreadCpu", -1L));
+	auto priority = Helper::ReadConfig("CaptureThreadPriority", long(Threads::PRIORITY_NORMAL));
+	captureOptions.priority = Threads::Priority(std::min(std::max(priority, long(Threads::PRIORITY_LOW)), long(Threads::PRIORITY_HIGH)));
+	captureOptions.anyDevice = Helper::ReadConfig("CaptureAnyDevice", true);
+	captureOptions.narrowFilter = Helper::ReadConfig("CaptureNarrowFilter", true);
+
 	// Setup a packet parsing stack
-	PacketCapture::Start("tcp port 3724 or tcp port 1119",
-		[]() -> PacketCapture::Callback::Ptr {
-		return std::make_unique<tcp::Parser>(
-			[](int64_t nanotime, tcp::Stream *stream) ->tcp::Parser::Callback::Ptr {
-			return std::make_unique<GameDecoder>(nanotime, stream);
-		});
-	});
+	capture.reset(new CaptureSupervisor(ParsingStack::FILTER, &ParsingStack::New, captureOptions));
+	capture->Start();
 
 	return true;
+}
+
+int HSSnifferApp::OnExit()
+{
+	// Stop capturing and let the parsing stacks finish what they have
+	capture.reset();
+	metricsServer.reset();
+
+	if (LatencyTrace::IsEnabled()) {
+		wxLogMessage("packet path latency:\n%s", LatencyTrace::Report().c_str());
+	}
+
+	// Write out anything still queued
+	Diagnostic::FlushAll();
+	AsyncLog::SetSink(nullptr);
+	AsyncLog::Stop();
+
+	return wxApp::OnExit();
 }
\ No newline at end of file
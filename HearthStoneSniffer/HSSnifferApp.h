@@ -7,5 +7,6 @@ class HSSnifferApp :
 {
 public:
 	virtual bool OnInit();
+	virtual int OnExit();
 };
 
@@ -0,0 +1,172 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Log-linear histogram of unsigned values (in the spirit of HdrHistogram).
+//
+// Values below 2^SUB_BITS are counted exactly, above that each power of two is
+// split into 2^(SUB_BITS-1) equal buckets, so the relative error of any
+// reported value is bounded by 1/2^(SUB_BITS-1) (~6%). Recording is a couple
+// of shifts and a few relaxed atomics so it can be shared between threads.
+class Histogram
+{
+public:
+	enum {
+		SUB_BITS = 5,
+		HALF = 1 << (SUB_BITS - 1),
+		BUCKETS = (64 - SUB_BITS + 2) * HALF,
+	};
+
+	Histogram() { Reset(); }
+
+	void Record(uint64_t value)
+	{
+		_buckets[Bucket(value)].fetch_add(1, std::memory_order_relaxed);
+		_sum.fetch_add(value, std::memory_order_relaxed);
+
+		auto max = _max.load(std::memory_order_relaxed);
+		while (value > max && !_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+		}
+	}
+
+	// Negative values (e.g. clock skew between capture and wall time) count as zero
+	void RecordSigned(int64_t value) { Record(value > 0 ? uint64_t(value) : 0); }
+
+	uint64_t Count() const
+	{
+		uint64_t count = 0;
+		for (auto &b : _buckets) {
+			count += b.load(std::memory_order_relaxed);
+		}
+		return count;
+	}
+
+	uint64_t Sum() const { return _sum.load(std::memory_order_relaxed); }
+	uint64_t Max() const { return _max.load(std::memory_order_relaxed); }
+
+	double Mean() const
+	{
+		auto count = Count();
+		return count ? double(Sum()) / count : 0.0;
+	}
+
+	// Value at or below which the given fraction (0..1) of the recorded values fall.
+	// Reports the upper end of the bucket (clamped to the max seen) so it never under-reports.
+	uint64_t Percentile(double fraction) const
+	{
+		auto count = Count();
+		if (!count) {
+			return 0;
+		}
+
+		auto target = uint64_t(fraction * count + 0.5);
+		if (target < 1) target = 1;
+		if (target > count) target = count;
+
+		uint64_t seen = 0;
+		for (int i = 0; i < BUCKETS; i++) {
+			seen += _buckets[i].load(std::memory_order_relaxed);
+			if (seen >= target) {
+				auto upper = UpperBound(i);
+				return upper < Max() ? upper : Max();
+			}
+		}
+		return Max();
+	}
+
+	void Merge(const Histogram &other)
+	{
+		for (int i = 0; i < BUCKETS; i++) {
+			auto n = other._buckets[i].load(std::memory_order_relaxed);
+			if (n) {
+				_buckets[i].fetch_add(n, std::memory_order_relaxed);
+			}
+		}
+		_sum.fetch_add(other.Sum(), std::memory_order_relaxed);
+
+		auto value = other.Max();
+		auto max = _max.load(std::memory_order_relaxed);
+		while (value > max && !_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+		}
+	}
+
+	void Reset()
+	{
+		for (auto &b : _buckets) {
+			b.store(0, std::memory_order_relaxed);
+		}
+		_sum.store(0, std::memory_order_relaxed);
+		_max.store(0, std::memory_order_relaxed);
+	}
+
+	// Iterate the non-empty buckets as (lower bound, upper bound, count)
+	template <typename F> void ForEachBucket(F f) const
+	{
+		for (int i = 0; i < BUCKETS; i++) {
+			auto n = _buckets[i].load(std::memory_order_relaxed);
+			if (n) {
+				f(LowerBound(i), UpperBound(i), n);
+			}
+		}
+	}
+
+	static int Bucket(uint64_t value)
+	{
+		if (value < 2 * HALF) {
+			return int(value);
+		}
+
+		auto shift = HighestBit(value) - (SUB_BITS - 1);
+		return int(shift * HALF + (value >> shift));
+	}
+
+	static uint64_t LowerBound(int bucket)
+	{
+		if (bucket < 2 * HALF) {
+			return bucket;
+		}
+
+		auto shift = bucket / HALF - 1;
+		return uint64_t(bucket % HALF + HALF) << shift;
+	}
+
+	static uint64_t UpperBound(int bucket)
+	{
+		if (bucket < 2 * HALF) {
+			return bucket;
+		}
+
+		auto shift = bucket / HALF - 1;
+		return LowerBound(bucket) + ((uint64_t(1) << shift) - 1);
+	}
+
+	// Index of the highest set bit (value must be non-zero)
+	static int HighestBit(uint64_t value)
+	{
+#ifdef _MSC_VER
+		// No _BitScanReverse64 on 32-bit targets
+		unsigned long bit;
+		if (_BitScanReverse(&bit, (unsigned long)(value >> 32))) {
+			return int(bit) + 32;
+		}
+		_BitScanReverse(&bit, (unsigned long)value);
+		return int(bit);
+#else
+		return 63 - __builtin_clzll(value);
+#endif
+	}
+
+private:
+	// Not copyable (atomics), use Merge() instead
+	Histogram(const Histogram &);
+	Histogram &operator=(const Histogram &);
+
+	std::atomic<uint64_t> _buckets[BUCKETS];
+	std::atomic<uint64_t> _sum;
+	std::atomic<uint64_t> _max;
+};
@@ -0,0 +1,116 @@
+// wx #includes must come first to prevent secure function warning from wxcrt.h
+#include <wx/string.h>
+
+#include "LatencyTrace.h"
+#include "AsyncLog.h"
+#include "Clock.h"
+
+bool LatencyTrace::_enabled = false;
+bool LatencyTrace::_live = false;
+Histogram LatencyTrace::_hops[STAGE_COUNT];
+Histogram LatencyTrace::_held;
+Histogram LatencyTrace::_total;
+
+namespace {
+	// When each stage of the packet being parsed on this thread was reached (0 if not yet)
+	HS_THREAD_LOCAL int64_t stamps[LatencyTrace::STAGE_COUNT];
+
+	// Capture timestamp of that packet (kept even when it's not a stage)
+	HS_THREAD_LOCAL int64_t packetCaptured;
+}
+
+void LatencyTrace::Enable(bool live)
+{
+	_enabled = true;
+	_live = live;
+}
+
+void LatencyTrace::Reset()
+{
+	for (auto &hop : _hops) {
+		hop.Reset();
+	}
+	_held.Reset();
+	_total.Reset();
+}
+
+void LatencyTrace::Dequeued(int64_t captured)
+{
+	auto now = Clock::Wall();
+	for (auto &stamp : stamps) {
+		stamp = 0;
+	}
+
+	if (_live) {
+		stamps[CAPTURED] = captured;
+		_hops[DEQUEUED].RecordSigned(now - captured);
+	}
+	stamps[DEQUEUED] = now;
+	packetCaptured = captured;
+}
+
+void LatencyTrace::Delivered(int64_t captured)
+{
+	_held.RecordSigned(packetCaptured - captured);
+	Mark(DELIVERED);
+}
+
+void LatencyTrace::Mark(Stage stage)
+{
+	auto now = Clock::Wall();
+
+	// From the latest stage marked before it (PARSED is skipped for the
+	// messages that aren't parsed, they still count towards PUBLISHED). A
+	// message framed after another one was published from the same data
+	// starts there, not at DELIVERED, so its hop leaves out that decoding.
+	auto from = stage == FRAMED ? stamps[PUBLISHED] : 0;
+	for (int i = stage - 1; i >= CAPTURED && !from; i--) {
+		from = stamps[i];
+	}
+	if (from) {
+		_hops[stage].RecordSigned(now - from);
+	}
+
+	// Later stages belong to the previous message
+	stamps[stage] = now;
+	for (int i = stage + 1; i < STAGE_COUNT; i++) {
+		stamps[i] = 0;
+	}
+
+	if (stage == PUBLISHED) {
+		auto first = stamps[CAPTURED] ? stamps[CAPTURED] : stamps[DEQUEUED];
+		if (first) {
+			_total.RecordSigned(now - first);
+		}
+	}
+}
+
+const char *LatencyTrace::Name(Stage stage)
+{
+	static const char *const names[STAGE_COUNT] = {
+		"captured", "dequeued", "delivered", "framed", "parsed", "published",
+	};
+	return names[stage];
+}
+
+std::string LatencyTrace::Report()
+{
+	wxString report = wxString::Format("%-28s %10s %10s %10s %10s %10s\n", "hop (us)", "count", "p50", "p99", "p999", "max");
+
+	auto line = [&report](const wxString &name, const Histogram &times) {
+		report += wxString::Format("%-28s %10llu %10.1f %10.1f %10.1f %10.1f\n", name, (unsigned long long)times.Count(),
+			times.Percentile(0.5) / 1e3, times.Percentile(0.99) / 1e3, times.Percentile(0.999) / 1e3, times.Max() / 1e3);
+	};
+
+	for (int stage = DEQUEUED; stage < STAGE_COUNT; stage++) {
+		if (stage == DEQUEUED && !_live) {
+			continue;
+		}
+		auto from = stage - 1 == PARSED ? wxString::Format("%s/%s", Name(FRAMED), Name(PARSED)) : wxString(Name(Stage(stage - 1)));
+		line(wxString::Format("%s -> %s", from, Name(Stage(stage))), _hops[stage]);
+	}
+	line(wxString::Format("%s -> %s", Name(_live ? CAPTURED : DEQUEUED), Name(PUBLISHED)), _total);
+	line("held for reassembly", _held);
+
+	return report.ToStdString();
+}
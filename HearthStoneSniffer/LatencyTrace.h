@@ -0,0 +1,73 @@
+#pragma once
+
+#include "Histogram.h"
+
+#include <cstdint>
+#include <string>
+
+// Optional per-stage latency of the packet path, from the capture timestamp
+// of a packet to the event decoded from it.
+//
+// tcp::Parser starts a trace for every packet it takes, later stages of the
+// same packet are marked on the same thread as the parsing stack runs. Each
+// mark records the hop from the latest earlier stage marked for the current
+// message, so a slow stage shows up in its own histogram. Data that waited
+// in reassembly for an earlier segment is delivered with a later packet, the
+// capture time it waited is kept apart in Held().
+class LatencyTrace
+{
+public:
+	enum Stage {
+		CAPTURED,   // kernel timestamp (pcap)
+		DEQUEUED,   // taken by the parser (after any FlowSharder queue)
+		DELIVERED,  // reassembled and passed to the decoder
+		FRAMED,     // a whole message was read
+		PARSED,     // its protobuf was parsed (only for the types that are)
+		PUBLISHED,  // the decoder is done with it
+		STAGE_COUNT
+	};
+
+	// Must be called before capture starts. Capture timestamps of files are
+	// in the past, so <live> is false to leave out the first hop.
+	static void Enable(bool live);
+	static bool IsEnabled() { return _enabled; }
+
+	// Start the histograms over (e.g. between benchmark runs, not during capture)
+	static void Reset();
+
+	// A packet with the given capture timestamp was taken off the queue
+	static void Dequeued(int64_t captured);
+
+	// The current packet passed data to the decoder, the start of which was
+	// captured at <captured> (before the packet itself if it was held back)
+	static void Delivered(int64_t captured);
+
+	// The current packet reached <stage> (after DELIVERED)
+	static void Mark(Stage stage);
+
+	// Nanoseconds from the latest stage marked before <stage> to it
+	// (PUBLISHED is from FRAMED for the messages that aren't parsed, FRAMED
+	// from the previous message's PUBLISHED when a packet holds more than one)
+	static const Histogram &Hop(Stage stage) { return _hops[stage]; }
+
+	// Capture nanoseconds from delivered data to the packet that delivered it
+	// (0 unless it was held for reassembly)
+	static const Histogram &Held() { return _held; }
+
+	// Nanoseconds from the first stage to PUBLISHED
+	static const Histogram &Total() { return _total; }
+
+	static const char *Name(Stage stage);
+
+	// p50/p99/p999 of every hop, one line each
+	static std::string Report();
+
+private:
+	LatencyTrace() {}
+
+	static bool _enabled;
+	static bool _live;
+	static Histogram _hops[STAGE_COUNT];
+	static Histogram _held;
+	static Histogram _total;
+};
@@ -0,0 +1,250 @@
+#include "LogStore.h"
+
+#include <algorithm>
+
+LogStore::LogStore(size_t maxBytes)
+	: _maxBytes(maxBytes),
+	  _lines(),
+	  _bytes(0),
+	  _begin(0),
+	  _end(0),
+	  _blocks(),
+	  _firstBlock(0)
+{
+}
+
+// Lower case of a character, without a locale lookup for ASCII
+static uint32_t Fold(const wxUniChar &ch)
+{
+	uint32_t c = ch.GetValue();
+	if (c < 128) {
+		return (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+	}
+	return uint32_t(wxTolower(ch));
+}
+
+// Case insensitive substring check without copying the text (<lower> is already folded)
+static bool ContainsLower(const wxString &text, const wxString &lower)
+{
+	auto first = Fold(*lower.begin());
+	for (auto it = text.begin(); it != text.end(); ++it) {
+		if (Fold(*it) != first) {
+			continue;
+		}
+
+		auto a = it;
+		auto b = lower.begin();
+		while (b != lower.end() && a != text.end() && Fold(*a) == Fold(*b)) {
+			++a;
+			++b;
+		}
+		if (b == lower.end()) {
+			return true;
+		}
+	}
+	return false;
+}
+
+template <typename F> void LogStore::ForEachTrigram(const wxString &text, F f)
+{
+	uint32_t a = 0, b = 0;
+	int n = 0;
+	for (auto it = text.begin(); it != text.end(); ++it) {
+		auto c = Fold(*it);
+		if (++n >= 3) {
+			auto hash = (a * 0x9E3779B1u) ^ (b * 0x85EBCA77u) ^ (c * 0xC2B2AE3Du);
+			f(hash ^ (hash >> 15));
+		}
+		a = b;
+		b = c;
+	}
+}
+
+uint32_t LogStore::LevelMask(wxLogLevel maxLevel)
+{
+	uint32_t mask = 0;
+	for (wxLogLevel level = 0; level <= maxLevel && level < 32; level++) {
+		mask |= LevelBit(level);
+	}
+	return mask;
+}
+
+void LogStore::Block::Add(uint32_t trigram)
+{
+	open.insert(trigram);
+}
+
+bool LogStore::Block::MayContain(uint32_t trigram) const
+{
+	if (!sealed) {
+		return open.count(trigram) != 0;
+	}
+
+	// Double hashing: probe i is h1 + i * h2 (h2 odd, so the probes differ)
+	auto mask = bloom.size() * 64 - 1;
+	auto h1 = trigram;
+	auto h2 = (trigram >> 16 | trigram << 16) | 1;
+	for (uint32_t i = 0; i < BLOOM_HASHES; i++) {
+		auto bit = (h1 + i * h2) & mask;
+		if (!(bloom[bit / 64] & (uint64_t(1) << (bit % 64)))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void LogStore::Block::Seal()
+{
+	size_t words = 1;
+	while (words * 64 < open.size() * BLOOM_BITS_EACH) {
+		words *= 2;
+	}
+	bloom.assign(words, 0);
+	sealed = true;
+
+	auto mask = words * 64 - 1;
+	for (auto trigram : open) {
+		auto h1 = trigram;
+		auto h2 = (trigram >> 16 | trigram << 16) | 1;
+		for (uint32_t i = 0; i < BLOOM_HASHES; i++) {
+			auto bit = (h1 + i * h2) & mask;
+			bloom[bit / 64] |= uint64_t(1) << (bit % 64);
+		}
+	}
+	std::unordered_set<uint32_t>().swap(open);
+}
+
+void LogStore::Index(uint64_t seq, const Entry &entry)
+{
+	auto blockNum = seq >> BLOCK_SHIFT;
+	if (_blocks.empty()) {
+		_firstBlock = blockNum;
+	}
+	while (_firstBlock + _blocks.size() <= blockNum) {
+		if (!_blocks.empty()) {
+			_blocks.back().Seal();
+		}
+		_blocks.emplace_back();
+	}
+
+	auto &block = _blocks[size_t(blockNum - _firstBlock)];
+	block.levels |= LevelBit(entry.level);
+	ForEachTrigram(entry.text, [&block](uint32_t hash) { block.Add(hash); });
+}
+
+void LogStore::Append(Entries &entries)
+{
+	std::lock_guard<std::mutex> lock(_lock);
+
+	for (auto &entry : entries) {
+		Index(_end, entry);
+		_bytes += Bytes(entry);
+		_lines.push_back(std::move(entry));
+		_end++;
+	}
+
+	// Drop the oldest lines until the rest fit (always keeping the newest)
+	while (_bytes > _maxBytes && _lines.size() > 1) {
+		_bytes -= Bytes(_lines.front());
+		_lines.pop_front();
+		_begin++;
+	}
+
+	// Forget blocks that no longer hold any lines
+	while (!_blocks.empty() && ((_firstBlock + 1) << BLOCK_SHIFT) <= _begin) {
+		_blocks.pop_front();
+		_firstBlock++;
+	}
+
+	entries.clear();
+}
+
+void LogStore::Clear()
+{
+	std::lock_guard<std::mutex> lock(_lock);
+
+	// Keep numbering from where we were so old sequence numbers just read as dropped
+	std::deque<Entry>().swap(_lines);
+	_bytes = 0;
+	_begin = _end;
+	_blocks.clear();
+}
+
+uint64_t LogStore::Begin() const
+{
+	std::lock_guard<std::mutex> lock(_lock);
+	return _begin;
+}
+
+uint64_t LogStore::End() const
+{
+	std::lock_guard<std::mutex> lock(_lock);
+	return _end;
+}
+
+bool LogStore::Get(uint64_t seq, Entry &entry) const
+{
+	std::lock_guard<std::mutex> lock(_lock);
+
+	if (seq < _begin || seq >= _end) {
+		return false;
+	}
+
+	entry = _lines[size_t(seq - _begin)];
+	return true;
+}
+
+uint64_t LogStore::Get(uint64_t begin, uint64_t end, Entries &entries) const
+{
+	std::lock_guard<std::mutex> lock(_lock);
+
+	begin = std::max(begin, _begin);
+	end = std::min(end, _end);
+
+	for (auto seq = begin; seq < end; seq++) {
+		entries.push_back(_lines[size_t(seq - _begin)]);
+	}
+	return begin;
+}
+
+uint64_t LogStore::Find(const Query &query, uint64_t begin, uint64_t end, std::vector<uint64_t> &matches) const
+{
+	auto levels = LevelMask(query.maxLevel);
+	auto lower = query.text.Lower();
+
+	std::vector<uint32_t> hashes;
+	ForEachTrigram(lower, [&hashes](uint32_t hash) { hashes.push_back(hash); });
+
+	// One block at a time so appends (and the GUI) aren't held up by a long search
+	auto seq = begin;
+	while (seq < end) {
+		std::lock_guard<std::mutex> lock(_lock);
+
+		seq = std::max(seq, _begin);
+		end = std::min(end, _end);
+		if (seq >= end) {
+			break;
+		}
+
+		auto blockNum = seq >> BLOCK_SHIFT;
+		auto blockEnd = std::min(end, (blockNum + 1) << BLOCK_SHIFT);
+
+		// Skip the block unless it might have a match
+		auto &block = _blocks[size_t(blockNum - _firstBlock)];
+		bool candidate = (block.levels & levels) != 0;
+		for (size_t i = 0; candidate && i < hashes.size(); i++) {
+			candidate = block.MayContain(hashes[i]);
+		}
+
+		if (candidate) {
+			for (; seq < blockEnd; seq++) {
+				auto &entry = _lines[size_t(seq - _begin)];
+				if ((LevelBit(entry.level) & levels) && (lower.empty() || ContainsLower(entry.text, lower))) {
+					matches.push_back(seq);
+				}
+			}
+		}
+		seq = blockEnd;
+	}
+	return std::max(seq, end);
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <wx/log.h>
+
+#include <cstdint>
+#include <ctime>
+#include <deque>
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+// Log lines up to a fixed number of bytes (counting each line's text and
+// bookkeeping). Past that, appending drops the oldest lines. Lines are kept
+// in a deque so growing never moves the ones already stored. Every line gets a sequence
+// number that stays valid until it's dropped, so readers can address lines
+// while the ring keeps moving. All methods are thread safe.
+//
+// Lines are indexed as they're appended so searches can skip most of a large
+// store: for each block of lines there's a mask of the levels used and the
+// set of lower-cased character trigrams in them. While a block is being
+// filled the set is exact, once it's full the set becomes a bloom filter
+// sized for the number of trigrams it holds.
+class LogStore
+{
+public:
+	struct Entry
+	{
+		wxLogLevel level;
+		time_t time;
+		wxString text;
+	};
+	typedef std::vector<Entry> Entries;
+
+	// Lines at <maxLevel> or more severe that contain <text> (case insensitive)
+	struct Query
+	{
+		wxString text;
+		wxLogLevel maxLevel;
+
+		Query() : maxLevel(wxLOG_Max) { }
+		Query(const wxString &text, wxLogLevel maxLevel) : text(text), maxLevel(maxLevel) { }
+
+		bool IsEmpty() const { return text.empty() && maxLevel >= wxLOG_Max; }
+	};
+
+	explicit LogStore(size_t maxBytes);
+
+	size_t MaxBytes() const { return _maxBytes; }
+
+	// What a line counts against MaxBytes()
+	static size_t Bytes(const Entry &entry) { return sizeof(Entry) + entry.text.length() * sizeof(wchar_t); }
+
+	// Moves the entries in (leaves <entries> empty)
+	void Append(Entries &entries);
+	void Clear();
+
+	// Sequence numbers of the oldest line and one past the newest
+	uint64_t Begin() const;
+	uint64_t End() const;
+
+	// Copies out a line, false if it's been dropped (or doesn't exist yet)
+	bool Get(uint64_t seq, Entry &entry) const;
+
+	// Copies out the lines in [begin, end) that are still stored, returns where the copy started
+	uint64_t Get(uint64_t begin, uint64_t end, Entries &entries) const;
+
+	// Appends the sequence numbers in [begin, end) that match to <matches>, returns
+	// where the search stopped (<end>, or End() if that's smaller)
+	uint64_t Find(const Query &query, uint64_t begin, uint64_t end, std::vector<uint64_t> &matches) const;
+
+private:
+	enum {
+		BLOCK_SHIFT = 10,    // 1024 lines per block
+		BLOOM_BITS_EACH = 10, // per trigram, with BLOOM_HASHES about 1% false positives
+		BLOOM_HASHES = 3,
+	};
+
+	struct Block
+	{
+		uint32_t levels;
+		std::unordered_set<uint32_t> open; // trigrams, until Seal()
+		std::vector<uint64_t> bloom;       // after: a power of two bits
+		bool sealed;
+
+		Block() : levels(0), sealed(false) { }
+
+		void Add(uint32_t trigram);
+		bool MayContain(uint32_t trigram) const;
+
+		// No more lines will be added
+		void Seal();
+	};
+
+	static uint32_t LevelBit(wxLogLevel level) { return 1u << (level < 31 ? level : 31); }
+	static uint32_t LevelMask(wxLogLevel maxLevel);
+	template <typename F> static void ForEachTrigram(const wxString &text, F f);
+
+	void Index(uint64_t seq, const Entry &entry);
+
+	mutable std::mutex _lock;
+	const size_t _maxBytes;
+	std::deque<Entry> _lines; // [_begin, _end)
+	size_t _bytes;
+	uint64_t _begin;
+	uint64_t _end;
+
+	std::deque<Block> _blocks; // one per BLOCK_SHIFT lines, starting at _firstBlock
+	uint64_t _firstBlock;
+};
@@ -11,11 +11,164 @@
 #include <wx/dir.h>
 #include <wx/textfile.h>
 #include <wx/filedlg.h>
+#include <wx/listctrl.h>
+#include <wx/timer.h>
+#include <wx/panel.h>
+#include <wx/sizer.h>
+#include <wx/srchctrl.h>
+#include <wx/choice.h>
+#include <wx/wfstream.h>
+#include <wx/zstream.h>
 
 #include "LogWindow.h"
 
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <thread>
+
 static int OpenLogFile(wxFile& file, wxString *filename = NULL, wxWindow *parent = NULL);
 
+// Memory the lines kept (and shown) by the window may take, the store grows
+// up to it and then drops the oldest (a few hundred thousand typical lines)
+static const size_t LOG_WINDOW_BYTES = 64 * 1024 * 1024;
+
+// How often new lines are moved into the view: at most once per frame while
+// it's shown, and just often enough to keep the pending list short otherwise.
+static const int UPDATE_SHOWN_MS = 16;
+static const int UPDATE_HIDDEN_MS = 250;
+
+// Number of lines copied out of the store at a time while saving
+static const size_t SAVE_CHUNK_LINES = 4096;
+
+// Report mode list that asks for the text of visible rows only
+class LogList : public wxListCtrl
+{
+public:
+	LogList(wxWindow *parent, LogStore &store)
+		: wxListCtrl(parent, wxID_ANY, wxDefaultPosition, wxDefaultSize,
+		             wxLC_REPORT | wxLC_VIRTUAL | wxLC_NO_HEADER | wxLC_SINGLE_SEL),
+		  m_store(store),
+		  m_base(0),
+		  m_filterEnd(0)
+	{
+		InsertColumn(0, _("Time"));
+		InsertColumn(1, _("Message"));
+		SetColumnWidth(0, 80);
+		SetColumnWidth(1, 2000);
+
+		m_errorAttr.SetTextColour(*wxRED);
+		m_warningAttr.SetTextColour(wxColour(192, 96, 0));
+	}
+
+	// Show only the lines matching <query> (an empty query shows everything)
+	void SetFilter(const LogStore::Query &query)
+	{
+		m_query = query;
+		m_matches.clear();
+		m_filterEnd = m_store.Begin();
+		SetItemCount(0);
+		Resync();
+	}
+
+	// Resync with the store after lines were added or dropped
+	void Resync()
+	{
+		auto begin = m_store.Begin();
+		auto end = m_store.End();
+
+		// Follow new lines only if the last line was already visible
+		auto count = GetItemCount();
+		bool atBottom = count == 0 || GetTopItem() + GetCountPerPage() >= count;
+
+		long items;
+		if (m_query.IsEmpty()) {
+			items = long(end - begin);
+		} else {
+			// Only the lines added since the last update need searching
+			m_filterEnd = m_store.Find(m_query, m_filterEnd, end, m_matches);
+
+			auto dropped = std::lower_bound(m_matches.begin(), m_matches.end(), begin);
+			m_matches.erase(m_matches.begin(), dropped);
+			items = long(m_matches.size());
+		}
+
+		m_base = begin;
+		m_cached = false;
+		SetItemCount(items);
+		if (atBottom && items > 0) {
+			EnsureVisible(items - 1);
+		}
+		Refresh();
+	}
+
+protected:
+	virtual wxString OnGetItemText(long item, long column) const
+	{
+		if (!Fetch(item)) {
+			return wxEmptyString;
+		}
+
+		if (column == 0) {
+			char stamp[16];
+			strftime(stamp, sizeof(stamp), "%H:%M:%S", localtime(&m_entry.time));
+			return stamp;
+		}
+		return m_entry.text;
+	}
+
+	virtual wxListItemAttr *OnGetItemAttr(long item) const
+	{
+		if (!Fetch(item)) {
+			return NULL;
+		}
+
+		switch (m_entry.level) {
+		case wxLOG_FatalError:
+		case wxLOG_Error:
+			return &m_errorAttr;
+		case wxLOG_Warning:
+			return &m_warningAttr;
+		default:
+			return NULL;
+		}
+	}
+
+private:
+	// Both columns (and the attributes) of a row are asked for in turn, so remember the last one
+	bool Fetch(long item) const
+	{
+		uint64_t seq;
+		if (m_query.IsEmpty()) {
+			seq = m_base + item;
+		} else if (item >= 0 && size_t(item) < m_matches.size()) {
+			seq = m_matches[item];
+		} else {
+			return false;
+		}
+
+		if (seq != m_cachedSeq || !m_cached) {
+			m_cachedSeq = seq;
+			m_cached = m_store.Get(seq, m_entry);
+		}
+		return m_cached;
+	}
+
+	LogStore &m_store;
+	uint64_t m_base; // sequence number of item 0 (unfiltered)
+
+	LogStore::Query m_query;
+	std::vector<uint64_t> m_matches; // sequence number of each item (filtered)
+	uint64_t m_filterEnd;            // where the next incremental search starts
+
+	mutable uint64_t m_cachedSeq = 0;
+	mutable bool m_cached = false;
+	mutable LogStore::Entry m_entry;
+
+	mutable wxListItemAttr m_errorAttr;
+	mutable wxListItemAttr m_warningAttr;
+};
+
 class LogFrame : public wxFrame
 {
 public:
@@ -24,6 +177,8 @@ public:
 
 	virtual bool ShouldPreventAppExit() const { return false; }
 
+	virtual bool Show(bool show = true);
+
 	void OnClose(wxCommandEvent& event);
 	void OnCloseWindow(wxCloseEvent& event);
 
@@ -31,12 +186,13 @@ public:
 
 	void OnClear(wxCommandEvent& event);
 
-	void ShowLogMessage(const wxString& message)
-	{
-		m_pTextCtrl->AppendText(message + wxS('\n'));
-	}
+	void OnTimer(wxTimerEvent& event);
+
+	void OnFilter(wxCommandEvent& event);
 
 private:
+	void OnSaved(bool ok, wxString filename);
+
 	// use standard ids for our commands!
 	enum
 	{
@@ -48,8 +204,14 @@ private:
 	// common part of OnClose() and OnCloseWindow()
 	void DoClose();
 
-	wxTextCtrl  *m_pTextCtrl;
+	LogList *m_pList;
+	wxSearchCtrl *m_pSearch;
+	wxChoice *m_pLevel;
 	LogWindow *m_log;
+	wxTimer m_timer;
+
+	std::thread m_saveThread;
+	std::atomic<bool> m_saving;
 
 	DECLARE_EVENT_TABLE()
 };
@@ -59,21 +221,43 @@ BEGIN_EVENT_TABLE(LogFrame, wxFrame)
 EVT_MENU(Menu_Close, LogFrame::OnClose)
 EVT_MENU(Menu_Save, LogFrame::OnSave)
 EVT_MENU(Menu_Clear, LogFrame::OnClear)
+EVT_TIMER(wxID_ANY, LogFrame::OnTimer)
+EVT_TEXT(wxID_ANY, LogFrame::OnFilter)
+EVT_CHOICE(wxID_ANY, LogFrame::OnFilter)
 
 EVT_CLOSE(LogFrame::OnCloseWindow)
 END_EVENT_TABLE()
 
 LogFrame::LogFrame(wxWindow *pParent, LogWindow *log, const wxString& szTitle)
-		:wxFrame(pParent, wxID_ANY, szTitle)
+		:wxFrame(pParent, wxID_ANY, szTitle),
+		 m_timer(this)
 {
 	m_log = log;
+	m_saving = false;
 	SetWindowStyleFlag(wxCAPTION | wxCLOSE_BOX | wxCLIP_CHILDREN | wxSTAY_ON_TOP | wxRESIZE_BORDER);
 
-	m_pTextCtrl = new wxTextCtrl(this, wxID_ANY, wxEmptyString, wxDefaultPosition,
-		wxDefaultSize,
-		wxTE_MULTILINE | wxHSCROLL | wxTE_RICH | wxTE_READONLY);
+	auto panel = new wxPanel(this);
+
+	m_pSearch = new wxSearchCtrl(panel, wxID_ANY);
+	m_pSearch->SetDescriptiveText(_("Filter"));
 
-	m_pTextCtrl->SetFont(wxFont(11, wxMODERN, wxNORMAL, wxNORMAL, false, wxT("Terminal")));
+	// Same order as the levels in OnFilter()
+	const wxString levels[] = { _("All"), _("Messages"), _("Warnings"), _("Errors") };
+	m_pLevel = new wxChoice(panel, wxID_ANY, wxDefaultPosition, wxDefaultSize, WXSIZEOF(levels), levels);
+	m_pLevel->SetSelection(0);
+
+	m_pList = new LogList(panel, m_log->Store());
+
+	m_pList->SetFont(wxFont(11, wxMODERN, wxNORMAL, wxNORMAL, false, wxT("Terminal")));
+
+	auto filters = new wxBoxSizer(wxHORIZONTAL);
+	filters->Add(m_pSearch, 1, wxEXPAND | wxRIGHT, 4);
+	filters->Add(m_pLevel, 0, wxEXPAND);
+
+	auto sizer = new wxBoxSizer(wxVERTICAL);
+	sizer->Add(filters, 0, wxEXPAND | wxALL, 4);
+	sizer->Add(m_pList, 1, wxEXPAND);
+	panel->SetSizer(sizer);
 
 	// create menu
 	wxMenuBar *pMenuBar = new wxMenuBar;
@@ -84,6 +268,36 @@ LogFrame::LogFrame(wxWindow *pParent, LogWindow *log, const wxString& szTitle)
 	pMenu->Append(Menu_Close, _("&Close"), _("Close this window"));
 	pMenuBar->Append(pMenu, _("&Log"));
 	SetMenuBar(pMenuBar);
+
+	m_timer.Start(UPDATE_HIDDEN_MS);
+}
+
+bool LogFrame::Show(bool show)
+{
+	m_timer.Start(show ? UPDATE_SHOWN_MS : UPDATE_HIDDEN_MS);
+	if (show) {
+		m_log->FlushPending();
+		m_pList->Resync();
+	}
+	return wxFrame::Show(show);
+}
+
+void LogFrame::OnTimer(wxTimerEvent& WXUNUSED(event))
+{
+	// All lines logged since the last tick become one view update
+	if (m_log->FlushPending() && IsShown()) {
+		m_pList->Resync();
+	}
+}
+
+void LogFrame::OnFilter(wxCommandEvent& WXUNUSED(event))
+{
+	static const wxLogLevel maxLevels[] = { wxLOG_Max, wxLOG_Message, wxLOG_Warning, wxLOG_Error };
+
+	auto selection = m_pLevel->GetSelection();
+	auto maxLevel = (selection >= 0 && selection < int(WXSIZEOF(maxLevels))) ? maxLevels[selection] : wxLOG_Max;
+
+	m_pList->SetFilter(LogStore::Query(m_pSearch->GetValue(), maxLevel));
 }
 
 void LogFrame::DoClose()
@@ -106,27 +320,80 @@ void LogFrame::OnCloseWindow(wxCloseEvent& WXUNUSED(event))
 
 void LogFrame::OnSave(wxCommandEvent& WXUNUSED(event))
 {
+	if (m_saving) {
+		wxLogStatus((wxFrame*)this, _("Still saving the log, please wait."));
+		return;
+	}
+
 	wxString filename;
-	wxFile file;
-	int rc = OpenLogFile(file, &filename, this);
+	auto file = std::make_shared<wxFile>();
+	int rc = OpenLogFile(*file, &filename, this);
 	if (rc == -1)
 	{
 		// cancelled
 		return;
 	}
 
-	bool bOk = rc != 0;
+	if (rc == 0) {
+		wxLogError(_("Can't save log contents to file."));
+		return;
+	}
+
+	// Save everything in the store right now (lines logged later aren't included).
+	// The lines are streamed from the store on another thread, so a large log
+	// doesn't hang the GUI. Saving as *.gz compresses it.
+	auto &store = m_log->Store();
+	auto begin = store.Begin();
+	auto end = store.End();
+	bool compress = filename.Lower().EndsWith(wxT(".gz"));
 
-	// retrieve text and save it
-	// -------------------------
-	int nLines = m_pTextCtrl->GetNumberOfLines();
-	for (int nLine = 0; bOk && nLine < nLines; nLine++) {
-		bOk = file.Write(m_pTextCtrl->GetLineText(nLine) +
-			wxTextFile::GetEOL());
+	if (m_saveThread.joinable()) {
+		m_saveThread.join();
 	}
 
-	if (bOk)
-		bOk = file.Close();
+	m_saving = true;
+	m_saveThread = std::thread([this, &store, file, filename, begin, end, compress]() {
+		bool bOk;
+		{
+			wxFileOutputStream fileStream(*file);
+			std::unique_ptr<wxZlibOutputStream> zlibStream;
+			wxOutputStream *out = &fileStream;
+			if (compress) {
+				zlibStream.reset(new wxZlibOutputStream(fileStream, -1, wxZLIB_GZIP));
+				out = zlibStream.get();
+			}
+
+			// retrieve text and save it
+			// -------------------------
+			auto eol = wxTextFile::GetEOL();
+			LogStore::Entries entries;
+			bOk = out->IsOk();
+			for (auto seq = begin; bOk && seq < end; seq += SAVE_CHUNK_LINES) {
+				entries.clear();
+				store.Get(seq, std::min<uint64_t>(seq + SAVE_CHUNK_LINES, end), entries);
+
+				for (auto &entry : entries) {
+					auto utf8 = (entry.text + eol).utf8_str();
+					out->Write(utf8.data(), utf8.length());
+				}
+				bOk = out->IsOk();
+			}
+
+			if (zlibStream) {
+				bOk = zlibStream->Close() && bOk;
+			}
+		}
+
+		if (bOk)
+			bOk = file->Close();
+
+		CallAfter(&LogFrame::OnSaved, bOk, filename);
+	});
+}
+
+void LogFrame::OnSaved(bool bOk, wxString filename)
+{
+	m_saving = false;
 
 	if (!bOk) {
 		wxLogError(_("Can't save log contents to file."));
@@ -138,11 +405,16 @@ void LogFrame::OnSave(wxCommandEvent& WXUNUSED(event))
 
 void LogFrame::OnClear(wxCommandEvent& WXUNUSED(event))
 {
-	m_pTextCtrl->Clear();
+	m_log->Store().Clear();
+	m_pList->Resync();
 }
 
 LogFrame::~LogFrame()
 {
+	m_timer.Stop();
+	if (m_saveThread.joinable()) {
+		m_saveThread.join();
+	}
 	m_log->OnFrameDelete(this);
 }
 
@@ -150,6 +422,8 @@ LogWindow::LogWindow(wxWindow *pParent,
 	                 const wxString& szTitle,
 					 bool bShow,
 					 bool bDoPass)
+	: m_store(LOG_WINDOW_BYTES),
+	  m_pendingBytes(0)
 {
 	m_pLogFrame = NULL;
 
@@ -166,15 +440,58 @@ void LogWindow::Show(bool bShow)
 	m_pLogFrame->Show(bShow);
 }
 
-void LogWindow::DoLogTextAtLevel(wxLogLevel level, const wxString& msg)
+void LogWindow::DoLogRecord(wxLogLevel level, const wxString& msg, const wxLogRecordInfo& info)
 {
-	if (!m_pLogFrame)
-		return;
+	// What wxLogChain would do, without formatting it for this log
+	if (IsPassingMessages() && GetOldLog())
+		GetOldLog()->LogRecord(level, msg, info);
 
 	if (level == wxLOG_Trace)
 		return;
 
-	m_pLogFrame->ShowLogMessage(msg);
+	LogStore::Entry entry = { level, info.timestamp, msg };
+
+	std::lock_guard<std::mutex> lock(m_pendingLock);
+	m_pendingBytes += LogStore::Bytes(entry);
+	m_pending.push_back(std::move(entry));
+}
+
+void LogWindow::operator()(const AsyncLog::Lines &lines)
+{
+	std::lock_guard<std::mutex> lock(m_pendingLock);
+	for (auto &line : lines) {
+		if (line.level != wxLOG_Trace) {
+			LogStore::Entry entry = { line.level, line.time, line.text };
+			m_pendingBytes += LogStore::Bytes(entry);
+			m_pending.push_back(std::move(entry));
+		}
+	}
+
+	// Nothing past the store's size would survive the next flush anyway
+	if (m_pendingBytes > m_store.MaxBytes()) {
+		auto drop = m_pending.begin();
+		while (m_pendingBytes > m_store.MaxBytes() && drop + 1 < m_pending.end()) {
+			m_pendingBytes -= LogStore::Bytes(*drop++);
+		}
+		m_pending.erase(m_pending.begin(), drop);
+	}
+}
+
+bool LogWindow::FlushPending()
+{
+	LogStore::Entries pending;
+	{
+		std::lock_guard<std::mutex> lock(m_pendingLock);
+		pending.swap(m_pending);
+		m_pendingBytes = 0;
+	}
+
+	if (pending.empty()) {
+		return false;
+	}
+
+	m_store.Append(pending);
+	return true;
 }
 
 wxFrame *LogWindow::GetFrame() const
@@ -195,6 +512,7 @@ void LogWindow::OnFrameDelete(wxFrame * WXUNUSED(frame))
 
 LogWindow::~LogWindow()
 {
+	AsyncLog::SetSink(nullptr);
 	delete m_pLogFrame;
 }
 
@@ -5,10 +5,16 @@
 #include <wx/wfstream.h>
 #include <wx/zstream.h>
 
+#include "AsyncLog.h"
+#include "LogStore.h"
+
+#include <mutex>
+
 class LogFrame;
 
 class LogWindow :
-	public wxLogPassThrough
+	public wxLogPassThrough,
+	public AsyncLog::Sink
 {
 public:
 	LogWindow(wxWindow *pParent,
@@ -25,9 +31,25 @@ public:
 
 	virtual void OnFrameDelete(wxFrame *frame);
 
+	// Lines from AsyncLog (called on its thread)
+	virtual void operator()(const AsyncLog::Lines &lines);
+
+	// Everything shown in the window
+	LogStore &Store() { return m_store; }
+
+	// Moves lines logged since the last call into the store, returns whether there were any
+	bool FlushPending();
+
 protected:
-	virtual void DoLogTextAtLevel(wxLogLevel Level, const wxString& msg);
+	// Stores the message as it was logged (wx's text has the time and level prepended)
+	virtual void DoLogRecord(wxLogLevel level, const wxString& msg, const wxLogRecordInfo& info);
 
 private:
 	LogFrame *m_pLogFrame;
+	LogStore m_store;
+
+	// Lines waiting for the next frame update (logged from any thread)
+	std::mutex m_pendingLock;
+	LogStore::Entries m_pending;
+	size_t m_pendingBytes; // LogStore::Bytes() of m_pending
 };
@@ -0,0 +1,193 @@
+// wx #includes must come first to prevent secure function warning from wxcrt.h
+#include <wx/string.h>
+
+#include "Metrics.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <vector>
+
+// Zero initialized before any constructor runs
+Metrics::Metric *Metrics::_first;
+Metrics::Collector *Metrics::_collectors;
+int Metrics::_slots;
+
+HS_THREAD_LOCAL Metrics::Value *Metrics::_shard = nullptr;
+
+namespace {
+	// Metrics that don't fit write here (and aren't reported)
+	const int OVERFLOW_SLOTS = Metrics::Distribution::BUCKETS + 1;
+
+	struct Shard
+	{
+		char before[64]; // keeps the values off cache lines used by anything else
+		uint64_t values[Metrics::MAX_SLOTS + OVERFLOW_SLOTS];
+		char after[64];
+		bool inUse;
+
+		Shard() : inUse(true)
+		{
+			std::fill(std::begin(values), std::end(values), 0);
+		}
+	};
+
+	std::mutex mu; // guards shards
+	std::vector<Shard *> shards; // never freed, their values are part of the totals
+}
+
+Metrics::Metric::Metric(Type type, const char *name, const char *help, int slots)
+	: _type(type),
+	  _name(name),
+	  _help(help),
+	  _slot(Metrics::_slots + slots <= MAX_SLOTS ? Metrics::_slots : MAX_SLOTS),
+	  _next(Metrics::_first)
+{
+	// Only called during static initialization, so no locking
+	if (_slot < MAX_SLOTS) {
+		Metrics::_slots += slots;
+		Metrics::_first = this;
+	}
+}
+
+Metrics::Collector::Collector()
+	: _next(Metrics::_collectors)
+{
+	Metrics::_collectors = this;
+}
+
+Metrics::Value *Metrics::AcquireShard()
+{
+	std::lock_guard<std::mutex> lock(mu);
+	for (auto shard : shards) {
+		if (!shard->inUse) {
+			shard->inUse = true;
+			return shard->values;
+		}
+	}
+
+	shards.push_back(new Shard());
+	return shards.back()->values;
+}
+
+void Metrics::ReleaseThread()
+{
+	if (_shard) {
+		std::lock_guard<std::mutex> lock(mu);
+		for (auto shard : shards) {
+			if (shard->values == _shard) {
+				shard->inUse = false;
+			}
+		}
+		_shard = nullptr;
+	}
+}
+
+uint64_t Metrics::Read(const Value &value)
+{
+	uint64_t last = value;
+	while (true) {
+		uint64_t now = value;
+		if (now == last) {
+			return now;
+		}
+		last = now;
+	}
+}
+
+uint64_t Metrics::Sum(int slot)
+{
+	std::lock_guard<std::mutex> lock(mu);
+	uint64_t sum = 0;
+	for (auto shard : shards) {
+		sum += Read(shard->values[slot]);
+	}
+	return sum;
+}
+
+void Metrics::Header(std::string &out, const char *name, const char *type, const char *help)
+{
+	out += wxString::Format("# HELP %s %s\n# TYPE %s %s\n", name, help, name, type).ToStdString();
+}
+
+std::string Metrics::Escape(const std::string &label)
+{
+	std::string escaped;
+	for (auto c : label) {
+		switch (c) {
+		case '\\': escaped += "\\\\"; break;
+		case '"': escaped += "\\\""; break;
+		case '\n': escaped += "\\n"; break;
+		default: escaped += c; break;
+		}
+	}
+	return escaped;
+}
+
+std::string Metrics::Scrape()
+{
+	// Sum every shard once, up front
+	std::vector<uint64_t> totals(MAX_SLOTS);
+	{
+		std::lock_guard<std::mutex> lock(mu);
+		for (auto shard : shards) {
+			for (int i = 0; i < MAX_SLOTS; i++) {
+				totals[i] += Read(shard->values[i]);
+			}
+		}
+	}
+
+	// In name order, so scrapes are easy to compare
+	std::vector<const Metric *> metrics;
+	for (auto metric = _first; metric; metric = metric->Next()) {
+		metrics.push_back(metric);
+	}
+	std::sort(metrics.begin(), metrics.end(), [](const Metric *a, const Metric *b) { return std::strcmp(a->Name(), b->Name()) < 0; });
+
+	std::string out;
+	for (auto metric : metrics) {
+		auto values = &totals[metric->_slot];
+		switch (metric->_type) {
+		case Metric::COUNTER:
+			Header(out, metric->Name(), "counter", metric->Help());
+			out += wxString::Format("%s %llu\n", metric->Name(), (unsigned long long)values[0]).ToStdString();
+			break;
+
+		case Metric::GAUGE:
+			Header(out, metric->Name(), "gauge", metric->Help());
+			out += wxString::Format("%s %lld\n", metric->Name(), (long long)values[0]).ToStdString();
+			break;
+
+		case Metric::HISTOGRAM: {
+				auto scale = static_cast<const Distribution *>(metric)->Scale();
+				Header(out, metric->Name(), "histogram", metric->Help());
+
+				// Up to the last bucket used (the top one's bound is +Inf anyway)
+				int last = Distribution::BUCKETS - 2;
+				while (last > 0 && !values[last]) {
+					last--;
+				}
+
+				uint64_t count = 0;
+				for (int i = 0; i <= last; i++) {
+					count += values[i];
+					auto bound = i ? double((uint64_t(1) << i) - 1) : 0.0;
+					out += wxString::Format("%s_bucket{le=\"%.9g\"} %llu\n", metric->Name(), bound * scale, (unsigned long long)count).ToStdString();
+				}
+				for (int i = last + 1; i < Distribution::BUCKETS; i++) {
+					count += values[i];
+				}
+				out += wxString::Format("%s_bucket{le=\"+Inf\"} %llu\n", metric->Name(), (unsigned long long)count).ToStdString();
+				out += wxString::Format("%s_sum %.9g\n", metric->Name(), double(values[Distribution::BUCKETS]) * scale).ToStdString();
+				out += wxString::Format("%s_count %llu\n", metric->Name(), (unsigned long long)count).ToStdString();
+			}
+			break;
+		}
+	}
+
+	for (auto collector = _collectors; collector; collector = collector->_next) {
+		(*collector)(out);
+	}
+	return out;
+}
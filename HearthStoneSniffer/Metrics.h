@@ -0,0 +1,151 @@
+#pragma once
+
+#include "AsyncLog.h" // HS_THREAD_LOCAL
+#include "Histogram.h"
+
+#include <cstdint>
+#include <string>
+
+// Counters, gauges and histograms for the packet path, read as Prometheus
+// text (see MetricsServer).
+//
+// Every thread that records gets its own shard of values, padded out to
+// whole cache lines, so recording is a plain add with no sharing. The values
+// aren't atomics: a 64-bit std::atomic is a locked cmpxchg8b on 32-bit x86,
+// even relaxed. Reading sums the shards while their threads carry on (see
+// Read()). When a thread ends it calls ReleaseThread() and its shard (with
+// its values) goes to the next new thread. Instances are meant to be file
+// scope statics (like Diagnostic), they register themselves.
+class Metrics
+{
+public:
+	class Metric
+	{
+	public:
+		const char *Name() const { return _name; }
+		const char *Help() const { return _help; }
+
+		Metric *Next() const { return _next; }
+
+	protected:
+		enum Type { COUNTER, GAUGE, HISTOGRAM };
+
+		// <name> and <help> must be string literals
+		Metric(Type type, const char *name, const char *help, int slots);
+
+		void Add(int slot, uint64_t n)
+		{
+			Metrics::Values()[_slot + slot] += n;
+		}
+
+		uint64_t Sum(int slot) const { return Metrics::Sum(_slot + slot); }
+
+	private:
+		friend class Metrics;
+
+		const Type _type;
+		const char *const _name;
+		const char *const _help;
+		const int _slot; // first of this metric's values in a shard
+		Metric *const _next;
+
+		Metric(const Metric &);
+		Metric &operator=(const Metric &);
+	};
+
+	class Counter : public Metric
+	{
+	public:
+		Counter(const char *name, const char *help) : Metric(COUNTER, name, help, 1) { }
+
+		void Add(uint64_t n = 1) { Metric::Add(0, n); }
+		uint64_t Value() const { return Sum(0); }
+	};
+
+	// Goes up and down (e.g. open streams), each thread's changes sum to the value
+	class Gauge : public Metric
+	{
+	public:
+		Gauge(const char *name, const char *help) : Metric(GAUGE, name, help, 1) { }
+
+		void Add(int64_t n) { Metric::Add(0, uint64_t(n)); }
+		int64_t Value() const { return int64_t(Sum(0)); }
+	};
+
+	// Power of two buckets (the Prometheus "le" bounds are 2^i - 1, times <scale>
+	// to give the base unit, e.g. 1e-9 for nanoseconds recorded as seconds)
+	class Distribution : public Metric
+	{
+	public:
+		enum { BUCKETS = 65 }; // 0, then one per highest bit
+
+		Distribution(const char *name, const char *help, double scale = 1.0)
+			: Metric(HISTOGRAM, name, help, BUCKETS + 1), _scale(scale) { }
+
+		void Record(uint64_t value)
+		{
+			Metric::Add(value ? Histogram::HighestBit(value) + 1 : 0, 1);
+			Metric::Add(BUCKETS, value);
+		}
+
+		// Negative values (e.g. clock skew) count as zero
+		void RecordSigned(int64_t value) { Record(value > 0 ? uint64_t(value) : 0); }
+
+		double Scale() const { return _scale; }
+
+	private:
+		const double _scale;
+	};
+
+	// Adds lines for values kept elsewhere (e.g. per packet type) to every scrape
+	struct Collector
+	{
+		Collector();
+		virtual void operator()(std::string &out) = 0;
+		virtual ~Collector() { }
+
+	private:
+		friend class Metrics;
+		Collector *const _next;
+	};
+
+	// Everything in the Prometheus text format (version 0.0.4)
+	static std::string Scrape();
+
+	// Hand this thread's shard on (call before a recording thread exits)
+	static void ReleaseThread();
+
+	// Helpers for collectors
+	static void Header(std::string &out, const char *name, const char *type, const char *help);
+	static std::string Escape(const std::string &label);
+
+	enum { MAX_SLOTS = 1024 };
+
+private:
+	Metrics() {}
+
+	// Only ever written by the thread that owns the shard
+	typedef volatile uint64_t Value;
+
+	// This thread's values
+	static Value *Values()
+	{
+		if (!_shard) {
+			_shard = AcquireShard();
+		}
+		return _shard;
+	}
+
+	static Value *AcquireShard();
+	static uint64_t Sum(int slot);
+
+	// Another thread's value, which may be being written. A 64-bit value is
+	// written in two halves on a 32-bit target, so the read is repeated until
+	// it gets the same answer twice.
+	static uint64_t Read(const Value &value);
+
+	static HS_THREAD_LOCAL Value *_shard;
+	static Metric *_first;
+	static Collector *_collectors;
+	static int _slots; // allocated so far
+};
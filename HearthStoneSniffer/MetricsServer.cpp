@@ -0,0 +1,195 @@
+#ifdef _WIN32
+// winsock2.h has to come before windows.h (included by wx)
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "ws2_32.lib")
+#endif
+
+// wx #includes must come first to prevent secure function warning from wxcrt.h
+#include <wx/log.h>
+
+#include "MetricsServer.h"
+#include "Metrics.h"
+
+#include <cstring>
+#include <string>
+
+#ifdef _WIN32
+typedef int socklen_t;
+
+static const MetricsServer::Socket NO_SOCKET = INVALID_SOCKET;
+static void closeSocket(MetricsServer::Socket s) { closesocket(s); }
+static int socketError() { return WSAGetLastError(); }
+static bool interrupted() { return false; }
+#else
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+static const MetricsServer::Socket NO_SOCKET = -1;
+static void closeSocket(MetricsServer::Socket s) { close(s); }
+static int socketError() { return errno; }
+static bool interrupted() { return errno == EINTR; }
+#endif
+
+namespace {
+	// Longest request read (only the request line matters)
+	const size_t MAX_REQUEST = 8192;
+
+	// How often Run() checks whether it should stop, and how long a client gets
+	// to send its request (and to take the response) before it's dropped
+	const long POLL_MICROSECONDS = 250000;
+	const int REQUEST_SECONDS = 2;
+
+	bool sendAll(MetricsServer::Socket s, const std::string &data)
+	{
+		size_t sent = 0;
+		while (sent < data.size()) {
+			auto n = send(s, data.data() + sent, int(data.size() - sent), 0);
+			if (n <= 0) {
+				if (n < 0 && interrupted()) {
+					continue;
+				}
+				return false;
+			}
+			sent += size_t(n);
+		}
+		return true;
+	}
+
+	std::string response(const char *status, const std::string &body)
+	{
+		return std::string("HTTP/1.0 ") + status + "\r\n"
+			"Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+			"Content-Length: " + std::to_string(body.size()) + "\r\n"
+			"Connection: close\r\n\r\n" + body;
+	}
+}
+
+MetricsServer::MetricsServer(uint16_t port)
+	: _socket(NO_SOCKET),
+	  _started(false),
+	  _stop(false)
+{
+#ifdef _WIN32
+	WSADATA wsa;
+	if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+		wxLogWarning("metrics: WSAStartup failed");
+		return;
+	}
+#endif
+	_started = true;
+
+	_socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+	if (_socket == NO_SOCKET) {
+		wxLogWarning("metrics: socket: %d", socketError());
+		return;
+	}
+
+	// Rebind straight after a restart, without letting anything else share the port
+	// (SO_REUSEADDR on Windows would let another process bind it too)
+	int option = 1;
+#ifdef _WIN32
+	setsockopt(_socket, SOL_SOCKET, SO_EXCLUSIVEADDRUSE, reinterpret_cast<const char *>(&option), sizeof(option));
+#else
+	setsockopt(_socket, SOL_SOCKET, SO_REUSEADDR, reinterpret_cast<const char *>(&option), sizeof(option));
+#endif
+
+	// Local only, there's no authentication
+	sockaddr_in addr = {};
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = htons(port);
+	if (bind(_socket, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 || listen(_socket, 8) != 0) {
+		wxLogWarning("metrics: can't listen on port %d: %d", int(port), socketError());
+		return;
+	}
+
+	wxLogVerbose("metrics: serving on http://127.0.0.1:%d/metrics", int(port));
+	_thread = std::thread(&MetricsServer::Run, this);
+}
+
+MetricsServer::~MetricsServer()
+{
+	if (_thread.joinable()) {
+		_stop = true;
+		_thread.join();
+	}
+
+	if (_socket != NO_SOCKET) {
+		closeSocket(_socket);
+	}
+#ifdef _WIN32
+	if (_started) {
+		WSACleanup();
+	}
+#endif
+}
+
+void MetricsServer::Run()
+{
+	while (!_stop) {
+		fd_set readable;
+		FD_ZERO(&readable);
+		FD_SET(_socket, &readable);
+		timeval timeout = { 0, POLL_MICROSECONDS };
+
+		auto ready = select(int(_socket + 1), &readable, nullptr, nullptr, &timeout);
+		if (ready < 0) {
+			if (interrupted()) {
+				continue;
+			}
+			wxLogWarning("metrics: select: %d", socketError());
+			return;
+		}
+		if (ready == 0) {
+			continue;
+		}
+
+		auto client = accept(_socket, nullptr, nullptr);
+		if (client == NO_SOCKET) {
+			continue;
+		}
+		Serve(client);
+		closeSocket(client);
+	}
+}
+
+void MetricsServer::Serve(Socket client)
+{
+	// Don't let a client that never sends its request, or never reads the
+	// response, hold up the next one (a timed out send() gives up on it)
+#ifdef _WIN32
+	DWORD wait = REQUEST_SECONDS * 1000;
+#else
+	timeval wait = { REQUEST_SECONDS, 0 };
+#endif
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, reinterpret_cast<const char *>(&wait), sizeof(wait));
+	setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, reinterpret_cast<const char *>(&wait), sizeof(wait));
+
+	// Read up to the end of the headers
+	std::string request;
+	char buffer[1024];
+	while (request.size() < MAX_REQUEST && request.find("\r\n\r\n") == std::string::npos) {
+		auto n = recv(client, buffer, sizeof(buffer), 0);
+		if (n <= 0) {
+			if (n < 0 && interrupted()) {
+				continue;
+			}
+			break;
+		}
+		request.append(buffer, size_t(n));
+	}
+
+	auto line = request.substr(0, request.find("\r\n"));
+	if (line.compare(0, 4, "GET ") != 0) {
+		sendAll(client, response("405 Method Not Allowed", "only GET is supported\n"));
+	} else if (line.compare(4, 9, "/metrics ") != 0 && line.compare(4, 2, "/ ") != 0) {
+		sendAll(client, response("404 Not Found", "try /metrics\n"));
+	} else {
+		sendAll(client, response("200 OK", Metrics::Scrape()));
+	}
+}
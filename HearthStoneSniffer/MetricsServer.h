@@ -0,0 +1,35 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+// Serves Metrics::Scrape() over HTTP on the loopback interface, for a local
+// Prometheus (or curl) to read. One request at a time on its own thread.
+class MetricsServer
+{
+public:
+	// Starts listening on 127.0.0.1:<port>, check IsServing()
+	explicit MetricsServer(uint16_t port);
+	~MetricsServer();
+
+	bool IsServing() const { return _thread.joinable(); }
+
+#ifdef _WIN32
+	typedef uintptr_t Socket; // SOCKET
+#else
+	typedef int Socket;
+#endif
+
+private:
+	void Run();
+	void Serve(Socket client);
+
+	Socket _socket;
+	bool _started; // WSAStartup() succeeded (always true elsewhere)
+	std::atomic<bool> _stop;
+	std::thread _thread;
+
+	MetricsServer(const MetricsServer &);
+	MetricsServer &operator=(const MetricsServer &);
+};
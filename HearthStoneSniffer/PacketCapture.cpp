@@ -3,15 +3,17 @@
 #include <wx/translation.h>
 
 #include "PacketCapture.h"
+#include "AsyncLog.h"
+#include "CaptureFile.h"
+#include "CaptureFilter.h"
+#include "Clock.h"
+#include "Metrics.h"
 
 #include <pcap.h>
 #include <thread>
-#include <chrono>
-#include <mutex>
-#include <set>
 
-std::set<std::string> deviceNames;
-std::mutex mu;
+static Metrics::Counter kernelDrops("hs_capture_dropped_total", "Packets dropped by the kernel (no room in the capture buffer).");
+static Metrics::Counter interfaceDrops("hs_capture_interface_dropped_total", "Packets dropped by the network interface or its driver.");
 
 int64_t toNanoTime(timeval ts) {
 	const int64_t NSEC_PER_SEC = 1e9;
@@ -20,133 +22,211 @@ int64_t toNanoTime(timeval ts) {
 	return ts.tv_sec * NSEC_PER_SEC + ts.tv_usec * NSEC_PER_USEC;
 }
 
-void PacketCapture::Start(const std::string &filter, Callback::Factory callbackFactory)
+pcap_t *PacketCapture::OpenLive(const std::string &device)
 {
-	wxCHECK2(callbackFactory, return);
+	char errbuf[PCAP_ERRBUF_SIZE] = "";
 
-	// Start thread
-	auto thread = std::thread([filter, callbackFactory]() {
-		char errbuf[PCAP_ERRBUF_SIZE];
-
-		// Continually scan interfaces to handle waking from sleep other reason 
-		// an interface may be added (after possibly becoming invalid earlier).
-		while (1) {
-			// Get all devices
-			pcap_if_t *alldevs;
-			if (pcap_findalldevs(&alldevs, errbuf) == -1) {
-				wxLogError("pcap_findalldevs: %s", errbuf);
-				return;
-			}
-	
-			// Enumerate all devices and start a thread for each one
-			// we aren't already listening to.
-			{
-				std::lock_guard<std::mutex> lock(mu);
-				for (auto dev = alldevs; dev != nullptr; dev = dev->next) {
-					if (deviceNames.find(dev->name) == deviceNames.end()) {
-						deviceNames.insert(dev->name);
-
-						wxLogMessage("listening to %s (%s)", dev->name, dev->description);
-						Start(filter, dev, callbackFactory);
-					}
-				}
-			}
-
-			// Done with the device list
-			pcap_freealldevs(alldevs);
-
-			// Wait a while until the next loop
-			std::this_thread::sleep_for(std::chrono::seconds(60));
-		}
-	});
+	pcap_t *pcap = pcap_open_live(device.c_str(), 65535, 0, 1000, errbuf);
+	if (!pcap) {
+		wxLogError("pcap_open_live(%s): %s", device, errbuf);
+	} else if (errbuf[0] != '\0') {
+		wxLogWarning("pcap_open_live(%s): %s", device, errbuf);
+	}
+	return pcap;
+}
 
-	// <thread> will be deleted once it completes
-	thread.detach();
+static pcap_t *openOffline(const std::string &file)
+{
+	char errbuf[PCAP_ERRBUF_SIZE];
+
+	pcap_t *pcap = pcap_open_offline(file.c_str(), errbuf);
+	if (!pcap) {
+		wxLogError("pcap_open_offline(%s): %s", file, errbuf);
+	}
+	return pcap;
 }
 
-void PacketCapture::Start(const std::string &filter, pcap_if_t *device, Callback::Factory callbackFactory)
+bool PacketCapture::SetFilter(pcap_t *pcap, const std::string &filter)
 {
-	wxCHECK2(device && callbackFactory, return);
+	if (filter.empty()) {
+		return true;
+	}
 
-	char errbuf[PCAP_ERRBUF_SIZE] = "";
+	bpf_program bpf;
+	if (pcap_compile(pcap, &bpf, filter.c_str(), 1, 0) == -1) {
+		wxLogError("pcap_compile(%s): %s", filter, pcap_geterr(pcap));
+		return false;
+	}
 
-	// Open device
-	pcap_t *pcap = pcap_open_live(device->name, 65535, 0, 1000, errbuf);
-	if (!pcap) {
-		wxLogError("pcap_open_live(%s): %s", device->name, errbuf);
+	bool ok = pcap_setfilter(pcap, &bpf) != -1;
+	if (!ok) {
+		wxLogError("pcap_setfilter(%s): %s", filter, pcap_geterr(pcap));
+	}
+	pcap_freecode(&bpf);
+	return ok;
+}
+
+static void onPacket(uint8_t *user, const pcap_pkthdr *header, const uint8_t *packet)
+{
+	if (header->caplen < header->len) {
+		AsyncLogWarning("truncated packet (%d of %d bytes)", header->caplen, header->len);
+		// Will likely fail during packet parsing (truncated payload)
+	}
+
+	auto&& time = toNanoTime(header->ts);
+	auto&& data = std::make_range(packet, packet + header->caplen);
+
+	(*(PacketCapture::Callback*)user)(time, data);
+}
+
+// Pass every packet to <callback> until the capture ends (or fails)
+static bool loop(pcap_t *pcap, PacketCapture::Callback &callback)
+{
+	callback.SetLinkType(pcap_datalink(pcap));
+	if (pcap_loop(pcap, -1, &onPacket, (uint8_t*)&callback) < 0) {
+		wxLogError("pcap_loop: %s", pcap_geterr(pcap));
+		return false;
+	}
+	return true;
+}
+
+// Swap in a program without the connections rejected since the last one,
+// unless the last swap was too recent (the kernel recompiles every time)
+static void narrow(pcap_t *pcap, const std::string &filter, uint64_t &applied, int64_t &lastSwap)
+{
+	auto generation = CaptureFilter::Generation();
+	if (generation == applied) {
+		return;
+	}
+
+	auto now = Clock::Now();
+	if (now - lastSwap < int64_t(CaptureFilter::MIN_SWAP_MILLISECONDS) * 1000000) {
 		return;
-	} else if (errbuf[0] != '\0') {
-		wxLogWarning("pcap_open_live(%s): %s", device->name, errbuf);
 	}
+	lastSwap = now;
 
-	Start(filter, pcap, callbackFactory, device->name);
+	// Compiled before the old program is replaced, and kept if it doesn't
+	// (don't retry a bad one until the list changes again)
+	applied = generation;
+	PacketCapture::SetFilter(pcap, CaptureFilter::Build(filter));
+}
+
+// Count the drops since <last> (pcap_stats counters are 32 bits and wrap)
+static void countDrops(pcap_t *pcap, pcap_stat &last)
+{
+	pcap_stat stats;
+	if (pcap_stats(pcap, &stats) != 0) {
+		return;
+	}
+
+	kernelDrops.Add(uint32_t(stats.ps_drop - last.ps_drop));
+	interfaceDrops.Add(uint32_t(stats.ps_ifdrop - last.ps_ifdrop));
+	last = stats;
+}
+
+// Same as loop() for a live capture, but flush the callback whenever the read times out
+bool PacketCapture::Dispatch(pcap_t *pcap, Callback &callback, const std::string &filter)
+{
+	uint64_t applied = 0; // generation of the program in use (0 is the base filter)
+	int64_t lastSwap = 0;
+
+	// Drops are polled about once a second
+	const int64_t STATS_INTERVAL = 1000000000;
+	pcap_stat dropped = {};
+	int64_t lastStats = Clock::Now();
+
+	callback.SetLinkType(pcap_datalink(pcap));
+	while (true) {
+		auto count = pcap_dispatch(pcap, -1, &onPacket, (uint8_t*)&callback);
+		if (count == -2) {
+			countDrops(pcap, dropped);
+			return true; // pcap_breakloop()
+		} else if (count < 0) {
+			wxLogError("pcap_dispatch: %s", pcap_geterr(pcap));
+			return false;
+		} else if (count == 0) {
+			callback.Flush();
+		}
+
+		if (!filter.empty()) {
+			narrow(pcap, filter, applied, lastSwap);
+		}
+
+		auto now = Clock::Now();
+		if (now - lastStats >= STATS_INTERVAL) {
+			lastStats = now;
+			countDrops(pcap, dropped);
+		}
+	}
 }
 
 void PacketCapture::Start(const std::string &filter, const std::string &file, Callback::Factory callbackFactory)
 {
 	wxCHECK2(!file.empty() && callbackFactory, return);
 
-	char errbuf[PCAP_ERRBUF_SIZE];
-
 	// Open the file
-	pcap_t *pcap = pcap_open_offline(file.c_str(), errbuf);
+	pcap_t *pcap = openOffline(file);
 	if (!pcap) {
-		wxLogError("pcap_open_offline(%s): %s", file, errbuf);
 		return;
 	}
 
 	Start(filter, pcap, callbackFactory);
 }
 
-void PacketCapture::Start(const std::string &filter, pcap_t *pcap, Callback::Factory callbackFactory, std::string deviceName)
+bool PacketCapture::Run(const std::string &filter, const std::string &file, Callback::Factory callbackFactory)
 {
-	wxCHECK2(pcap && callbackFactory, return);
+	wxCHECK(!file.empty() && callbackFactory, false);
 
-	// Filter
-	if (!filter.empty()) {
-		bpf_program bpf;
-		if (pcap_compile(pcap, &bpf, filter.c_str(), 1, 0) == -1) {
-			wxLogError("pcap_compile(%s): %s", filter, pcap_geterr(pcap));
-			return;
-		}
+	Callback::Ptr callback = callbackFactory();
 
-		if (pcap_setfilter(pcap, &bpf) == -1) {
-			wxLogError("pcap_setfilter(%s): %s", filter, pcap_geterr(pcap));
-			return;
-		}
+	// Read pcap/pcapng straight out of a mapping of the file, libpcap handles anything else
+	auto status = CaptureFile::Read(filter, file, *callback);
+	if (status != CaptureFile::UNSUPPORTED) {
+		return status == CaptureFile::READ;
 	}
 
-	// Start thread
-	auto thread = std::thread([pcap, callbackFactory, deviceName]() {
-		auto handler = [](uint8_t *user, const pcap_pkthdr *header, const uint8_t *packet) {
-			if (header->caplen < header->len) {
-				wxLogWarning("truncated packet (%d of %d bytes)", header->caplen, header->len);
-				// Will likely fail during packet parsing (truncated payload)
-			}
+	pcap_t *pcap = openOffline(file);
+	if (!pcap) {
+		return false;
+	}
 
-			auto&& time = toNanoTime(header->ts);
-			auto&& data = std::make_range(packet, packet + header->caplen);
+	bool ok = SetFilter(pcap, filter) && loop(pcap, *callback);
+	pcap_close(pcap);
+	return ok;
+}
 
-			(*(Callback*)user)(time, data);
-		};
+void PacketCapture::Start(const std::string &filter, pcap_t *pcap, Callback::Factory callbackFactory)
+{
+	wxCHECK2(pcap && callbackFactory, return);
 
+	// Filter
+	if (!SetFilter(pcap, filter)) {
+		return;
+	}
+
+	// Start thread
+	auto thread = std::thread([pcap, callbackFactory]() {
 		Callback::Ptr callback = callbackFactory();
 		// Read packets
-		if (pcap_loop(pcap, -1, handler, (uint8_t*)callback.get()) < 0) {
-			wxLogError("pcap_loop: %s", pcap_geterr(pcap));
+		if (pcap_file(pcap)) {
+			loop(pcap, *callback);
+		} else {
+			Dispatch(pcap, *callback);
 		}
 
 		wxLogWarning("pcap_loop exited");
 		pcap_close(pcap);
-
-		// We are no longer listening to this device, but if it becomes 
-		// available again the outter loop will start a new thread.
-		{
-			std::lock_guard<std::mutex> lock(mu);
-			deviceNames.erase(deviceName);
-		}
+		EndThread(callback);
 	});
 
 	// <thread> will be deleted once it completes
 	thread.detach();
 }
+
+void PacketCapture::EndThread(Callback::Ptr &callback)
+{
+	// The parsing stack may still log while it's destroyed, so it goes before this thread's log buffer
+	callback.reset();
+	AsyncLog::ReleaseThread();
+	Metrics::ReleaseThread();
+}
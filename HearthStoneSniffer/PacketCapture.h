@@ -17,12 +17,36 @@ public:
 		virtual void operator()(int64_t nanotime, std::range<const uint8_t*> data) = 0;
 		virtual ~Callback() { }
 
+		// Called when a live capture has had nothing to read for a while,
+		// pass on anything being held back
+		virtual void Flush() { }
+
+		// Called before the first packet, and again if it changes: the
+		// pcap_datalink() type (DLT_*) of the packets that follow
+		virtual void SetLinkType(int linkType) { }
+
 		typedef std::unique_ptr<Callback> Ptr;
 		typedef Ptr (*Factory)();
 	};
 
-	static void Start(const std::string &filter,                           Callback::Factory callbackFactory);
-	static void Start(const std::string &filter, pcap_if_t *device,        Callback::Factory callbackFactory);
+	// Read a capture on a background thread (live devices are run by a CaptureSupervisor)
 	static void Start(const std::string &filter, const std::string &file,  Callback::Factory callbackFactory);
-	static void Start(const std::string &filter, pcap_t *pcap,             Callback::Factory callbackFactory, std::string deviceName = "");
+	static void Start(const std::string &filter, pcap_t *pcap,             Callback::Factory callbackFactory);
+
+	// Read a whole capture file on the calling thread (for headless/batch use).
+	// Returns false if the file couldn't be opened, filtered or read.
+	static bool Run(const std::string &filter, const std::string &file,   Callback::Factory callbackFactory);
+
+	// Building blocks for running a live device, errors are logged.
+	static pcap_t *OpenLive(const std::string &device);
+	static bool SetFilter(pcap_t *pcap, const std::string &filter);
+
+	// Pass packets to <callback> until pcap_breakloop() (true) or an error (false).
+	// Given the <filter> the handle was opened with, the handle's filter is
+	// narrowed to drop connections as CaptureFilter rejects them.
+	static bool Dispatch(pcap_t *pcap, Callback &callback, const std::string &filter = std::string());
+
+	// Last thing on a thread that ran <callback>: destroys it, then gives up
+	// the thread's log buffer and metrics shard
+	static void EndThread(Callback::Ptr &callback);
 };
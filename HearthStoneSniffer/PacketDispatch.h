@@ -0,0 +1,102 @@
+#pragma once
+
+#include "Clock.h"
+#include "Histogram.h"
+#include "PacketType.h"
+
+#include <atomic>
+#include <cstdint>
+
+// Statistics kept for each packet type
+struct PacketStats
+{
+	std::atomic<uint64_t> messages;
+	std::atomic<uint64_t> bytes;
+	Histogram decodeTime; // nanoseconds spent in the handler
+
+	PacketStats() { messages = 0; bytes = 0; }
+
+	void Record(int size, int64_t nanos)
+	{
+		messages.fetch_add(1, std::memory_order_relaxed);
+		bytes.fetch_add(size > 0 ? size : 0, std::memory_order_relaxed);
+		decodeTime.RecordSigned(nanos);
+	}
+};
+
+// Dense dispatch table from a wire packet type to Handler::Handle<Type>() and
+// the statistics slot for that type.
+//
+// The handler for every known type is bound when the table is instantiated
+// (unknown types all share Handle<0>), so dispatching is one bounds check and
+// one indexed call instead of a switch over the sparse HSPacketType values.
+// The table is filled once at startup; VS2013 can't build it as a constexpr.
+template <typename Handler>
+class PacketDispatch
+{
+public:
+	typedef void (Handler::*Function)(uint32_t type, const uint8_t *data, int len);
+
+	struct Entry
+	{
+		Function function;
+		int slot;
+	};
+
+	static const Entry &Lookup(uint32_t type)
+	{
+		return _table.entries[type < PACKET_TYPE_LIMIT ? type : 0];
+	}
+
+	static void Dispatch(Handler &handler, uint32_t type, const uint8_t *data, int len)
+	{
+		auto &entry = Lookup(type);
+
+		auto start = Clock::Now();
+		(handler.*entry.function)(type, data, len);
+		_stats[entry.slot].Record(len, Clock::Now() - start);
+	}
+
+	static const PacketStats &Stats(int slot)
+	{
+		return _stats[(slot >= 0 && slot < PACKET_SLOT_COUNT) ? slot : PACKET_SLOT_UNKNOWN];
+	}
+
+private:
+	// Only instantiate Handle<Type> for known types
+	template <int Type, bool Known> struct Bind
+	{
+		static Function Get() { return &Handler::template Handle<Type>; }
+	};
+	template <int Type> struct Bind<Type, false>
+	{
+		static Function Get() { return &Handler::template Handle<0>; }
+	};
+
+	template <int Type, int Dummy = 0> struct Fill
+	{
+		static void Apply(Entry *entries)
+		{
+			entries[Type].function = Bind<Type, int(PacketInfo<Type>::Slot) != int(PACKET_SLOT_UNKNOWN)>::Get();
+			entries[Type].slot = PacketInfo<Type>::Slot;
+			Fill<Type - 1>::Apply(entries);
+		}
+	};
+	template <int Dummy> struct Fill<-1, Dummy>
+	{
+		static void Apply(Entry *) {}
+	};
+
+	struct Table
+	{
+		Entry entries[PACKET_TYPE_LIMIT];
+
+		Table() { Fill<PACKET_TYPE_LIMIT - 1>::Apply(entries); }
+	};
+
+	static const Table _table;
+	static PacketStats _stats[PACKET_SLOT_COUNT];
+};
+
+template <typename Handler> const typename PacketDispatch<Handler>::Table PacketDispatch<Handler>::_table;
+template <typename Handler> PacketStats PacketDispatch<Handler>::_stats[PACKET_SLOT_COUNT];
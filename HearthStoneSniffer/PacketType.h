@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Every known message type as (name, wire value). The values are sparse, so
+// everything that needs a dense index (dispatch tables, per-type statistics)
+// is generated from this list instead of being written out by hand.
+#define HS_PACKET_TYPES(X) \
+	X(GET_GAME_STATE,          1) \
+	X(CHOOSE_OPTION,           2) \
+	X(CHOOSE_ENTITIES,         3) \
+	X(PRE_CAST,                4) \
+	X(DEBUG_MESSAGE,           5) \
+	X(CLIENT_PACKET,           6) \
+	X(START_GAME_STATE,        7) \
+	X(FINISH_GAME_STATE,       8) \
+	X(TURN_TIMER,              9) \
+	X(NACK_OPTION,            10) \
+	X(GIVE_UP,                11) \
+	X(GAME_CANCELLED,         12) \
+	X(ALL_OPTIONS,            14) \
+	X(USER_UI,                15) \
+	X(GAME_SETUP,             16) \
+	X(ENTITY_CHOICE,          17) \
+	X(PRE_LOAD,               18) \
+	X(POWER_HISTORY,          19) \
+	X(NOTIFICATION,           21) \
+	X(AUTO_LOGIN,            103) \
+	X(BEGIN_PLAYING,         113) \
+	X(GAME_STARTING,         114) \
+	X(DEBUG_CONSOLE_COMMAND, 123) \
+	X(DEBUG_CONSOLE_RESPONSE,124) \
+	X(AURORA_HANDSHAKE,      168)
+
+typedef enum {
+#define HS_PACKET_ENUM(name, value) name = value,
+	HS_PACKET_TYPES(HS_PACKET_ENUM)
+#undef HS_PACKET_ENUM
+} HSPacketType;
+
+// Dense index of each packet type, 0 is reserved for unknown types
+enum PacketSlot {
+	PACKET_SLOT_UNKNOWN,
+#define HS_PACKET_SLOT(name, value) PACKET_SLOT_##name,
+	HS_PACKET_TYPES(HS_PACKET_SLOT)
+#undef HS_PACKET_SLOT
+	PACKET_SLOT_COUNT
+};
+
+// Wire values at or above this are never dispatched by value (all map to unknown)
+const uint32_t PACKET_TYPE_LIMIT = 256;
+
+// The size of the header in front of every message (type and payload size, little endian)
+const size_t PACKET_HEADER_SIZE = 8;
+
+// Compile time information about a packet type
+template <int Type> struct PacketInfo
+{
+	enum { Slot = PACKET_SLOT_UNKNOWN };
+	static const char *Name() { return "UNKNOWN"; }
+};
+
+#define HS_PACKET_INFO(name, value) \
+	template <> struct PacketInfo<name> \
+	{ \
+		enum { Slot = PACKET_SLOT_##name }; \
+		static const char *Name() { return #name; } \
+	};
+HS_PACKET_TYPES(HS_PACKET_INFO)
+#undef HS_PACKET_INFO
+
+// Runtime versions of the above
+inline const char *PacketSlotName(int slot)
+{
+	static const char *const names[PACKET_SLOT_COUNT] = {
+		"UNKNOWN",
+#define HS_PACKET_NAME(name, value) #name,
+		HS_PACKET_TYPES(HS_PACKET_NAME)
+#undef HS_PACKET_NAME
+	};
+	return (slot >= 0 && slot < PACKET_SLOT_COUNT) ? names[slot] : names[PACKET_SLOT_UNKNOWN];
+}
+
+inline bool IsKnownPacketType(uint32_t type)
+{
+	switch (type) {
+#define HS_PACKET_CASE(name, value) case name:
+	HS_PACKET_TYPES(HS_PACKET_CASE)
+#undef HS_PACKET_CASE
+		return true;
+	default:
+		return false;
+	}
+}
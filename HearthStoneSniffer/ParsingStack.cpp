@@ -0,0 +1,23 @@
+#include "ParsingStack.h"
+#include "GameDecoder.h"
+#include "tcp/Parser.h"
+
+const char *const ParsingStack::FILTER = "tcp port 3724 or tcp port 1119";
+
+ParsingStack::Options ParsingStack::_options;
+
+PacketCapture::Callback::Ptr ParsingStack::New()
+{
+	if (_options.shards == 0) {
+		return NewParser();
+	}
+	return std::make_unique<FlowSharder>(_options.shards, &NewParser, _options.sharder);
+}
+
+PacketCapture::Callback::Ptr ParsingStack::NewParser()
+{
+	return std::make_unique<tcp::Parser>(
+		[](int64_t nanotime, tcp::Stream *stream) -> tcp::Parser::Callback::Ptr {
+		return std::make_unique<GameDecoder>(nanotime, stream);
+	}, &GameDecoder::Classify, _options.attach);
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "FlowSharder.h"
+#include "PacketCapture.h"
+
+// The packet parsing stack (tcp::Parser -> GameDecoder for every game
+// connection), built the same way for the app, hssniff and the benchmarks.
+// With shards, a FlowSharder spreads the connections over that many copies
+// of it, each on its own thread.
+class ParsingStack
+{
+public:
+	// Capture filter for the game servers' ports
+	static const char *const FILTER;
+
+	struct Options
+	{
+		// Pick up games already in progress when the capture started
+		bool attach;
+
+		// Split the connections over this many parsing threads (0 parses on the capture thread)
+		unsigned shards;
+		FlowSharder::Options sharder;
+
+		Options() : attach(false), shards(0) { }
+	};
+
+	// Used by every stack created afterwards, so set them before capture starts
+	static void SetOptions(const Options &options) { _options = options; }
+	static const Options &GetOptions() { return _options; }
+
+	// A whole stack as the options ask for (a PacketCapture::Callback::Factory)
+	static PacketCapture::Callback::Ptr New();
+
+	// A stack without the FlowSharder (what each shard runs)
+	static PacketCapture::Callback::Ptr NewParser();
+
+private:
+	ParsingStack() {}
+
+	static Options _options;
+};
@@ -0,0 +1,314 @@
+// wx #includes must come first to prevent secure function warning from wxcrt.h
+#include <wx/log.h>
+
+#include "Replay.h"
+#include "AsyncLog.h"
+#include "CaptureFile.h"
+#include "Clock.h"
+#include "Metrics.h"
+#include "tcp/LinkLayer.h"
+#include "tcp/Segment.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+	// A quiet live capture is flushed when a read times out (PacketCapture::OpenLive's timeout)
+	const int64_t FLUSH_NANOS = 1000000000;
+
+	// How long the capture thread sleeps when the buffer is empty
+	const int IDLE_MICROSECONDS = 50;
+
+	// The sender sleeps until this close to a packet being due and spins the
+	// rest of the way. Sleeps are rounded up to the timer resolution, which
+	// on Windows is 15.6 ms unless something has asked for better.
+#ifdef _WIN32
+	const int64_t SPIN_NANOS = 16000000;
+#else
+	const int64_t SPIN_NANOS = 1000000;
+#endif
+}
+
+// The capture buffer: one thread puts packets in, one takes them out, and
+// the packets are copied in back to back like they are in the kernel's.
+// Positions are byte counts since the start, the offset is modulo the size.
+class Replay::Buffer
+{
+public:
+	struct Header
+	{
+		int64_t nanotime;
+		uint32_t size; // WRAP: the rest of the buffer is unused, continue at the start
+		int32_t linkType;
+	};
+
+	enum { ALIGN = 8, WRAP = 0xffffffff };
+
+	explicit Buffer(size_t bytes)
+		: _data((std::max<size_t>(bytes, sizeof(Header)) + ALIGN - 1) / ALIGN),
+		  _size(_data.size() * ALIGN),
+		  _write(0)
+	{
+		_read = 0;
+		_written = 0;
+		_done = false;
+	}
+
+	// Whether a packet of <size> bytes could ever fit
+	bool Fits(size_t size) const { return size < WRAP && Bytes(uint32_t(size)) <= _size; }
+
+	// Sender: false if there's no room for the packet
+	bool Push(int64_t nanotime, int linkType, std::range<const uint8_t *> data)
+	{
+		auto bytes = Bytes(uint32_t(data.size()));
+		auto offset = _write % _size;
+		auto skip = offset + bytes > _size ? _size - offset : 0;
+		if (_write + skip + bytes - _read.load(std::memory_order_acquire) > _size) {
+			return false;
+		}
+
+		if (skip) {
+			if (skip >= sizeof(Header)) {
+				At(offset)->size = WRAP;
+			}
+			_write += skip;
+			offset = 0;
+		}
+
+		auto header = At(offset);
+		header->nanotime = nanotime;
+		header->size = uint32_t(data.size());
+		header->linkType = linkType;
+		if (!data.empty()) {
+			memcpy(header + 1, &data[0], data.size());
+		}
+
+		_write += bytes;
+		_written.store(_write, std::memory_order_release);
+		return true;
+	}
+
+	// Sender: no more packets
+	void Finish() { _done.store(true, std::memory_order_release); }
+
+	// Capture thread: the oldest packet, nullptr if there's none (yet)
+	const Header *Peek()
+	{
+		auto read = _read.load(std::memory_order_relaxed);
+		if (read == _written.load(std::memory_order_acquire)) {
+			return nullptr;
+		}
+
+		auto offset = read % _size;
+		if (_size - offset < sizeof(Header) || At(offset)->size == WRAP) {
+			// The sender only skips to the start to write a packet there
+			_read.store(read + _size - offset, std::memory_order_release);
+			offset = 0;
+		}
+		return At(offset);
+	}
+
+	// Capture thread: done with the packet Peek() returned
+	void Pop(const Header *header)
+	{
+		_read.store(_read.load(std::memory_order_relaxed) + Bytes(header->size), std::memory_order_release);
+	}
+
+	// Capture thread: everything's been taken and no more is coming
+	bool IsFinished()
+	{
+		return _done.load(std::memory_order_acquire) && !Peek();
+	}
+
+	// Bytes waiting (only exact on the sender's thread, between pushes)
+	size_t Used() const { return size_t(_write - _read.load(std::memory_order_acquire)); }
+
+private:
+	static uint64_t Bytes(uint32_t size) { return sizeof(Header) + (uint64_t(size) + ALIGN - 1) / ALIGN * ALIGN; }
+
+	Header *At(uint64_t offset) { return reinterpret_cast<Header *>(reinterpret_cast<uint8_t *>(&_data[0]) + offset); }
+
+	std::vector<uint64_t> _data; // aligned for the headers
+	const uint64_t _size;
+	uint64_t _write;                // sender only
+	std::atomic<uint64_t> _written; // published by the sender
+	std::atomic<uint64_t> _read;    // published by the capture thread
+	std::atomic<bool> _done;
+
+	Buffer(const Buffer &);
+	Buffer &operator=(const Buffer &);
+};
+
+// Copies every packet of a file, and finds how long each connection was open
+class Replay::Loader : public PacketCapture::Callback
+{
+public:
+	explicit Loader(Replay &replay)
+		: _replay(replay),
+		  _linkType(tcp::LinkLayer::ETHERNET),
+		  _link(&tcp::LinkLayer::Ethernet)
+	{
+	}
+
+	virtual void operator()(int64_t nanotime, std::range<const uint8_t*> data)
+	{
+		Packet packet = { nanotime, _replay._data.size(), uint32_t(data.size()), _linkType };
+		_replay._packets.push_back(packet);
+		_replay._data.insert(_replay._data.end(), data.begin(), data.end());
+
+		uint32_t hash;
+		if (_link && tcp::Segment::FlowHash(data, hash, _link)) {
+			auto &span = _flows.insert(std::make_pair(hash, std::make_pair(nanotime, nanotime))).first->second;
+			span.first = std::min(span.first, nanotime);
+			span.second = std::max(span.second, nanotime);
+		}
+	}
+
+	virtual void SetLinkType(int linkType)
+	{
+		_linkType = linkType;
+		_link = tcp::LinkLayer::ForLinkType(linkType);
+	}
+
+	// Nanoseconds every connection was open, added up
+	int64_t OpenNanos() const
+	{
+		int64_t total = 0;
+		for (auto &flow : _flows) {
+			total += flow.second.second - flow.second.first;
+		}
+		return total;
+	}
+
+private:
+	Replay &_replay;
+	int _linkType;
+	tcp::LinkLayer::Strip _link; // for the flow hash
+	std::unordered_map<uint32_t, std::pair<int64_t, int64_t>> _flows; // first and last packet of each connection
+};
+
+Replay::Replay()
+	: _concurrency(0)
+{
+}
+
+bool Replay::Load(const std::string &filter, const std::string &file)
+{
+	_data.clear();
+	_packets.clear();
+	_concurrency = 0;
+
+	// Only the formats CaptureFile maps (libpcap's other formats are rare enough not to bother)
+	Loader loader(*this);
+	auto status = CaptureFile::Read(filter, file, loader);
+	if (status == CaptureFile::UNSUPPORTED) {
+		wxLogError("%s: not a pcap or pcapng file", file);
+	}
+	if (status != CaptureFile::READ || _packets.empty()) {
+		return false;
+	}
+
+	auto duration = Duration();
+	_concurrency = duration > 0 ? double(loader.OpenNanos()) / double(duration) : 0;
+	return true;
+}
+
+int64_t Replay::Duration() const
+{
+	return _packets.empty() ? 0 : _packets.back().nanotime - _packets.front().nanotime;
+}
+
+Replay::Result Replay::Run(PacketCapture::Callback::Factory callbackFactory, const Options &options) const
+{
+	Result result = {};
+	wxCHECK(callbackFactory && !_packets.empty() && options.speed >= 0, result);
+
+	Buffer buffer(options.bufferBytes);
+	auto start = Clock::Now();
+
+	// The capture thread, as PacketCapture::Start() runs it
+	int64_t end = start;
+	std::thread capture([&buffer, &result, &end, callbackFactory]() {
+		PacketCapture::Callback::Ptr callback = callbackFactory();
+		int linkType = -1;
+		int64_t idle = 0; // since when the buffer has been empty (0 while it isn't)
+		bool flushed = false;
+
+		while (true) {
+			auto header = buffer.Peek();
+			if (header) {
+				if (header->linkType != linkType) {
+					linkType = header->linkType;
+					callback->SetLinkType(linkType);
+				}
+
+				auto data = reinterpret_cast<const uint8_t *>(header + 1);
+				(*callback)(header->nanotime, std::make_range(data, data + header->size));
+				result.packets++;
+				result.bytes += header->size;
+				buffer.Pop(header);
+
+				idle = 0;
+				flushed = false;
+				continue;
+			}
+
+			if (buffer.IsFinished()) {
+				break;
+			}
+
+			auto now = Clock::Now();
+			if (!idle) {
+				idle = now;
+			} else if (!flushed && now - idle >= FLUSH_NANOS) {
+				callback->Flush();
+				flushed = true;
+			}
+			std::this_thread::sleep_for(std::chrono::microseconds(IDLE_MICROSECONDS));
+		}
+
+		callback.reset();
+		end = Clock::Now();
+		AsyncLog::ReleaseThread();
+		Metrics::ReleaseThread();
+	});
+
+	// Packets get the wall clock time they're sent at, like a live capture's
+	const auto wall = Clock::Wall() - start;
+	const auto first = _packets.front().nanotime;
+
+	for (auto &packet : _packets) {
+		auto now = Clock::Now();
+		if (options.speed > 0) {
+			auto due = start + int64_t(double(packet.nanotime - first) / options.speed);
+			while (now < due) {
+				if (due - now > SPIN_NANOS) {
+					std::this_thread::sleep_for(std::chrono::nanoseconds(due - now - SPIN_NANOS));
+				}
+				now = Clock::Now();
+			}
+			result.maxLag = std::max(result.maxLag, now - due);
+		}
+
+		auto data = std::make_range(&_data[0] + packet.offset, &_data[0] + packet.offset + packet.size);
+		while (!buffer.Push(wall + now, packet.linkType, data)) {
+			if (options.speed > 0 || !buffer.Fits(packet.size)) {
+				result.dropped++;
+				break;
+			}
+			std::this_thread::yield();
+		}
+		result.peakBuffered = std::max(result.peakBuffered, buffer.Used());
+	}
+	result.sendNanos = Clock::Now() - start;
+
+	buffer.Finish();
+	capture.join();
+	result.nanos = end - start;
+	return result;
+}
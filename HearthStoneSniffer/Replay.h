@@ -0,0 +1,85 @@
+#pragma once
+
+#include "PacketCapture.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Plays a capture file into a parsing stack at a chosen rate, the way a live
+// capture would deliver it, to find out how much traffic it keeps up with.
+//
+// The file is loaded into memory first. A sender (the calling thread) copies
+// each packet into a bounded buffer when it's due, and a capture thread takes
+// them out and passes them to the callback, just as pcap_dispatch() does with
+// the kernel's capture buffer. Packets that don't fit in the buffer are
+// dropped, like the kernel's ps_drop. The callback sees the time each packet
+// was sent as its capture timestamp, so a LatencyTrace enabled for a live
+// capture measures the queueing too.
+class Replay
+{
+public:
+	struct Options
+	{
+		// Times the rate the packets were captured at, 0 for as fast as the
+		// callback takes them (then the sender waits for room instead of dropping)
+		double speed;
+
+		// Room for this much (packet data plus a small header each) before
+		// packets are dropped. Libpcap asks Linux for 2 MB by default.
+		size_t bufferBytes;
+
+		Options() : speed(1), bufferBytes(2 * 1024 * 1024) { }
+	};
+
+	struct Result
+	{
+		uint64_t packets;    // passed to the callback
+		uint64_t bytes;
+		uint64_t dropped;    // no room in the buffer
+		size_t peakBuffered; // most bytes waiting in the buffer at once
+		int64_t sendNanos;   // from the first packet being sent to the last
+		int64_t nanos;       // from the first packet being sent to the callback being destroyed
+		int64_t maxLag;      // furthest the sender fell behind the schedule (nanoseconds)
+	};
+
+	Replay();
+
+	// Read every packet in <file> matching <filter>. False if the file
+	// couldn't be read (logged) or had no packets.
+	bool Load(const std::string &filter, const std::string &file);
+
+	uint64_t Packets() const { return _packets.size(); }
+	uint64_t Bytes() const { return _data.size(); }
+
+	// Nanoseconds from the first packet to the last, as captured
+	int64_t Duration() const;
+
+	// Average number of connections open at once, as captured (a connection
+	// is open from its first packet to its last)
+	double Concurrency() const { return _concurrency; }
+
+	// Replay everything loaded into a new callback from <callbackFactory>,
+	// which is created, run and destroyed on the capture thread. Returns once
+	// the callback is destroyed.
+	Result Run(PacketCapture::Callback::Factory callbackFactory, const Options &options) const;
+
+private:
+	struct Packet
+	{
+		int64_t nanotime;
+		uint64_t offset; // into _data
+		uint32_t size;
+		int linkType;
+	};
+
+	class Buffer;
+	class Loader;
+
+	std::vector<uint8_t> _data;
+	std::vector<Packet> _packets;
+	double _concurrency;
+
+	Replay(const Replay &);
+	Replay &operator=(const Replay &);
+};
@@ -0,0 +1,84 @@
+// wx #includes must come first to prevent secure function warning from wxcrt.h
+#include <wx/log.h>
+
+#include "Threads.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+unsigned Threads::Cpus()
+{
+	return std::max(1u, std::thread::hardware_concurrency());
+}
+
+#ifdef _WIN32
+bool Threads::PinCurrent(unsigned cpu)
+{
+	// Affinity masks only cover the first processor group
+	cpu %= std::min<unsigned>(Cpus(), sizeof(DWORD_PTR) * 8);
+	if (!SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << cpu)) {
+		wxLogWarning("SetThreadAffinityMask(%u): %d", cpu, GetLastError());
+		return false;
+	}
+	return true;
+}
+
+bool Threads::SetPriority(Priority priority)
+{
+	static const int PRIORITIES[] = { THREAD_PRIORITY_BELOW_NORMAL, THREAD_PRIORITY_NORMAL, THREAD_PRIORITY_HIGHEST };
+	if (!SetThreadPriority(GetCurrentThread(), PRIORITIES[priority])) {
+		wxLogWarning("SetThreadPriority(%d): %d", PRIORITIES[priority], GetLastError());
+		return false;
+	}
+	return true;
+}
+#elif defined(__linux__)
+bool Threads::PinCurrent(unsigned cpu)
+{
+	cpu %= Cpus();
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	auto rc = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (rc != 0) {
+		wxLogWarning("pthread_setaffinity_np(%u): %d", cpu, rc);
+		return false;
+	}
+	return true;
+}
+
+bool Threads::SetPriority(Priority priority)
+{
+	// Nice values are per thread on Linux (given the thread id, not the process id)
+	static const int NICE[] = { 10, 0, -10 };
+	auto tid = id_t(syscall(SYS_gettid));
+	if (setpriority(PRIO_PROCESS, tid, NICE[priority]) != 0) {
+		wxLogWarning("setpriority(%d): %d", NICE[priority], errno);
+		return false;
+	}
+	return true;
+}
+#else
+bool Threads::PinCurrent(unsigned)
+{
+	// OS X only has affinity hints between threads, not CPUs
+	return false;
+}
+
+bool Threads::SetPriority(Priority)
+{
+	return false;
+}
+#endif
@@ -0,0 +1,28 @@
+#pragma once
+
+// Thread placement helpers (std::thread has no portable way to do these)
+class Threads
+{
+public:
+	// Number of hardware threads (at least 1)
+	static unsigned Cpus();
+
+	// Only run the calling thread on <cpu> (modulo Cpus()).
+	// Returns false if it isn't supported on this platform or failed.
+	static bool PinCurrent(unsigned cpu);
+
+	enum Priority
+	{
+		PRIORITY_LOW,
+		PRIORITY_NORMAL,
+		PRIORITY_HIGH,
+	};
+
+	// Change the scheduling priority of the calling thread.
+	// Returns false if it isn't supported on this platform or failed
+	// (raising it usually needs extra privileges outside Windows).
+	static bool SetPriority(Priority priority);
+
+private:
+	Threads() {}
+};
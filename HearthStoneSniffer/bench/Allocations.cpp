@@ -0,0 +1,33 @@
+#include "Allocations.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace {
+	std::atomic<uint64_t> allocations(0);
+}
+
+uint64_t Allocations::Count()
+{
+	return allocations.load(std::memory_order_relaxed);
+}
+
+void *operator new(size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (auto p = std::malloc(size ? size : 1)) {
+		return p;
+	}
+	throw std::bad_alloc();
+}
+
+void operator delete(void *p) throw()
+{
+	std::free(p);
+}
+
+void operator delete(void *p, size_t) throw()
+{
+	std::free(p);
+}
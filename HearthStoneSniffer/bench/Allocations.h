@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+
+// Counts every heap allocation of the program it's linked into (it replaces
+// the global operator new), for the benchmarks' allocs/op figures.
+class Allocations
+{
+public:
+	// Allocations so far, on any thread
+	static uint64_t Count();
+
+private:
+	Allocations() {}
+};
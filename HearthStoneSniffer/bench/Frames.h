@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Synthetic Ethernet frames for the benchmarks and hsgen, built a field at
+// a time in network byte order.
+class Frames
+{
+public:
+	typedef std::vector<uint8_t> Bytes;
+
+	enum { FIN = 0x01, SYN = 0x02, PSH = 0x08, ACK = 0x10 };
+
+	struct Tcp
+	{
+		uint16_t srcPort;
+		uint16_t dstPort;
+		uint32_t seq;
+		uint32_t ack;
+		uint8_t flags;
+
+		// The timestamps option (RFC 7323), left out when false
+		bool timestamps;
+		uint32_t tsVal;
+		uint32_t tsEcr;
+	};
+
+	static void Put16(Bytes &b, uint16_t v) { b.push_back(uint8_t(v >> 8)); b.push_back(uint8_t(v)); }
+	static void Put32(Bytes &b, uint32_t v) { Put16(b, uint16_t(v >> 16)); Put16(b, uint16_t(v)); }
+
+	// The MAC addresses and <etherType>, for the network header to follow
+	static Bytes Ethernet(uint16_t etherType)
+	{
+		Bytes f(12, 0);
+		f[5] = 1;   // destination MAC
+		f[11] = 2;  // source MAC
+		Put16(f, etherType);
+		return f;
+	}
+
+	static size_t TcpHeaderSize(const Tcp &tcp) { return tcp.timestamps ? 32 : 20; }
+
+	// A TCP header and the payload, the checksum is left at 0
+	static void PutTcp(Bytes &f, const Tcp &tcp, const uint8_t *payload, size_t size)
+	{
+		Put16(f, tcp.srcPort);
+		Put16(f, tcp.dstPort);
+		Put32(f, tcp.seq);
+		Put32(f, tcp.ack);
+		f.push_back(uint8_t(TcpHeaderSize(tcp) / 4 << 4));
+		f.push_back(tcp.flags);
+		Put16(f, 65535);
+		Put32(f, 0);           // checksum, urgent
+		if (tcp.timestamps) {
+			Put32(f, 0x0101080a); // NOP, NOP, timestamps (10 bytes)
+			Put32(f, tcp.tsVal);
+			Put32(f, tcp.tsEcr);
+		}
+		f.insert(f.end(), payload, payload + size);
+	}
+
+	// An Ethernet/IPv4/TCP frame, with valid checksums
+	static Bytes Ipv4(uint32_t srcIp, uint32_t dstIp, const Tcp &tcp, const uint8_t *payload, size_t size)
+	{
+		auto f = Ethernet(0x0800);
+
+		auto ip = f.size();
+		f.push_back(0x45);
+		f.push_back(0);
+		auto tcpSize = TcpHeaderSize(tcp) + size;
+		Put16(f, uint16_t(20 + tcpSize));
+		Put32(f, 0x4000);   // id, don't fragment
+		f.push_back(64);
+		f.push_back(6);     // TCP
+		Put16(f, 0);
+		Put32(f, srcIp);
+		Put32(f, dstIp);
+		auto ipSum = Fold(Sum(&f[ip], 20));
+		f[ip + 10] = uint8_t(ipSum >> 8);
+		f[ip + 11] = uint8_t(ipSum);
+
+		auto start = f.size();
+		PutTcp(f, tcp, payload, size);
+
+		uint8_t pseudo[12];
+		for (int i = 0; i < 4; i++) {
+			pseudo[i] = uint8_t(srcIp >> (24 - 8 * i));
+			pseudo[4 + i] = uint8_t(dstIp >> (24 - 8 * i));
+		}
+		pseudo[8] = 0;
+		pseudo[9] = 6;
+		pseudo[10] = uint8_t(tcpSize >> 8);
+		pseudo[11] = uint8_t(tcpSize);
+		auto tcpSum = Fold(Sum(&f[start], f.size() - start, Sum(pseudo, sizeof(pseudo))));
+		f[start + 16] = uint8_t(tcpSum >> 8);
+		f[start + 17] = uint8_t(tcpSum);
+		return f;
+	}
+
+	// Ones' complement sum of 16 bit words, as in the IP and TCP headers
+	static uint32_t Sum(const uint8_t *data, size_t size, uint32_t sum = 0)
+	{
+		for (size_t i = 0; i + 1 < size; i += 2) {
+			sum += (uint32_t(data[i]) << 8) | data[i + 1];
+		}
+		if (size & 1) {
+			sum += uint32_t(data[size - 1]) << 8;
+		}
+		return sum;
+	}
+
+	static uint16_t Fold(uint32_t sum)
+	{
+		while (sum >> 16) {
+			sum = (sum & 0xffff) + (sum >> 16);
+		}
+		return uint16_t(~sum);
+	}
+
+private:
+	Frames() {}
+};
@@ -0,0 +1,469 @@
+// wx #includes must come first to prevent secure function warning from wxcrt.h
+#include <wx/cmdline.h>
+#include <wx/crt.h>
+#include <wx/init.h>
+#include <wx/log.h>
+
+#include "Allocations.h"
+#include "Batch.h"
+#include "GameDecoder.h"
+#include "LatencyTrace.h"
+#include "ParsingStack.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+// hsperf: the performance regression gate. Runs a fixed corpus of capture
+// files (see the perfgate target, they're made by hsgen) through the same
+// parsing stack as hssniff and compares the results with a baseline file:
+//
+//   file.<name>.mbps                 best throughput of the timed runs
+//   file.<name>.allocs_per_packet    heap allocations
+//   file.<name>.p99_us.<stage>       p99 of each LatencyTrace hop, and in total
+//   file.<name>.events               decoded messages: count and hash
+//   peak_rss_mb                      for the whole run
+//
+// Anything more than --tolerance percent worse than the baseline fails the
+// gate (--latency-tolerance for the p99s, and changes under a noise floor
+// never do), and so does any change in the decoded messages. --events writes
+// the messages themselves, and --compare-events shows which ones differ
+// from a file written earlier (e.g. before and after an optimization, or
+// with and without --shards).
+
+namespace {
+	typedef std::map<std::string, std::string> Values;          // metric -> value
+	typedef std::map<std::string, std::vector<std::string>> Events; // file -> sorted messages
+
+	uint64_t PeakRss()
+	{
+#ifdef _WIN32
+		PROCESS_MEMORY_COUNTERS counters;
+		return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? counters.PeakWorkingSetSize : 0;
+#else
+		rusage usage;
+		if (getrusage(RUSAGE_SELF, &usage) != 0) {
+			return 0;
+		}
+#ifdef __APPLE__
+		return uint64_t(usage.ru_maxrss); // bytes
+#else
+		return uint64_t(usage.ru_maxrss) * 1024; // kilobytes
+#endif
+#endif
+	}
+
+	// FNV-1a
+	uint64_t Hash(const void *data, size_t size, uint64_t hash = 14695981039346656037ULL)
+	{
+		auto bytes = static_cast<const uint8_t *>(data);
+		for (size_t i = 0; i < size; i++) {
+			hash = (hash ^ bytes[i]) * 1099511628211ULL;
+		}
+		return hash;
+	}
+
+	// One line per message: "<time> <game> <type> <size> <payload hash>". The
+	// time is when it was delivered and the game is named by its connection,
+	// so sorted lines come out the same however the files were parsed.
+	struct EventLog : GameDecoder::Observer
+	{
+		std::mutex mu;
+		std::vector<std::string> lines;
+
+		virtual void operator()(const std::string &game, int64_t nanotime, uint32_t type, std::range<const uint8_t *> payload)
+		{
+			auto line = wxString::Format("%lld %s %u %u %016llx", (long long)nanotime, game.c_str(), type, unsigned(payload.size()),
+				(unsigned long long)Hash(payload.begin(), payload.size())).ToStdString();
+
+			std::lock_guard<std::mutex> lock(mu);
+			lines.push_back(std::move(line));
+		}
+	} eventLog;
+
+	bool RunFile(const std::string &filter, const std::string &file, Batch::Result &result)
+	{
+		auto results = Batch::Run(filter, std::vector<std::string>(1, file), &ParsingStack::New, 1);
+		result = results[0];
+		if (!result.ok) {
+			wxLogError("can't process %s", file);
+		}
+		return result.ok;
+	}
+
+	// Baselines name files without their directory, so the corpus can be anywhere
+	std::string BaseName(const std::string &path)
+	{
+		auto slash = path.find_last_of("/\\");
+		return slash == std::string::npos ? path : path.substr(slash + 1);
+	}
+
+	std::string Format(const char *format, double value)
+	{
+		return wxString::Format(format, value).ToStdString();
+	}
+
+	bool Measure(const std::string &filter, const std::vector<std::string> &files, int repeat, Values &values, Events &events)
+	{
+		// Timed runs first, before tracing is turned on (it can't be turned off)
+		for (auto &file : files) {
+			auto name = "file." + BaseName(file);
+
+			double best = 0;
+			for (int i = 0; i < repeat; i++) {
+				Batch::Result result;
+				if (!RunFile(filter, file, result)) {
+					return false;
+				}
+				auto seconds = double(result.nanos) / 1e9;
+				best = std::max(best, seconds > 0 ? double(result.bytes) / (1024 * 1024) / seconds : 0.0);
+			}
+			values[name + ".mbps"] = Format("%.1f", best);
+		}
+
+		// Then one traced run of each file for the latencies, allocations and messages
+		LatencyTrace::Enable(false);
+		GameDecoder::SetObserver(&eventLog);
+		for (auto &file : files) {
+			auto fileName = BaseName(file);
+			auto name = "file." + fileName;
+
+			LatencyTrace::Reset();
+			eventLog.lines.clear();
+			auto allocated = Allocations::Count();
+
+			Batch::Result result;
+			if (!RunFile(filter, file, result)) {
+				return false;
+			}
+
+			allocated = Allocations::Count() - allocated;
+			values[name + ".allocs_per_packet"] = Format("%.2f", result.packets ? double(allocated) / result.packets : 0.0);
+
+			for (int stage = LatencyTrace::DELIVERED; stage < LatencyTrace::STAGE_COUNT; stage++) {
+				auto &hop = LatencyTrace::Hop(LatencyTrace::Stage(stage));
+				if (hop.Count()) {
+					values[name + ".p99_us." + LatencyTrace::Name(LatencyTrace::Stage(stage))] = Format("%.1f", hop.Percentile(0.99) / 1e3);
+				}
+			}
+			values[name + ".p99_us.total"] = Format("%.1f", LatencyTrace::Total().Percentile(0.99) / 1e3);
+
+			auto &lines = events[fileName];
+			lines.swap(eventLog.lines);
+			std::sort(lines.begin(), lines.end());
+			auto hash = Hash(nullptr, 0);
+			for (auto &line : lines) {
+				hash = Hash(line.data(), line.size() + 1, hash); // with the terminator, so lines can't run together
+			}
+			values[name + ".events"] = wxString::Format("%u %016llx", unsigned(lines.size()), (unsigned long long)hash).ToStdString();
+		}
+		GameDecoder::SetObserver(nullptr);
+
+		values["peak_rss_mb"] = Format("%.1f", double(PeakRss()) / (1024 * 1024));
+		return true;
+	}
+
+	// "<metric> <value>" lines, # comments
+	bool ReadValues(const std::string &path, Values &values)
+	{
+		std::ifstream in(path);
+		if (!in) {
+			wxLogError("can't read %s", path);
+			return false;
+		}
+
+		std::string line;
+		while (std::getline(in, line)) {
+			if (!line.empty() && line.back() == '\r') {
+				line.pop_back();
+			}
+			if (line.empty() || line[0] == '#') {
+				continue;
+			}
+			auto space = line.find(' ');
+			if (space == std::string::npos) {
+				wxLogError("%s: bad line: %s", path, line);
+				return false;
+			}
+			values[line.substr(0, space)] = line.substr(space + 1);
+		}
+		return true;
+	}
+
+	bool WriteValues(const std::string &path, const Values &values)
+	{
+		std::ofstream out(path);
+		out << "# hsperf baseline, regenerate with hsperf -w on the machine that runs the gate\n";
+		out << "# (throughput, latency and memory depend on it; the event hashes don't)\n";
+		for (auto &value : values) {
+			out << value.first << ' ' << value.second << '\n';
+		}
+		out.close();
+		if (!out) {
+			wxLogError("error writing %s", path);
+			return false;
+		}
+		return true;
+	}
+
+	bool EndsWith(const std::string &s, const std::string &suffix)
+	{
+		return s.size() > suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+	}
+
+	bool IsLatency(const std::string &metric)
+	{
+		return metric.find(".p99_us.") != std::string::npos;
+	}
+
+	// Changes smaller than this are noise, whatever the percentage (a
+	// sub-microsecond hop's p99 moves by a whole histogram bucket)
+	double NoiseFloor(const std::string &metric)
+	{
+		if (IsLatency(metric)) {
+			return 2.0; // us
+		}
+		if (metric == "peak_rss_mb") {
+			return 4.0;
+		}
+		return 0;
+	}
+
+	struct Tolerance
+	{
+		double percent;
+		double latencyPercent; // p99s are noisier than throughput
+	};
+
+	// Prints every metric against the baseline, returns the number of regressions
+	int Compare(const Values &baseline, const Values &current, const Tolerance &tolerance)
+	{
+		int regressions = 0;
+		wxPrintf("%-48s %14s %14s %9s\n", "metric", "baseline", "current", "change");
+
+		for (auto &base : baseline) {
+			auto it = current.find(base.first);
+			if (it == current.end()) {
+				wxPrintf("%-48s %14s %14s %9s  MISSING\n", base.first.c_str(), base.second.c_str(), "-", "");
+				regressions++;
+				continue;
+			}
+
+			if (EndsWith(base.first, ".events")) {
+				auto same = it->second == base.second;
+				wxPrintf("%-48s %s\n", base.first.c_str(), same ? "same" : ("CHANGED (was " + base.second + ", now " + it->second + ")").c_str());
+				regressions += same ? 0 : 1;
+				continue;
+			}
+
+			auto was = std::atof(base.second.c_str());
+			auto now = std::atof(it->second.c_str());
+			auto worse = EndsWith(base.first, ".mbps") ? was - now : now - was;
+			auto allowed = IsLatency(base.first) ? tolerance.latencyPercent : tolerance.percent;
+			auto failed = worse > NoiseFloor(base.first);
+			// With nothing to take a percentage of, any worsening past the noise
+			// floor fails (e.g. allocations where there were none)
+			wxString change = "-";
+			if (was != 0) {
+				change = wxString::Format("%+8.1f%%", 100 * (now - was) / was);
+				failed = failed && 100 * worse / was > allowed;
+			}
+			wxPrintf("%-48s %14s %14s %9s%s\n", base.first.c_str(), base.second.c_str(), it->second.c_str(), change.c_str(), failed ? "  REGRESSED" : "");
+			regressions += failed ? 1 : 0;
+		}
+
+		for (auto &value : current) {
+			if (!baseline.count(value.first)) {
+				wxPrintf("%-48s %14s %14s %9s  (new)\n", value.first.c_str(), "-", value.second.c_str(), "");
+			}
+		}
+		return regressions;
+	}
+
+	// "# <file>" then its sorted messages
+	bool WriteEvents(const std::string &path, const Events &events)
+	{
+		std::ofstream out(path);
+		for (auto &file : events) {
+			out << "# " << file.first << '\n';
+			for (auto &line : file.second) {
+				out << line << '\n';
+			}
+		}
+		out.close();
+		if (!out) {
+			wxLogError("error writing %s", path);
+			return false;
+		}
+		return true;
+	}
+
+	bool ReadEvents(const std::string &path, Events &events)
+	{
+		std::ifstream in(path);
+		if (!in) {
+			wxLogError("can't read %s", path);
+			return false;
+		}
+
+		std::string line;
+		std::vector<std::string> *lines = nullptr;
+		while (std::getline(in, line)) {
+			if (line.compare(0, 2, "# ") == 0) {
+				lines = &events[line.substr(2)];
+			} else if (lines && !line.empty()) {
+				lines->push_back(line);
+			}
+		}
+		for (auto &file : events) {
+			std::sort(file.second.begin(), file.second.end());
+		}
+		return true;
+	}
+
+	// Shows the first few messages only in one or the other, returns the number of files that differ
+	int DiffEvents(const Events &reference, const Events &current)
+	{
+		const size_t SHOWN = 10;
+
+		int differ = 0;
+		for (auto &file : reference) {
+			auto it = current.find(file.first);
+			if (it == current.end()) {
+				continue; // not in this corpus
+			}
+
+			std::vector<std::string> missing;
+			std::vector<std::string> added;
+			std::set_difference(file.second.begin(), file.second.end(), it->second.begin(), it->second.end(), std::back_inserter(missing));
+			std::set_difference(it->second.begin(), it->second.end(), file.second.begin(), file.second.end(), std::back_inserter(added));
+			if (missing.empty() && added.empty()) {
+				wxPrintf("%s: %u messages, same\n", file.first.c_str(), unsigned(it->second.size()));
+				continue;
+			}
+
+			differ++;
+			wxPrintf("%s: %u messages missing, %u new\n", file.first.c_str(), unsigned(missing.size()), unsigned(added.size()));
+			for (size_t i = 0; i < missing.size() && i < SHOWN; i++) {
+				wxPrintf("  - %s\n", missing[i].c_str());
+			}
+			for (size_t i = 0; i < added.size() && i < SHOWN; i++) {
+				wxPrintf("  + %s\n", added[i].c_str());
+			}
+		}
+		return differ;
+	}
+
+	const wxCmdLineEntryDesc COMMAND_LINE[] = {
+		{ wxCMD_LINE_SWITCH, "h", "help", "show this help", wxCMD_LINE_VAL_NONE, wxCMD_LINE_OPTION_HELP },
+		{ wxCMD_LINE_OPTION, "b", "baseline", "compare with this baseline, fail on a regression" },
+		{ wxCMD_LINE_OPTION, "w", "write-baseline", "write the results as a new baseline" },
+		{ wxCMD_LINE_OPTION, NULL, "tolerance", "percent worse than the baseline that still passes (default: 10)", wxCMD_LINE_VAL_DOUBLE },
+		{ wxCMD_LINE_OPTION, NULL, "latency-tolerance", "the same for p99 latencies (default: 25)", wxCMD_LINE_VAL_DOUBLE },
+		{ wxCMD_LINE_OPTION, "r", "repeat", "timed runs of each file, the best counts (default: 5)", wxCMD_LINE_VAL_NUMBER },
+		{ wxCMD_LINE_OPTION, "s", "shards", "split each file's connections over this many threads", wxCMD_LINE_VAL_NUMBER },
+		{ wxCMD_LINE_OPTION, "f", "filter", "capture filter (default: the game ports)" },
+		{ wxCMD_LINE_OPTION, NULL, "events", "write the decoded messages to this file" },
+		{ wxCMD_LINE_OPTION, NULL, "compare-events", "fail if the decoded messages differ from this file (from --events)" },
+		{ wxCMD_LINE_PARAM, NULL, NULL, "capture file", wxCMD_LINE_VAL_STRING, wxCMD_LINE_PARAM_MULTIPLE },
+		{ wxCMD_LINE_NONE }
+	};
+}
+
+int main(int argc, char **argv)
+{
+	wxInitializer initializer(argc, argv);
+	if (!initializer.IsOk()) {
+		fprintf(stderr, "hsperf: failed to initialize wxWidgets\n");
+		return 2;
+	}
+
+	wxCmdLineParser commandLine(COMMAND_LINE, argc, argv);
+	switch (commandLine.Parse()) {
+	case -1:
+		return 0; // help
+	case 0:
+		break;
+	default:
+		return 2;
+	}
+
+	wxString filter = ParsingStack::FILTER;
+	commandLine.Found("f", &filter);
+
+	Tolerance tolerance = { 10, 25 };
+	commandLine.Found("tolerance", &tolerance.percent);
+	commandLine.Found("latency-tolerance", &tolerance.latencyPercent);
+
+	long repeat = 5;
+	commandLine.Found("r", &repeat);
+
+	// Parsing stacks as in hssniff
+	ParsingStack::Options stackOptions;
+	long shardCount = 0;
+	commandLine.Found("s", &shardCount);
+	stackOptions.shards = unsigned(std::max(shardCount, 0L));
+	ParsingStack::SetOptions(stackOptions);
+
+	std::vector<std::string> files;
+	for (size_t i = 0; i < commandLine.GetParamCount(); i++) {
+		files.push_back(commandLine.GetParam(i).ToStdString());
+	}
+
+	Values current;
+	Events events;
+	if (!Measure(filter.ToStdString(), files, int(std::max(repeat, 1L)), current, events)) {
+		return 2;
+	}
+
+	int failures = 0;
+
+	wxString baselineFile;
+	if (commandLine.Found("b", &baselineFile)) {
+		Values baseline;
+		if (!ReadValues(baselineFile.ToStdString(), baseline)) {
+			return 2;
+		}
+		failures += Compare(baseline, current, tolerance);
+	} else {
+		for (auto &value : current) {
+			wxPrintf("%-48s %s\n", value.first.c_str(), value.second.c_str());
+		}
+	}
+
+	wxString path;
+	if (commandLine.Found("w", &path) && !WriteValues(path.ToStdString(), current)) {
+		return 2;
+	}
+	if (commandLine.Found("events", &path) && !WriteEvents(path.ToStdString(), events)) {
+		return 2;
+	}
+	if (commandLine.Found("compare-events", &path)) {
+		Events reference;
+		if (!ReadEvents(path.ToStdString(), reference)) {
+			return 2;
+		}
+		failures += DiffEvents(reference, events);
+	}
+
+	if (failures) {
+		wxPrintf("FAILED: %d regressions\n", failures);
+		return 1;
+	}
+	return 0;
+}
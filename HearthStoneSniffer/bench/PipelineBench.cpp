@@ -0,0 +1,440 @@
+// wx #includes must come first to prevent secure function warning from wxcrt.h
+#include <wx/crt.h>
+#include <wx/init.h>
+#include <wx/log.h>
+
+#include "Allocations.h"
+#include "Clock.h"
+#include "Frames.h"
+#include "GameDecoder.h"
+#include "PacketCapture.h"
+#include "PacketType.h"
+#include "tcp/LinkLayer.h"
+#include "tcp/Parser.h"
+#include "tcp/Segment.h"
+#include "tcp/Stream.h"
+
+#include "PowerHistory.pb.h"
+#include "StartGameState.pb.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// pipebench: the cost of each stage from a captured frame to a decoded
+// message, on fixed synthetic inputs and (given a capture file) on recorded
+// ones:
+//
+//   segment   tcp::Segment parsing
+//   parser    tcp::Parser flow lookup (pure ACKs over many open flows)
+//   stream    tcp::Stream::Add in order, and out of order (reassembled)
+//   framing   GameDecoder splitting a stream into messages, by segment size
+//   decode    PowerHistory and StartGameState parsing
+//
+// Each line gives the time per operation, throughput, heap allocations per
+// operation and TSC cycles per byte (the timestamp counter, which ticks at
+// the nominal rate whatever the core's actual clock is).
+
+namespace {
+	// Every pass is repeated until this much time has gone by
+	const int64_t MIN_NANOS = 250 * 1000000;
+
+	uint64_t Cycles()
+	{
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+		return __rdtsc();
+#elif defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return 0; // not reported
+#endif
+	}
+
+	// What one pass did
+	struct Work
+	{
+		uint64_t ops;
+		uint64_t bytes;
+
+		Work(uint64_t ops, uint64_t bytes) : ops(ops), bytes(bytes) { }
+	};
+
+	void Run(const std::string &name, const std::function<Work()> &pass)
+	{
+		pass(); // warm up (caches, lazily allocated buffers)
+
+		uint64_t ops = 0;
+		uint64_t bytes = 0;
+		auto allocated = Allocations::Count();
+		auto cycles = Cycles();
+		auto start = Clock::Now();
+		int64_t elapsed;
+		do {
+			auto work = pass();
+			ops += work.ops;
+			bytes += work.bytes;
+			elapsed = Clock::Now() - start;
+		} while (elapsed < MIN_NANOS);
+		cycles = Cycles() - cycles;
+		allocated = Allocations::Count() - allocated;
+
+		if (!ops || !bytes) {
+			wxPrintf("%-28s no work done\n", name.c_str());
+			return;
+		}
+
+		wxPrintf("%-28s %9.1f ns/op %9.1f MB/s %7.2f allocs/op", name.c_str(),
+			double(elapsed) / ops, bytes / (1024.0 * 1024.0) / (elapsed / 1e9), double(allocated) / ops);
+		if (cycles) {
+			wxPrintf(" %7.2f cycles/byte", double(cycles) / bytes);
+		}
+		wxPrintf("\n");
+	}
+
+	typedef Frames::Bytes Bytes;
+
+	std::range<const uint8_t *> Range(const Bytes &bytes)
+	{
+		return std::make_range(bytes.data(), bytes.data() + bytes.size());
+	}
+
+	// A segment from client <client> to a game server
+	Bytes Frame(uint32_t client, uint32_t seq, uint8_t flags, size_t payload)
+	{
+		Frames::Tcp tcp = { uint16_t(30000 + client % 20000), 3724, seq, 1, flags };
+		Bytes data(payload, uint8_t(client));
+		// 10.x.x.x to 12.130.244.1
+		return Frames::Ipv4(0x0a000000u + client, 0x0c82f401u, tcp, data.data(), data.size());
+	}
+
+	// Synthetic messages
+
+	void PutMessage(Bytes &stream, uint32_t type, const std::string &payload)
+	{
+		uint32_t header[2] = { type, uint32_t(payload.size()) };
+		stream.insert(stream.end(), (const uint8_t *)header, (const uint8_t *)header + sizeof(header));
+		stream.insert(stream.end(), payload.begin(), payload.end());
+	}
+
+	void AddTags(google::protobuf::RepeatedPtrField<Tag> *tags, int count, int seed)
+	{
+		for (int i = 0; i < count; i++) {
+			auto tag = tags->Add();
+			tag->set_name(i * 7 + 1);
+			tag->set_value((seed + i) * 13 % 100);
+		}
+	}
+
+	// A turn's worth of history: mostly tag changes, some entities shown
+	std::string PowerHistoryMessage(int seed)
+	{
+		PowerHistory history;
+		for (int i = 0; i < 40; i++) {
+			auto data = history.add_list();
+			if (i % 8 == 0) {
+				auto entity = data->mutable_show_entity();
+				entity->set_entity(seed + i);
+				entity->set_name("EX1_066");
+				AddTags(entity->mutable_tags(), 12, i);
+			} else {
+				auto change = data->mutable_tag_change();
+				change->set_entity(seed + i % 5);
+				change->set_tag(i * 3 + 1);
+				change->set_value(i);
+			}
+		}
+		return history.SerializeAsString();
+	}
+
+	std::string StartGameStateMessage(int seed)
+	{
+		StartGameState state;
+		state.mutable_game_entity()->set_id(1);
+		AddTags(state.mutable_game_entity()->mutable_tags(), 20, seed);
+		for (int i = 0; i < 2; i++) {
+			auto player = state.add_players();
+			player->set_id(i + 1);
+			player->mutable_accountid()->set_hi(144115188075855872LL >> 32);
+			player->mutable_accountid()->set_lo(seed + i);
+			player->mutable_entity()->set_id(i + 2);
+			AddTags(player->mutable_entity()->mutable_tags(), 30, seed + i);
+		}
+		return state.SerializeAsString();
+	}
+
+	// Sinks and factories for the stages under test
+
+	struct Sink : tcp::Parser::Callback
+	{
+		virtual void operator()(int64_t, int64_t, std::range<const uint8_t *> data) { bytes += data.size(); }
+
+		static uint64_t bytes;
+	};
+	uint64_t Sink::bytes = 0;
+
+	tcp::Parser::Callback::Ptr NewSink(int64_t, tcp::Stream *)
+	{
+		return std::make_unique<Sink>();
+	}
+
+	tcp::Parser::Callback::Ptr NewDecoder(int64_t nanotime, tcp::Stream *stream)
+	{
+		return std::make_unique<GameDecoder>(nanotime, stream);
+	}
+
+	// Feeds <stream> through a fresh GameDecoder in <segment> sized pieces
+	// (the decoder keeps every message of a game, so it can't be reused)
+	Work Decode(tcp::Parser &host, const Bytes &stream, size_t segment)
+	{
+		tcp::Stream owner(&host, tcp::EndpointPair(), nullptr, 0, 0);
+		auto &decoder = *owner.Callback();
+
+		uint64_t ops = 0;
+		for (size_t offset = 0; offset < stream.size(); offset += segment, ops++) {
+			auto end = std::min(offset + segment, stream.size());
+			decoder(0, 0, std::make_range(stream.data() + offset, stream.data() + end));
+		}
+		return Work(ops, stream.size());
+	}
+
+	Work Parse(const std::vector<Bytes> &frames, tcp::LinkLayer::Strip link)
+	{
+		uint64_t bytes = 0;
+		uint64_t parsed = 0;
+		for (auto &frame : frames) {
+			tcp::Segment segment(Range(frame), link);
+			parsed += segment.WasParsed() ? 1 : 0;
+			bytes += frame.size();
+		}
+		return Work(parsed, bytes);
+	}
+
+	template <typename T> Work ParseMessages(const std::vector<std::string> &messages)
+	{
+		uint64_t bytes = 0;
+		for (auto &message : messages) {
+			T parsed;
+			parsed.ParseFromArray(message.data(), int(message.size()));
+			bytes += message.size();
+		}
+		return Work(messages.size(), bytes);
+	}
+
+	// Recorded inputs (from a capture file given on the command line)
+
+	struct Recording
+	{
+		int linkType;
+		std::vector<Bytes> frames;
+		std::deque<Bytes> streams; // the payload of each game connection, in order
+
+		Recording() : linkType(tcp::LinkLayer::ETHERNET) { }
+	} recording;
+
+	struct Recorder : PacketCapture::Callback
+	{
+		virtual void operator()(int64_t, std::range<const uint8_t *> data) { recording.frames.push_back(Bytes(data.begin(), data.end())); }
+		virtual void SetLinkType(int linkType) { recording.linkType = linkType; }
+	};
+
+	PacketCapture::Callback::Ptr NewRecorder()
+	{
+		return std::make_unique<Recorder>();
+	}
+
+	struct Reassembled : tcp::Parser::Callback
+	{
+		Bytes &stream;
+
+		Reassembled() : stream((recording.streams.push_back(Bytes()), recording.streams.back())) { }
+		virtual void operator()(int64_t, int64_t, std::range<const uint8_t *> data) { stream.insert(stream.end(), data.begin(), data.end()); }
+	};
+
+	tcp::Parser::Callback::Ptr NewReassembled(int64_t, tcp::Stream *)
+	{
+		return std::make_unique<Reassembled>();
+	}
+
+	// Splits the recorded streams into the payloads of <type> messages
+	std::vector<std::string> RecordedMessages(uint32_t type)
+	{
+		std::vector<std::string> messages;
+		for (auto &stream : recording.streams) {
+			size_t offset = 0;
+			while (offset + PACKET_HEADER_SIZE <= stream.size()) {
+				uint32_t header[2];
+				std::memcpy(header, &stream[offset], sizeof(header));
+				if (header[1] > GameDecoder::MAX_MESSAGE_SIZE || offset + PACKET_HEADER_SIZE + header[1] > stream.size()) {
+					break;
+				}
+				if (header[0] == type) {
+					messages.push_back(std::string((const char *)&stream[offset + PACKET_HEADER_SIZE], header[1]));
+				}
+				offset += PACKET_HEADER_SIZE + header[1];
+			}
+		}
+		return messages;
+	}
+
+	void Synthetic()
+	{
+		// segment
+		std::vector<Bytes> frames;
+		for (uint32_t i = 0; i < 4096; i++) {
+			frames.push_back(Frame(i, 1000 + i, Frames::PSH | Frames::ACK, 200));
+		}
+		Run("segment/synthetic", [&]() { return Parse(frames, &tcp::LinkLayer::Ethernet); });
+
+		// parser
+		const uint32_t FLOWS[] = { 16, 1024, 65536 };
+		for (auto flows : FLOWS) {
+			std::unique_ptr<tcp::Parser> parser(new tcp::Parser(&NewSink));
+			std::vector<Bytes> acks;
+			for (uint32_t i = 0; i < flows; i++) {
+				auto syn = Frame(i, 1000, Frames::SYN, 0);
+				(*parser)(0, Range(syn));
+				acks.push_back(Frame(i, 1001, Frames::ACK, 0));
+			}
+			Run("parser/flows=" + std::to_string(flows), [&]() {
+				uint64_t bytes = 0;
+				for (auto &ack : acks) {
+					(*parser)(0, Range(ack));
+					bytes += ack.size();
+				}
+				return Work(acks.size(), bytes);
+			});
+		}
+
+		// stream
+		const uint32_t SEGMENT = 1460;
+		const uint32_t SEGMENTS = 1024;
+		const uint32_t WINDOW = 8; // out of order: the first segment of every window arrives last
+		Bytes payload(SEGMENT, 0x5a);
+		tcp::Parser host(&NewSink);
+
+		tcp::Stream inOrder(&host, tcp::EndpointPair(), nullptr, 0, 0);
+		uint32_t seq = 1;
+		Run("stream/in-order", [&]() {
+			for (uint32_t i = 0; i < SEGMENTS; i++, seq += SEGMENT) {
+				inOrder.Add(0, seq, Range(payload));
+			}
+			return Work(SEGMENTS, uint64_t(SEGMENTS) * SEGMENT);
+		});
+
+		tcp::Stream outOfOrder(&host, tcp::EndpointPair(), nullptr, 0, 0);
+		seq = 1;
+		auto delivered = Sink::bytes;
+		Run("stream/out-of-order", [&]() {
+			for (uint32_t i = 0; i < SEGMENTS; i += WINDOW, seq += WINDOW * SEGMENT) {
+				for (uint32_t j = 1; j < WINDOW; j++) {
+					outOfOrder.Add(0, seq + j * SEGMENT, Range(payload));
+				}
+				outOfOrder.Add(0, seq, Range(payload));
+			}
+			return Work(SEGMENTS, uint64_t(SEGMENTS) * SEGMENT);
+		});
+		if (Sink::bytes == delivered) {
+			wxPrintf("stream/out-of-order: NOTHING DELIVERED\n");
+		}
+
+		// framing (messages the decoder doesn't parse, so this is the framing alone)
+		Bytes stream;
+		for (int i = 0; i < 512; i++) {
+			PutMessage(stream, USER_UI, std::string(20 + i * 37 % 400, char(i)));
+		}
+		tcp::Parser decoders(&NewDecoder);
+		const size_t SEGMENT_SIZES[] = { 64, 536, 1460, 8192 };
+		for (auto size : SEGMENT_SIZES) {
+			Run("framing/segment=" + std::to_string(size), [&]() { return Decode(decoders, stream, size); });
+		}
+
+		// decode
+		std::vector<std::string> histories;
+		std::vector<std::string> starts;
+		Bytes historyStream;
+		for (int i = 0; i < 64; i++) {
+			histories.push_back(PowerHistoryMessage(i));
+			starts.push_back(StartGameStateMessage(i));
+			PutMessage(historyStream, POWER_HISTORY, histories.back());
+		}
+		Run("decode/power_history", [&]() { return ParseMessages<PowerHistory>(histories); });
+		Run("decode/start_game_state", [&]() { return ParseMessages<StartGameState>(starts); });
+		Run("decoder/power_history", [&]() { return Decode(decoders, historyStream, SEGMENT); });
+	}
+
+	bool Recorded(const std::string &file)
+	{
+		recording = Recording();
+		if (!PacketCapture::Run("", file, &NewRecorder)) {
+			return false;
+		}
+		auto link = tcp::LinkLayer::ForLinkType(recording.linkType);
+		if (!link) {
+			return false;
+		}
+
+		{
+			tcp::Parser parser(&NewReassembled, &GameDecoder::Classify);
+			parser.SetLinkType(recording.linkType);
+			for (auto &frame : recording.frames) {
+				parser(0, Range(frame));
+			}
+		}
+
+		wxPrintf("%s: %u frames, %u connections\n", file.c_str(), unsigned(recording.frames.size()), unsigned(recording.streams.size()));
+
+		Run("segment/recorded", [&]() { return Parse(recording.frames, link); });
+
+		// The whole stack, a fresh one for every pass (it keeps every game)
+		Run("pipeline/recorded", [&]() {
+			tcp::Parser parser(&NewDecoder, &GameDecoder::Classify);
+			parser.SetLinkType(recording.linkType);
+			uint64_t bytes = 0;
+			for (auto &frame : recording.frames) {
+				parser(0, Range(frame));
+				bytes += frame.size();
+			}
+			return Work(recording.frames.size(), bytes);
+		});
+
+		auto histories = RecordedMessages(POWER_HISTORY);
+		auto starts = RecordedMessages(START_GAME_STATE);
+		Run("decode/power_history/rec", [&]() { return ParseMessages<PowerHistory>(histories); });
+		Run("decode/start_game_state/rec", [&]() { return ParseMessages<StartGameState>(starts); });
+		return true;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	wxInitializer initializer(argc, argv);
+	if (!initializer.IsOk()) {
+		fprintf(stderr, "pipebench: failed to initialize wxWidgets\n");
+		return 1;
+	}
+
+	// Whatever the inputs are, the benchmarks shouldn't be timing the log
+	wxLog::SetLogLevel(wxLOG_Error);
+
+	Synthetic();
+
+	for (int i = 1; i < argc; i++) {
+		if (!Recorded(argv[i])) {
+			fprintf(stderr, "pipebench: can't read %s\n", argv[i]);
+			return 1;
+		}
+	}
+	return 0;
+}
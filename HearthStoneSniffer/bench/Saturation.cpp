@@ -0,0 +1,225 @@
+// wx #includes must come first to prevent secure function warning from wxcrt.h
+#include <wx/cmdline.h>
+#include <wx/crt.h>
+#include <wx/init.h>
+#include <wx/log.h>
+
+#include "GameDecoder.h"
+#include "LatencyTrace.h"
+#include "ParsingStack.h"
+#include "Replay.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+// hsload: finds the highest packet rate the live capture path keeps up with.
+// A capture file is replayed (see Replay) into the same parsing stack as
+// hssniff, at faster and faster speeds until packets are dropped for lack
+// of room in the capture buffer, which is what pcap_stats() would report
+// live. The speed is then narrowed down between the last step without drops
+// and the first with. Each step replays the whole file once, so use a
+// capture (or an hsgen file) long enough that the fast steps still last a
+// second or more.
+//
+// The result is for this build on this machine: the packets/s, and the
+// number of connections like those in the file that could be open at once.
+
+namespace {
+	// The sender is too slow to tell if it falls this far short of the speed asked for
+	const double SENDER_SHORTFALL = 0.9;
+
+	struct Step
+	{
+		double speed;     // asked for (0 for unthrottled)
+		double achieved;  // the file's duration over the time it took to send
+		double packetsPerSecond;
+		double megabytesPerSecond;
+		double gamesPerSecond;
+		Replay::Result result;
+	};
+
+	Step Run(const Replay &replay, double speed, size_t bufferBytes)
+	{
+		Replay::Options options;
+		options.speed = speed;
+		options.bufferBytes = bufferBytes;
+
+		LatencyTrace::Reset();
+		auto games = GameDecoder::Stats(PACKET_SLOT_START_GAME_STATE).messages.load();
+
+		Step step;
+		step.speed = speed;
+		step.result = replay.Run(&ParsingStack::New, options);
+		games = GameDecoder::Stats(PACKET_SLOT_START_GAME_STATE).messages.load() - games;
+
+		// Offered rates: everything sent over the time it took (the buffer
+		// and the parsing stack may still be catching up after that)
+		auto &result = step.result;
+		auto seconds = double(std::max<int64_t>(result.sendNanos, 1)) / 1e9;
+		step.achieved = double(replay.Duration()) / 1e9 / seconds;
+		step.packetsPerSecond = double(replay.Packets()) / seconds;
+		step.megabytesPerSecond = double(replay.Bytes()) / (1024 * 1024) / seconds;
+		step.gamesPerSecond = double(games) / seconds;
+
+		wxPrintf("%9.2fx %9.2fx %12.0f %9.1f %9.2f %10llu %7.1f%% %9.3f",
+			speed, step.achieved, step.packetsPerSecond, step.megabytesPerSecond, step.gamesPerSecond,
+			(unsigned long long)result.dropped, 100.0 * double(result.peakBuffered) / double(bufferBytes),
+			double(result.maxLag) / 1e6);
+		if (LatencyTrace::IsEnabled()) {
+			wxPrintf(" %9.3f", LatencyTrace::Total().Percentile(0.99) / 1e6);
+		}
+		wxPrintf("\n");
+		return step;
+	}
+
+	bool IsSustained(const Step &step)
+	{
+		return step.result.dropped == 0;
+	}
+
+	// The sender couldn't keep to the schedule, so a faster step wouldn't be any faster
+	bool IsSenderBound(const Step &step)
+	{
+		return step.speed > 0 && step.achieved < step.speed * SENDER_SHORTFALL;
+	}
+
+	const wxCmdLineEntryDesc COMMAND_LINE[] = {
+		{ wxCMD_LINE_SWITCH, "h", "help", "show this help", wxCMD_LINE_VAL_NONE, wxCMD_LINE_OPTION_HELP },
+		{ wxCMD_LINE_OPTION, "f", "filter", "capture filter (default: the game ports)" },
+		{ wxCMD_LINE_OPTION, "x", "speed", "replay once at this many times the captured rate (0: as fast as it's taken) instead of ramping", wxCMD_LINE_VAL_DOUBLE },
+		{ wxCMD_LINE_OPTION, NULL, "from", "first speed of the ramp (default 1)", wxCMD_LINE_VAL_DOUBLE },
+		{ wxCMD_LINE_OPTION, NULL, "factor", "speed up by this much each step (default 2)", wxCMD_LINE_VAL_DOUBLE },
+		{ wxCMD_LINE_OPTION, NULL, "to", "highest speed to try (default 100000)", wxCMD_LINE_VAL_DOUBLE },
+		{ wxCMD_LINE_OPTION, NULL, "refine", "steps narrowing down the speed after the first drops (default 4)", wxCMD_LINE_VAL_NUMBER },
+		{ wxCMD_LINE_OPTION, "B", "buffer", "capture buffer size in KB (default 2048, libpcap's default on Linux)", wxCMD_LINE_VAL_NUMBER },
+		{ wxCMD_LINE_OPTION, "s", "shards", "split the connections over this many threads", wxCMD_LINE_VAL_NUMBER },
+		{ wxCMD_LINE_SWITCH, NULL, "pin", "pin each shard's thread to a CPU" },
+		{ wxCMD_LINE_SWITCH, "t", "trace", "report the p99 latency from capture to decoded message of each step" },
+		{ wxCMD_LINE_SWITCH, NULL, "attach", "pick up games already in progress when the capture started" },
+		{ wxCMD_LINE_PARAM, NULL, NULL, "capture file", wxCMD_LINE_VAL_STRING },
+		{ wxCMD_LINE_NONE }
+	};
+}
+
+int main(int argc, char **argv)
+{
+	wxInitializer initializer(argc, argv);
+	if (!initializer.IsOk()) {
+		fprintf(stderr, "hsload: failed to initialize wxWidgets\n");
+		return 2;
+	}
+
+	wxCmdLineParser commandLine(COMMAND_LINE, argc, argv);
+	switch (commandLine.Parse()) {
+	case -1:
+		return 0; // help
+	case 0:
+		break;
+	default:
+		return 2;
+	}
+
+	wxString filter = ParsingStack::FILTER;
+	commandLine.Found("f", &filter);
+
+	long bufferKilobytes = 2048;
+	commandLine.Found("B", &bufferKilobytes);
+	auto bufferBytes = size_t(std::max(bufferKilobytes, 64L)) * 1024;
+
+	// Parsing stacks as in hssniff
+	ParsingStack::Options stackOptions;
+	long shardCount = 0;
+	commandLine.Found("s", &shardCount);
+	stackOptions.shards = unsigned(std::max(shardCount, 0L));
+	stackOptions.sharder.firstCpu = commandLine.Found("pin") ? 0 : -1;
+
+	// Partial chunks are handed over as in a live capture
+	stackOptions.sharder.maxDelay = 10 * 1000000; // 10ms, as in the app
+
+	stackOptions.attach = commandLine.Found("attach");
+	ParsingStack::SetOptions(stackOptions);
+	if (commandLine.Found("t")) {
+		LatencyTrace::Enable(true);
+	}
+
+	Replay replay;
+	auto file = commandLine.GetParam(0).ToStdString();
+	if (!replay.Load(filter.ToStdString(), file)) {
+		wxLogError("can't replay %s", file);
+		return 2;
+	}
+
+	auto duration = double(replay.Duration()) / 1e9;
+	wxPrintf("%s: %llu packets, %.1f MB over %.3f s, %.1f connections open on average\n",
+		file.c_str(), (unsigned long long)replay.Packets(), double(replay.Bytes()) / (1024 * 1024), duration,
+		replay.Concurrency());
+	wxPrintf("%10s %10s %12s %9s %9s %10s %8s %9s%s\n", "speed", "achieved", "packets/s", "MB/s", "games/s",
+		"dropped", "buffer", "lag ms", LatencyTrace::IsEnabled() ? "   p99 ms" : "");
+
+	double speed;
+	if (commandLine.Found("x", &speed)) {
+		auto step = Run(replay, std::max(speed, 0.0), bufferBytes);
+		return IsSustained(step) ? 0 : 1;
+	}
+
+	double from = 1;
+	double factor = 2;
+	double to = 100000;
+	long refine = 4;
+	commandLine.Found("from", &from);
+	commandLine.Found("factor", &factor);
+	commandLine.Found("to", &to);
+	commandLine.Found("refine", &refine);
+	if (from <= 0 || factor <= 1 || from > to) {
+		wxLogError("the ramp needs --from > 0, --factor > 1 and --from <= --to");
+		return 2;
+	}
+
+	// Speed up until the first drops (or the sender can't go any faster)
+	Step best = {};
+	bool failed = false;
+	bool senderBound = false;
+	double over = 0; // slowest speed with drops
+	for (speed = from; speed <= to; speed *= factor) {
+		auto step = Run(replay, speed, bufferBytes);
+		if (!IsSustained(step)) {
+			failed = true;
+			over = speed;
+			break;
+		}
+		best = step;
+		if (IsSenderBound(step)) {
+			senderBound = true;
+			break;
+		}
+	}
+
+	// Then narrow it down (the steps are geometric, so is the search)
+	for (long i = 0; failed && best.speed > 0 && i < refine; i++) {
+		auto step = Run(replay, std::sqrt(best.speed * over), bufferBytes);
+		if (IsSustained(step)) {
+			best = step;
+		} else {
+			over = step.speed;
+		}
+	}
+
+	if (best.speed == 0) {
+		wxPrintf("packets were dropped even at %.2fx\n", from);
+		return 1;
+	}
+
+	// Faster replays of the same connections are equivalent to more of them at the captured speed
+	wxPrintf("sustained: %.0f packets/s, %.1f MB/s, %.2f games/s at %.2fx (about %.0f connections like these at once)\n",
+		best.packetsPerSecond, best.megabytesPerSecond, best.gamesPerSecond, best.achieved,
+		replay.Concurrency() * best.achieved);
+	if (senderBound) {
+		wxPrintf("the replay couldn't send any faster, the parsing stack may handle more\n");
+	} else if (!failed) {
+		wxPrintf("no drops up to --to %.0fx\n", to);
+	}
+	return 0;
+}
@@ -0,0 +1,116 @@
+// wx #includes must come first to prevent secure function warning from wxcrt.h
+#include <wx/crt.h>
+#include <wx/init.h>
+
+#include "Clock.h"
+#include "Frames.h"
+#include "tcp/Segment.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+// segbench: the cost of tcp::Segment (and FlowHash) per frame for IPv4,
+// IPv6 and mixed traffic. Frames are built in memory, so this measures the
+// parsing alone. Exits with 1 if any frame wasn't parsed.
+
+namespace {
+	typedef Frames::Bytes Frame;
+
+	const int FRAMES = 4096;       // distinct frames, cycled through
+	const int PASSES = 500;
+	const size_t PAYLOAD = 200;
+
+	Frames::Tcp Tcp(int i)
+	{
+		Frames::Tcp tcp = { uint16_t(30000 + i % 20000), uint16_t(i % 2 ? 1119 : 3724), 1000u + i, 0, Frames::PSH | Frames::ACK };
+		return tcp;
+	}
+
+	Frame Ipv4(int i)
+	{
+		Frame payload(PAYLOAD, uint8_t(i));
+		// 10.x.x.x to 12.130.244.x
+		return Frames::Ipv4(0x0a000000u + i, 0x0c82f400u + i % 16, Tcp(i), payload.data(), payload.size());
+	}
+
+	// With <extensions> headers: hop-by-hop, then destination options
+	Frame Ipv6(int i, int extensions)
+	{
+		auto f = Frames::Ethernet(0x86dd);
+		Frames::Put32(f, 0x60000000);
+		Frames::Put16(f, uint16_t(extensions * 8 + 20 + PAYLOAD));
+		f.push_back(extensions ? 0 : 6);
+		f.push_back(64);
+		for (uint32_t word : { 0x20010db8u, 0u, 0u, uint32_t(i), 0x20010db8u, 1u, 0u, uint32_t(i % 16) }) {
+			Frames::Put32(f, word);
+		}
+		for (int n = 1; n <= extensions; n++) {
+			const uint8_t OPTIONS[] = { uint8_t(n < extensions ? 60 : 6), 0, 1, 4, 0, 0, 0, 0 }; // -> next, PadN
+			f.insert(f.end(), OPTIONS, OPTIONS + sizeof(OPTIONS));
+		}
+		Frame payload(PAYLOAD, uint8_t(i));
+		Frames::PutTcp(f, Tcp(i), payload.data(), payload.size());
+		return f;
+	}
+
+	// Every <v6Every>'th frame is IPv6 (0 for none), a third of those with
+	// <extensions> extension headers
+	std::vector<Frame> Mix(int v6Every, int extensions = 2)
+	{
+		std::vector<Frame> frames;
+		for (int i = 0; i < FRAMES; i++) {
+			frames.push_back(v6Every && i % v6Every == 0 ? Ipv6(i, i % 3 == 0 ? extensions : 0) : Ipv4(i));
+		}
+		return frames;
+	}
+
+	// Returns whether every frame was parsed
+	bool Run(const char *name, const std::vector<Frame> &frames)
+	{
+		uint64_t parsed = 0;
+		uint64_t hashed = 0;
+
+		auto start = Clock::Now();
+		for (int pass = 0; pass < PASSES; pass++) {
+			for (auto &frame : frames) {
+				tcp::Segment segment(std::make_range(frame.data(), frame.data() + frame.size()));
+				parsed += segment.WasParsed() ? segment.Payload().size() : 0;
+			}
+		}
+		auto parseNanos = Clock::Now() - start;
+
+		start = Clock::Now();
+		for (int pass = 0; pass < PASSES; pass++) {
+			for (auto &frame : frames) {
+				uint32_t hash;
+				hashed += tcp::Segment::FlowHash(std::make_range(frame.data(), frame.data() + frame.size()), hash) ? 1 : 0;
+			}
+		}
+		auto hashNanos = Clock::Now() - start;
+
+		auto count = double(frames.size()) * PASSES;
+		auto ok = parsed == uint64_t(count) * PAYLOAD && hashed == uint64_t(count);
+		wxPrintf("%-10s %8.1f ns/segment %8.1f ns/hash  (%s)\n", name,
+			parseNanos / count, hashNanos / count, ok ? "ok" : "PARSE ERRORS");
+		return ok;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	wxInitializer initializer(argc, argv);
+	if (!initializer.IsOk()) {
+		fprintf(stderr, "segbench: failed to initialize wxWidgets\n");
+		return 1;
+	}
+
+	bool ok = Run("ipv4", Mix(0));
+	ok = Run("ipv6", Mix(1)) && ok;
+	ok = Run("mixed", Mix(2)) && ok;
+
+	// As many extension headers as tcp::Segment follows
+	ok = Run("ipv6-ext8", Mix(1, 8)) && ok;
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,504 @@
+// wx #includes must come first to prevent secure function warning from wxcrt.h
+#include <wx/cmdline.h>
+#include <wx/crt.h>
+#include <wx/init.h>
+#include <wx/log.h>
+
+#include "Frames.h"
+#include "PacketType.h"
+
+#include "PowerHistory.pb.h"
+#include "StartGameState.pb.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+// hsgen: writes a pcap of synthetic games for the offline readers (hssniff,
+// pipebench) with as many concurrent games and as much damage as asked for.
+//
+// Every game is a TCP connection to port 3724 carrying a StartGameState and
+// then turns of CHOOSE_OPTION from the client answered by PowerHistory from
+// the server, all valid messages for the protos/ schemas behind the 8 byte
+// GameDecoder header. With --idle the server also plays an opponent's turn
+// after a quiet spell, the way an idle interactive connection looks to a
+// passive RTT estimate. The captured segments can then be lost (and
+// retransmitted later), dropped (never seen), reordered, duplicated or
+// overlapped by a repacketized retransmission. The same seed and options
+// always give the same file.
+
+namespace {
+	typedef Frames::Bytes Bytes;
+
+	const int64_t NSEC_PER_MSEC = 1000000;
+	const int64_t NSEC_PER_USEC = 1000;
+
+	// Captures start at a fixed time so the output only depends on the options
+	const int64_t EPOCH = int64_t(1500000000) * 1000 * NSEC_PER_MSEC;
+
+	// Only the engine's output is used: the std distributions aren't the same
+	// in every standard library, so they'd give different files
+	class Random
+	{
+	public:
+		explicit Random(uint32_t seed) : _engine(seed) { }
+
+		// In [0, n)
+		uint32_t Below(uint32_t n) { return uint32_t((uint64_t(_engine()) * n) >> 32); }
+
+		// In [low, high]
+		int64_t Between(int64_t low, int64_t high) { return low + Below(uint32_t(high - low + 1)); }
+
+		bool Chance(double p) { return p > 0 && _engine() < p * 4294967296.0; }
+
+	private:
+		std::mt19937 _engine;
+	};
+
+	struct Options
+	{
+		uint32_t seed;
+		uint32_t games;
+		uint32_t turns;
+		uint32_t minSegment;
+		uint32_t maxSegment;
+		int64_t spread;    // games start over this long (nanoseconds)
+		int64_t rtt;       // capture point (at the client) to the server and back
+		int64_t response;  // server think time after a CHOOSE_OPTION
+		int64_t idle;      // server silence before each opponent's turn (0 for none)
+		bool timestamps;   // TCP timestamps option on every segment
+
+		// Chance of each impairment, for every data segment
+		double loss;       // lost after the capture point and retransmitted an RTO later
+		double drop;       // missing from the capture altogether
+		double reorder;    // captured after the segments sent after it
+		double duplicate;  // captured twice
+		double overlap;    // followed by a retransmission starting in the middle of it
+	};
+
+	struct Packet
+	{
+		int64_t nanotime;
+		Bytes frame;
+	};
+
+	struct Counts
+	{
+		uint64_t segments;
+		uint64_t lost;
+		uint64_t dropped;
+		uint64_t reordered;
+		uint64_t duplicated;
+		uint64_t overlapped;
+
+		Counts() : segments(0), lost(0), dropped(0), reordered(0), duplicated(0), overlapped(0) { }
+	};
+
+	// One direction of a connection
+	struct Direction
+	{
+		uint32_t srcIp;
+		uint32_t dstIp;
+		uint16_t srcPort;
+		uint16_t dstPort;
+		uint32_t nextSeq;
+		Direction *other;
+		std::set<int64_t> sent; // capture times, with timestamps
+
+		// The TSval of the last segment that had reached the other end by <nanotime> (0 for none)
+		uint32_t Echo(int64_t nanotime) const
+		{
+			auto last = sent.upper_bound(nanotime);
+			return last == sent.begin() ? 0 : TsClock(*--last);
+		}
+
+		// Both ends' timestamp clocks tick every millisecond, from the same start
+		static uint32_t TsClock(int64_t nanotime) { return uint32_t(nanotime / NSEC_PER_MSEC); }
+	};
+
+	class Generator
+	{
+	public:
+		Generator(const Options &options, std::vector<Packet> &packets)
+			: _options(options), _random(options.seed), _network(options.seed ^ 0x9e3779b9u), _packets(packets), _counts() { }
+
+		void Game(uint32_t game);
+
+		const Counts &Totals() const { return _counts; }
+
+	private:
+		// An Ethernet/IPv4/TCP frame, with valid checksums
+		void Capture(int64_t nanotime, Direction &from, uint32_t seq, uint8_t flags, const uint8_t *payload = nullptr, size_t size = 0)
+		{
+			Frames::Tcp tcp = { from.srcPort, from.dstPort, seq, (flags & Frames::ACK) ? from.other->nextSeq : 0, flags };
+			if (_options.timestamps) {
+				// Captured at the client, so the server had only heard what was captured a round trip before
+				auto fromClient = from.dstPort == 3724;
+				tcp.timestamps = true;
+				tcp.tsVal = Direction::TsClock(nanotime);
+				tcp.tsEcr = from.other->Echo(fromClient ? nanotime : nanotime - _options.rtt);
+				from.sent.insert(nanotime);
+			}
+
+			Packet packet = { nanotime, Frames::Ipv4(from.srcIp, from.dstIp, tcp, payload, size) };
+			_packets.push_back(std::move(packet));
+		}
+
+		void Send(int64_t nanotime, Direction &from, uint32_t type, const std::string &payload);
+
+		std::string StartGame(int seed);
+		std::string CreateGame(int firstEntity, int cards);
+		std::string Play(int entities);
+		std::string Triggers(int entities);
+
+		const Options &_options;
+		Random _random;  // the games
+		Random _network; // segmenting and impairments, so the same seed gives the same games with or without them
+		std::vector<Packet> &_packets;
+		Counts _counts;
+	};
+
+	// Segments a message and captures it, with whatever impairments come up.
+	// The capture point is at the client, so the peer's ACK for a segment is
+	// seen a round trip later for client data and straight away for server data.
+	void Generator::Send(int64_t nanotime, Direction &from, uint32_t type, const std::string &payload)
+	{
+		Bytes message(PACKET_HEADER_SIZE);
+		uint32_t header[2] = { type, uint32_t(payload.size()) };
+		std::memcpy(message.data(), header, sizeof(header));
+		message.insert(message.end(), payload.begin(), payload.end());
+
+		auto fromClient = from.dstPort == 3724;
+		auto ackDelay = fromClient ? _options.rtt : 200 * NSEC_PER_USEC;
+		auto rto = std::max<int64_t>(200 * NSEC_PER_MSEC, 3 * _options.rtt);
+
+		size_t offset = 0;
+		size_t previous = 0; // start of the last segment
+		while (offset < message.size()) {
+			auto size = std::min<size_t>(message.size() - offset, size_t(_network.Between(_options.minSegment, _options.maxSegment)));
+			auto seq = from.nextSeq;
+			auto data = &message[offset];
+			_counts.segments++;
+
+			if (_network.Chance(_options.drop)) {
+				_counts.dropped++;
+			} else if (_network.Chance(_options.loss)) {
+				_counts.lost++;
+				Capture(nanotime + rto, from, seq, Frames::PSH | Frames::ACK, data, size);
+			} else if (_network.Chance(_options.reorder)) {
+				_counts.reordered++;
+				Capture(nanotime + NSEC_PER_MSEC, from, seq, Frames::PSH | Frames::ACK, data, size);
+			} else {
+				Capture(nanotime, from, seq, Frames::PSH | Frames::ACK, data, size);
+			}
+
+			if (_network.Chance(_options.duplicate)) {
+				_counts.duplicated++;
+				Capture(nanotime + 100 * NSEC_PER_USEC, from, seq, Frames::PSH | Frames::ACK, data, size);
+			}
+
+			// Resent from the middle of the previous segment to the end of this one
+			if (offset > 0 && _network.Chance(_options.overlap)) {
+				_counts.overlapped++;
+				auto start = previous + (offset - previous) / 2;
+				Capture(nanotime + 150 * NSEC_PER_USEC, from, seq - uint32_t(offset - start), Frames::PSH | Frames::ACK, &message[start], offset + size - start);
+			}
+
+			from.nextSeq += uint32_t(size);
+			previous = offset;
+			offset += size;
+
+			// Delayed ACKs, every other segment and at the end
+			if (_counts.segments % 2 == 0 || offset == message.size()) {
+				Capture(nanotime + ackDelay, *from.other, from.other->nextSeq, Frames::ACK);
+			}
+			nanotime += 10 * NSEC_PER_USEC;
+		}
+	}
+
+	void AddTags(google::protobuf::RepeatedPtrField<Tag> *tags, int count, int seed)
+	{
+		for (int i = 0; i < count; i++) {
+			auto tag = tags->Add();
+			tag->set_name(i * 7 + 1);
+			tag->set_value((seed + i) * 13 % 100);
+		}
+	}
+
+	void SetPlayer(Player *player, int id, int entity, uint32_t account)
+	{
+		player->set_id(id);
+		player->mutable_accountid()->set_hi(0x2000000);
+		player->mutable_accountid()->set_lo(int32_t(account));
+		player->mutable_entity()->set_id(entity);
+		AddTags(player->mutable_entity()->mutable_tags(), 30, entity);
+	}
+
+	std::string Generator::StartGame(int seed)
+	{
+		StartGameState state;
+		state.mutable_game_entity()->set_id(1);
+		AddTags(state.mutable_game_entity()->mutable_tags(), 20, seed);
+		SetPlayer(state.add_players(), 1, 2, _random.Below(1u << 31));
+		SetPlayer(state.add_players(), 2, 3, _random.Below(1u << 31));
+		return state.SerializeAsString();
+	}
+
+	// The game and every card in both decks
+	std::string Generator::CreateGame(int firstEntity, int cards)
+	{
+		PowerHistory history;
+		auto create = history.add_list()->mutable_create_game();
+		create->mutable_entity()->set_id(1);
+		AddTags(create->mutable_entity()->mutable_tags(), 20, 0);
+		SetPlayer(create->add_players(), 1, 2, 1);
+		SetPlayer(create->add_players(), 2, 3, 2);
+
+		for (int i = 0; i < cards; i++) {
+			auto entity = history.add_list()->mutable_full_entity();
+			entity->set_entity(firstEntity + i);
+			entity->set_name(i % 2 ? "" : "CS2_" + std::to_string(100 + _random.Below(200)));
+			AddTags(entity->mutable_tags(), 8, i);
+		}
+		return history.SerializeAsString();
+	}
+
+	// A card played: shown, its effects, and the state they leave
+	std::string Generator::Play(int entities)
+	{
+		PowerHistory history;
+		auto source = 4 + int(_random.Below(uint32_t(entities)));
+		auto target = 4 + int(_random.Below(uint32_t(entities)));
+
+		auto start = history.add_list()->mutable_power_start();
+		start->set_type(PowerHistoryStart::PLAY);
+		start->set_index(-1);
+		start->set_source(source);
+		start->set_target(target);
+
+		auto shown = history.add_list()->mutable_show_entity();
+		shown->set_entity(source);
+		shown->set_name("EX1_" + std::to_string(_random.Below(600)));
+		AddTags(shown->mutable_tags(), 12, source);
+
+		auto meta = history.add_list()->mutable_metadata();
+		meta->add_info(target);
+		meta->set_type(PowerHistoryMetaData::META_DAMAGE);
+		meta->set_data(int(_random.Between(1, 10)));
+
+		for (int i = 0, changes = int(_random.Between(5, 30)); i < changes; i++) {
+			auto change = history.add_list()->mutable_tag_change();
+			change->set_entity(4 + int(_random.Below(uint32_t(entities))));
+			change->set_tag(int(_random.Between(1, 500)));
+			change->set_value(int(_random.Below(100)));
+		}
+
+		history.add_list()->mutable_power_end();
+		return history.SerializeAsString();
+	}
+
+	// Follow up effects, a few tag changes and sometimes a card moved out of sight
+	std::string Generator::Triggers(int entities)
+	{
+		PowerHistory history;
+		for (int i = 0, changes = int(_random.Between(1, 8)); i < changes; i++) {
+			auto change = history.add_list()->mutable_tag_change();
+			change->set_entity(4 + int(_random.Below(uint32_t(entities))));
+			change->set_tag(int(_random.Between(1, 500)));
+			change->set_value(int(_random.Below(100)));
+		}
+		if (_random.Chance(0.3)) {
+			auto hide = history.add_list()->mutable_hide_entity();
+			hide->set_entity(4 + int(_random.Below(uint32_t(entities))));
+			hide->set_zone(3);
+		}
+		return history.SerializeAsString();
+	}
+
+	void Generator::Game(uint32_t game)
+	{
+		const int CARDS = 60;
+
+		// A client of its own talking to one of a few servers
+		Direction client = { 0x0a000001u + game, 0x0c82f401u + game % 16, uint16_t(50000 + game % 10000), 3724, _random.Below(~0u), nullptr };
+		Direction server = { client.dstIp, client.srcIp, client.dstPort, client.srcPort, _random.Below(~0u), nullptr };
+		client.other = &server;
+		server.other = &client;
+
+		auto t = EPOCH + int64_t(_random.Below(uint32_t(_options.spread / NSEC_PER_MSEC))) * NSEC_PER_MSEC;
+
+		// Handshake
+		Capture(t, client, client.nextSeq++, Frames::SYN);
+		t += _options.rtt;
+		Capture(t, server, server.nextSeq++, Frames::SYN | Frames::ACK);
+		Capture(t + 10 * NSEC_PER_USEC, client, client.nextSeq, Frames::ACK);
+
+		t += NSEC_PER_MSEC;
+		Send(t, server, START_GAME_STATE, StartGame(int(game)));
+		Send(t + NSEC_PER_MSEC, server, POWER_HISTORY, CreateGame(4, CARDS));
+
+		for (uint32_t turn = 0; turn < _options.turns; turn++) {
+			t += _random.Between(500, 5000) * NSEC_PER_MSEC; // thinking
+
+			Send(t, client, CHOOSE_OPTION, std::string(size_t(_random.Between(4, 12)), char(turn)));
+
+			// Half a round trip each way, plus the server's own time (+-25%)
+			auto response = _options.response + _random.Between(-_options.response / 4, _options.response / 4);
+			t += _options.rtt + response;
+			Send(t, server, POWER_HISTORY, Play(CARDS));
+
+			for (int i = 0, follow = int(_random.Between(0, 3)); i < follow; i++) {
+				t += _random.Between(5, 50) * NSEC_PER_MSEC;
+				Send(t, server, POWER_HISTORY, Triggers(CARDS));
+			}
+
+			// The opponent's turn, after a spell with only ACKs from the client
+			if (_options.idle > 0) {
+				t += _options.idle;
+				Send(t, server, POWER_HISTORY, Play(CARDS));
+			}
+		}
+
+		// The client closes, the server follows
+		t += NSEC_PER_MSEC * 1000;
+		Capture(t, client, client.nextSeq, Frames::FIN | Frames::ACK);
+		client.nextSeq++;
+		t += _options.rtt;
+		Capture(t, server, server.nextSeq, Frames::FIN | Frames::ACK);
+		server.nextSeq++;
+		Capture(t + 10 * NSEC_PER_USEC, client, client.nextSeq, Frames::ACK);
+	}
+
+	void Put(std::FILE *file, uint32_t value)
+	{
+		std::fwrite(&value, sizeof(value), 1, file);
+	}
+
+	// Classic pcap, microsecond timestamps, Ethernet
+	bool Write(const std::string &path, const std::vector<Packet> &packets)
+	{
+		auto file = std::fopen(path.c_str(), "wb");
+		if (!file) {
+			wxLogError("can't create %s", path);
+			return false;
+		}
+
+		Put(file, 0xa1b2c3d4);   // native byte order
+		Put(file, 2 | (4 << 16)); // version 2.4
+		Put(file, 0);             // time zone
+		Put(file, 0);             // accuracy
+		Put(file, 65535);         // snapshot length
+		Put(file, 1);             // DLT_EN10MB
+
+		for (auto &packet : packets) {
+			Put(file, uint32_t(packet.nanotime / (1000 * NSEC_PER_MSEC)));
+			Put(file, uint32_t(packet.nanotime % (1000 * NSEC_PER_MSEC) / NSEC_PER_USEC));
+			Put(file, uint32_t(packet.frame.size()));
+			Put(file, uint32_t(packet.frame.size()));
+			std::fwrite(packet.frame.data(), 1, packet.frame.size(), file);
+		}
+
+		auto ok = !std::ferror(file);
+		ok = std::fclose(file) == 0 && ok;
+		if (!ok) {
+			wxLogError("error writing %s", path);
+		}
+		return ok;
+	}
+
+	const wxCmdLineEntryDesc COMMAND_LINE[] = {
+		{ wxCMD_LINE_SWITCH, "h", "help", "show this help", wxCMD_LINE_VAL_NONE, wxCMD_LINE_OPTION_HELP },
+		{ wxCMD_LINE_OPTION, NULL, "seed", "random seed (default: 1)", wxCMD_LINE_VAL_NUMBER },
+		{ wxCMD_LINE_OPTION, "g", "games", "number of games (default: 10)", wxCMD_LINE_VAL_NUMBER },
+		{ wxCMD_LINE_OPTION, "t", "turns", "turns in every game (default: 30)", wxCMD_LINE_VAL_NUMBER },
+		{ wxCMD_LINE_OPTION, NULL, "spread", "seconds over which the games start (default: 10, 0 starts them together)", wxCMD_LINE_VAL_NUMBER },
+		{ wxCMD_LINE_OPTION, NULL, "min-segment", "smallest segment payload (default: 536)", wxCMD_LINE_VAL_NUMBER },
+		{ wxCMD_LINE_OPTION, NULL, "max-segment", "largest segment payload (default: 1460)", wxCMD_LINE_VAL_NUMBER },
+		{ wxCMD_LINE_OPTION, NULL, "rtt", "round trip to the server in ms (default: 40)", wxCMD_LINE_VAL_NUMBER },
+		{ wxCMD_LINE_OPTION, NULL, "response", "server response time in ms (default: 80)", wxCMD_LINE_VAL_NUMBER },
+		{ wxCMD_LINE_OPTION, NULL, "idle", "after every turn, play the opponent's turn after this many ms of silence (default: 0, none)", wxCMD_LINE_VAL_NUMBER },
+		{ wxCMD_LINE_SWITCH, NULL, "timestamps", "add the TCP timestamps option to every segment" },
+		{ wxCMD_LINE_OPTION, NULL, "loss", "percent of segments lost and retransmitted", wxCMD_LINE_VAL_DOUBLE },
+		{ wxCMD_LINE_OPTION, NULL, "drop", "percent of segments missing from the capture", wxCMD_LINE_VAL_DOUBLE },
+		{ wxCMD_LINE_OPTION, NULL, "reorder", "percent of segments captured out of order", wxCMD_LINE_VAL_DOUBLE },
+		{ wxCMD_LINE_OPTION, NULL, "duplicate", "percent of segments captured twice", wxCMD_LINE_VAL_DOUBLE },
+		{ wxCMD_LINE_OPTION, NULL, "overlap", "percent of segments followed by an overlapping retransmission", wxCMD_LINE_VAL_DOUBLE },
+		{ wxCMD_LINE_PARAM, NULL, NULL, "output file", wxCMD_LINE_VAL_STRING },
+		{ wxCMD_LINE_NONE }
+	};
+
+	long Number(wxCmdLineParser &commandLine, const char *name, long value, long low)
+	{
+		commandLine.Found(name, &value);
+		return std::max(value, low);
+	}
+
+	double Percent(wxCmdLineParser &commandLine, const char *name)
+	{
+		double value = 0;
+		commandLine.Found(name, &value);
+		return std::min(std::max(value, 0.0), 100.0) / 100;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	wxInitializer initializer(argc, argv);
+	if (!initializer.IsOk()) {
+		fprintf(stderr, "hsgen: failed to initialize wxWidgets\n");
+		return 1;
+	}
+
+	wxCmdLineParser commandLine(COMMAND_LINE, argc, argv);
+	switch (commandLine.Parse()) {
+	case -1:
+		return 0; // help
+	case 0:
+		break;
+	default:
+		return 2;
+	}
+
+	Options options;
+	options.seed = uint32_t(Number(commandLine, "seed", 1, 0));
+	options.games = uint32_t(Number(commandLine, "g", 10, 1));
+	options.turns = uint32_t(Number(commandLine, "t", 30, 0));
+	options.spread = Number(commandLine, "spread", 10, 0) * 1000 * NSEC_PER_MSEC + NSEC_PER_MSEC;
+	options.minSegment = uint32_t(Number(commandLine, "min-segment", 536, 1));
+	options.maxSegment = uint32_t(std::max<long>(Number(commandLine, "max-segment", 1460, 1), options.minSegment));
+	options.rtt = Number(commandLine, "rtt", 40, 0) * NSEC_PER_MSEC;
+	options.response = Number(commandLine, "response", 80, 0) * NSEC_PER_MSEC;
+	options.idle = Number(commandLine, "idle", 0, 0) * NSEC_PER_MSEC;
+	options.timestamps = commandLine.Found("timestamps");
+	options.loss = Percent(commandLine, "loss");
+	options.drop = Percent(commandLine, "drop");
+	options.reorder = Percent(commandLine, "reorder");
+	options.duplicate = Percent(commandLine, "duplicate");
+	options.overlap = Percent(commandLine, "overlap");
+
+	std::vector<Packet> packets;
+	Generator generator(options, packets);
+	for (uint32_t game = 0; game < options.games; game++) {
+		generator.Game(game);
+	}
+
+	// In capture order (ties stay in the order they were made)
+	std::stable_sort(packets.begin(), packets.end(), [](const Packet &a, const Packet &b) { return a.nanotime < b.nanotime; });
+
+	auto output = commandLine.GetParam(0).ToStdString();
+	if (!Write(output, packets)) {
+		return 1;
+	}
+
+	auto &counts = generator.Totals();
+	wxPrintf("%s: %u games, %llu packets, %llu data segments (%llu lost, %llu dropped, %llu reordered, %llu duplicated, %llu overlapped)\n",
+		output.c_str(), options.games, (unsigned long long)packets.size(), (unsigned long long)counts.segments,
+		(unsigned long long)counts.lost, (unsigned long long)counts.dropped, (unsigned long long)counts.reordered,
+		(unsigned long long)counts.duplicated, (unsigned long long)counts.overlapped);
+	return 0;
+}
@@ -1 +1,64 @@
 #include "Endpoint.h"
+
+std::string tcp::Address::ToString() const
+{
+	static const char HEX[] = "0123456789abcdef";
+
+	std::string s;
+	switch (_family) {
+	case V4:
+		for (int i = 0; i < 4; i++) {
+			if (i) {
+				s += '.';
+			}
+			s += std::to_string(_bytes[i]);
+		}
+		break;
+
+	case V6: {
+			// RFC 5952: lower case, no leading zeros, the longest run of two or more zero groups as "::"
+			uint16_t groups[8];
+			for (int i = 0; i < 8; i++) {
+				groups[i] = uint16_t(_bytes[2 * i] << 8 | _bytes[2 * i + 1]);
+			}
+
+			int zeroStart = -1, zeroLength = 0;
+			for (int i = 0; i < 8;) {
+				int j = i;
+				while (j < 8 && groups[j] == 0) {
+					j++;
+				}
+				if (j - i > zeroLength && j - i >= 2) {
+					zeroStart = i;
+					zeroLength = j - i;
+				}
+				i = j > i ? j : i + 1;
+			}
+
+			for (int i = 0; i < 8; i++) {
+				if (i == zeroStart) {
+					s += "::";
+					i += zeroLength - 1;
+					continue;
+				}
+				if (i && i != zeroStart + zeroLength) {
+					s += ':';
+				}
+
+				bool digits = false;
+				for (int shift = 12; shift >= 0; shift -= 4) {
+					auto digit = (groups[i] >> shift) & 0xf;
+					if (digit || digits || shift == 0) {
+						s += HEX[digit];
+						digits = true;
+					}
+				}
+			}
+		}
+		break;
+
+	default:
+		break;
+	}
+	return s;
+}
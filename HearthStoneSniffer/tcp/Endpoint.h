@@ -1,41 +1,86 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
 #include <ostream>
 #include <sstream>
 #include <string>
 
 namespace tcp {
 
+// IPv4 or IPv6 address, kept in binary (network order) so it's cheap to copy
+// and compare; only turned into text for logging
+class Address
+{
+public:
+	enum Family { NONE, V4, V6 };
+
+	Address() : _family(NONE) { std::memset(_bytes, 0, sizeof(_bytes)); }
+
+	static Address FromV4(const uint8_t *bytes) { return Address(V4, bytes, 4); }
+	static Address FromV6(const uint8_t *bytes) { return Address(V6, bytes, 16); }
+
+	Family GetFamily() const { return Family(_family); }
+	const uint8_t *Bytes() const { return _bytes; }
+
+	std::string ToString() const;
+
+	bool operator==(const Address &other) const { return _family == other._family && std::memcmp(_bytes, other._bytes, sizeof(_bytes)) == 0; }
+	bool operator<(const Address &other) const
+	{
+		return _family != other._family ? _family < other._family : std::memcmp(_bytes, other._bytes, sizeof(_bytes)) < 0;
+	}
+
+private:
+	Address(Family family, const uint8_t *bytes, size_t size) : _family(uint8_t(family))
+	{
+		std::memcpy(_bytes, bytes, size);
+		std::memset(_bytes + size, 0, sizeof(_bytes) - size);
+	}
+
+	uint8_t _bytes[16]; // IPv4 uses the first 4
+	uint8_t _family;
+};
+
 class Endpoint
 {
 public:
-	Endpoint() { } // = default;
-	Endpoint(std::string ip, uint16_t port) : _ip(std::move(ip)), _port(port) { }
+	Endpoint() : _ip(), _port(0) { } // = default;
+	Endpoint(const Address &ip, uint16_t port) : _ip(ip), _port(port) { }
 
-	const std::string &Ip() const { return _ip; }
+	const Address &Ip() const { return _ip; }
 	uint16_t Port() const { return _port; }
 
+	bool operator==(const Endpoint &other) const { return _port == other._port && _ip == other._ip; }
+	bool operator<(const Endpoint &other) const { return _port != other._port ? _port < other._port : _ip < other._ip; }
+
 private:
-	std::string _ip;
+	Address _ip;
 	uint16_t _port;
 
 	friend std::ostream &operator<<(std::ostream &out, const Endpoint &endpoint)
-	{ return out << '[' << endpoint._ip << "]:" << endpoint._port; }
+	{ return out << '[' << endpoint._ip.ToString() << "]:" << endpoint._port; }
 };
 
+// One direction of a connection. Also the key streams are looked up by.
 class EndpointPair
 {
 public:
 	EndpointPair() : _src(), _dst() { } // = default;
-	EndpointPair(Endpoint src, Endpoint dst) : _src(std::move(src)), _dst(std::move(dst)) { }
+	EndpointPair(const Endpoint &src, const Endpoint &dst) : _src(src), _dst(dst) { }
 
 	const Endpoint &Src() const { return _src; }
 	const Endpoint &Dst() const { return _dst; }
 
+	// The other direction
+	EndpointPair Reversed() const { return EndpointPair(_dst, _src); }
+
 	std::string SrcToDst(const std::string &sep = "->") const { return ToString(_src, sep, _dst); }
 	std::string DstToSrc(const std::string &sep = "->") const { return ToString(_dst, sep, _src); }
 
+	bool operator==(const EndpointPair &other) const { return _src == other._src && _dst == other._dst; }
+	bool operator<(const EndpointPair &other) const { return _src == other._src ? _dst < other._dst : _src < other._src; }
+
 private:
 	Endpoint _src;
 	Endpoint _dst;
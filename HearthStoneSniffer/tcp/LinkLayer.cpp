@@ -0,0 +1,154 @@
+// wx #includes must come first to prevent secure function warning from wxcrt.h
+#include <wx/log.h>
+
+#include "LinkLayer.h"
+
+#include "pcap_tcp.h"
+
+#include <cstring>
+
+namespace {
+	// Link types (pcap_datalink() values, and the LINKTYPE_ values saved in
+	// files where those differ). Not all of these are in older pcap.h files.
+	enum {
+		LINK_NULL = 0,
+		LINK_EN10MB = 1,
+		LINK_RAW = 12,         // DLT_RAW on most platforms
+		LINK_RAW_OPENBSD = 14,
+		LINK_RAW_FILE = 101,   // LINKTYPE_RAW
+		LINK_LOOP = 108,
+		LINK_LINUX_SLL = 113,
+		LINK_IPV4 = 228,
+		LINK_IPV6 = 229,
+		LINK_LINUX_SLL2 = 276,
+	};
+
+	// 802.1Q and 802.1ad (QinQ, and the older pre-standard value) VLAN tags
+	const uint16_t ETHERTYPE_VLAN = 0x8100;
+	const uint16_t ETHERTYPE_QINQ = 0x88a8;
+	const uint16_t ETHERTYPE_QINQ_OLD = 0x9100;
+	const ptrdiff_t VLAN_TAG_LEN = 4;
+
+	// Linux cooked headers
+	const ptrdiff_t SLL_HDRLEN = 16;
+	const ptrdiff_t SLL2_HDRLEN = 20;
+	const uint16_t SLL_OUTGOING = 4;        // sll_pkttype
+	const uint16_t ARPHRD_LOOPBACK = 772;   // sll_hatype
+
+	// BSD loopback, the address family in the byte order of the capturing machine
+	const ptrdiff_t NULL_HDRLEN = 4;
+
+	uint16_t Read16(const uint8_t *p)
+	{
+		uint16_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return ntohs(v);
+	}
+
+	// The network layer from the version in its first byte
+	bool FromVersion(std::range<const uint8_t *> frame, ptrdiff_t offset, uint16_t &etherType)
+	{
+		if (offset >= frame.size()) {
+			return false;
+		}
+
+		switch (frame.begin()[offset] >> 4) {
+		case 4: etherType = ETHERTYPE_IP; break;
+		case 6: etherType = ETHERTYPE_IPV6; break;
+		default: etherType = 0xffff; break; // reported as not IP
+		}
+		return true;
+	}
+}
+
+tcp::LinkLayer::Strip tcp::LinkLayer::ForLinkType(int linkType)
+{
+	switch (linkType) {
+	case LINK_EN10MB:
+		return &Ethernet;
+	case LINK_LINUX_SLL:
+		return &LinuxSll;
+	case LINK_LINUX_SLL2:
+		return &LinuxSll2;
+	case LINK_NULL:
+	case LINK_LOOP:
+		return &Null;
+	case LINK_RAW:
+	case LINK_RAW_OPENBSD:
+	case LINK_RAW_FILE:
+	case LINK_IPV4:
+	case LINK_IPV6:
+		return &Raw;
+	default:
+		return nullptr;
+	}
+}
+
+bool tcp::LinkLayer::Ethernet(std::range<const uint8_t *> frame, ptrdiff_t &offset, uint16_t &etherType)
+{
+	if (frame.size() < ETHER_HDRLEN) {
+		return false;
+	}
+
+	offset = ETHER_HDRLEN;
+	etherType = Read16(frame.begin() + offsetof(ether_header, ether_type));
+
+	// Each tag is followed by the next EtherType
+	while (etherType == ETHERTYPE_VLAN || etherType == ETHERTYPE_QINQ || etherType == ETHERTYPE_QINQ_OLD) {
+		if (offset + VLAN_TAG_LEN > frame.size()) {
+			return false;
+		}
+		etherType = Read16(frame.begin() + offset + 2);
+		offset += VLAN_TAG_LEN;
+	}
+	return true;
+}
+
+bool tcp::LinkLayer::LinuxSll(std::range<const uint8_t *> frame, ptrdiff_t &offset, uint16_t &etherType)
+{
+	if (frame.size() < SLL_HDRLEN) {
+		return false;
+	}
+
+	// Loopback traffic is seen once leaving and once arriving, keep the arrival
+	auto p = frame.begin();
+	if (Read16(p) == SLL_OUTGOING && Read16(p + 2) == ARPHRD_LOOPBACK) {
+		etherType = 0;
+		return true;
+	}
+
+	offset = SLL_HDRLEN;
+	etherType = Read16(p + 14);
+	return true;
+}
+
+bool tcp::LinkLayer::LinuxSll2(std::range<const uint8_t *> frame, ptrdiff_t &offset, uint16_t &etherType)
+{
+	if (frame.size() < SLL2_HDRLEN) {
+		return false;
+	}
+
+	auto p = frame.begin();
+	if (p[10] == SLL_OUTGOING && Read16(p + 8) == ARPHRD_LOOPBACK) {
+		etherType = 0;
+		return true;
+	}
+
+	offset = SLL2_HDRLEN;
+	etherType = Read16(p);
+	return true;
+}
+
+bool tcp::LinkLayer::Null(std::range<const uint8_t *> frame, ptrdiff_t &offset, uint16_t &etherType)
+{
+	// The family numbers differ between platforms (and the byte order is the
+	// capturing machine's), so go by the IP version instead
+	offset = NULL_HDRLEN;
+	return FromVersion(frame, offset, etherType);
+}
+
+bool tcp::LinkLayer::Raw(std::range<const uint8_t *> frame, ptrdiff_t &offset, uint16_t &etherType)
+{
+	offset = 0;
+	return FromVersion(frame, offset, etherType);
+}
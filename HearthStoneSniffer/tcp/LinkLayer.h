@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include "../range.h"
+
+namespace tcp {
+
+// Finds the network layer packet in a captured frame.
+//
+// The link-layer header depends on what was captured (pcap_datalink()), so
+// the function for it is looked up once per capture handle with ForLinkType()
+// and then called for every frame from that handle.
+class LinkLayer
+{
+public:
+	// Sets the offset of the network layer packet in <frame> and its EtherType
+	// (ETHERTYPE_IP, ETHERTYPE_IPV6, ...). An EtherType of 0 means there's
+	// nothing to parse but the frame wasn't malformed (e.g. the second copy of
+	// a loopback packet on the Linux "any" device). False if it's truncated.
+	typedef bool (*Strip)(std::range<const uint8_t *> frame, ptrdiff_t &offset, uint16_t &etherType);
+
+	// The default, and what frames were always assumed to be
+	enum { ETHERNET = 1 };
+
+	// nullptr if the link type isn't supported
+	static Strip ForLinkType(int linkType);
+
+	static bool Ethernet(std::range<const uint8_t *> frame, ptrdiff_t &offset, uint16_t &etherType); // with 802.1Q/802.1ad tags
+	static bool LinuxSll(std::range<const uint8_t *> frame, ptrdiff_t &offset, uint16_t &etherType); // the "any" device
+	static bool LinuxSll2(std::range<const uint8_t *> frame, ptrdiff_t &offset, uint16_t &etherType);
+	static bool Null(std::range<const uint8_t *> frame, ptrdiff_t &offset, uint16_t &etherType);     // BSD loopback
+	static bool Raw(std::range<const uint8_t *> frame, ptrdiff_t &offset, uint16_t &etherType);      // tun/VPN devices
+
+private:
+	LinkLayer() {}
+};
+
+} // namespace tcp
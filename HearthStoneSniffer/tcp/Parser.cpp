@@ -5,25 +5,67 @@
 #include "Segment.h"
 #include "Stream.h"
 
-tcp::Parser::Parser(Callback::Factory callbackFactory)
+#include "../CaptureFilter.h"
+#include "../Diagnostic.h"
+#include "../LatencyTrace.h"
+#include "../Metrics.h"
+
+static Diagnostic ignoredConnections(wxLOG_Info, "connections ignored (not games)");
+static Diagnostic attachedConnections(wxLOG_Info, "connections attached mid-stream");
+
+// How long an ignored connection is remembered after its last segment (and how often that's checked)
+static const int64_t IGNORED_IDLE_NANOS = int64_t(120) * 1000000000;
+
+static Metrics::Counter packets("hs_parser_packets_total", "Packets given to the TCP parser.");
+static Metrics::Counter bytes("hs_parser_bytes_total", "Bytes captured in packets given to the TCP parser.");
+static Metrics::Counter unparsed("hs_parser_unparsed_total", "Packets that weren't TCP segments (or didn't parse).");
+static Metrics::Counter resets("hs_parser_resets_total", "TCP segments with RST set.");
+
+tcp::Parser::Parser(Callback::Factory callbackFactory, Classifier classifier, bool attach)
 	: _streams(),
-	  _callbackFactory(callbackFactory)
+	  _ignored(),
+	  _swept(0),
+	  _callbackFactory(callbackFactory),
+	  _classifier(classifier),
+	  _attach(attach),
+	  _link(&LinkLayer::Ethernet)
 {
 }
 
+void tcp::Parser::SetLinkType(int linkType)
+{
+	_link = LinkLayer::ForLinkType(linkType);
+	if (!_link) {
+		wxLogError("unsupported link type %d, no packets will be parsed", linkType);
+	}
+}
+
 void tcp::Parser::operator()(int64_t nanotime, std::range<const uint8_t*> data)
 {
-	tcp::Segment segment(data);
+	if (LatencyTrace::IsEnabled()) {
+		LatencyTrace::Dequeued(nanotime);
+	}
+
+	packets.Add();
+	bytes.Add(data.size());
+
+	if (nanotime - _swept >= IGNORED_IDLE_NANOS) {
+		Sweep(nanotime);
+	}
+
+	tcp::Segment segment(data, _link);
 	if (!segment.WasParsed() || segment.IsRst()) {
+		(segment.WasParsed() ? resets : unparsed).Add();
+
 		// Try to reset/clear the TcpStream
 		// wxLogVerbose("%s: %s", segment.IsRst() ? "connection reset" : "segment parse error", segment.Endpoints().SrcToDst());
-		_streams.erase(segment.Endpoints().SrcToDst());
-		_streams.erase(segment.Endpoints().DstToSrc());
+		Forget(segment.Endpoints());
 		return;
 	}
 
-	auto key = segment.Endpoints().SrcToDst();
+	auto &key = segment.Endpoints();
 	auto seq = segment.SeqNum();
+	auto payload = segment.Payload();
 
 	// Get the current stream or reserve space for a new one
 	auto prevSize = _streams.size();
@@ -34,7 +76,7 @@ void tcp::Parser::operator()(int64_t nanotime, std::range<const uint8_t*> data)
 		// or if this starting sequence number doesn't match.
 		if (!stream || stream->FirstSeq() != seq) {
 			// Get the reverse stream if it already exists
-			auto it = _streams.find(segment.Endpoints().DstToSrc());
+			auto it = _streams.find(segment.Endpoints().Reversed());
 			auto other = it != _streams.end() ? it->second.get() : nullptr;
 
 			// Create a new stream if there wasn't one or the starting sequence number didn't match
@@ -45,6 +87,20 @@ void tcp::Parser::operator()(int64_t nanotime, std::range<const uint8_t*> data)
 		// report that it will be ignored (map now contains a null Stream for that key).
 		if (_streams.size() > prevSize) {
 			// wxLogVerbose("ignoring %s (no SYN)", key);
+
+			// Or pick it up from its first data (until then, don't keep an entry)
+			if (_attach) {
+				if (payload.size() == 0 || segment.IsFin()) {
+					_streams.erase(key);
+					return;
+				}
+
+				auto it = _streams.find(key.Reversed());
+				auto other = it != _streams.end() ? it->second.get() : nullptr;
+
+				DiagnosticLog(attachedConnections, "attaching to %s mid-stream", key.SrcToDst());
+				stream = std::make_unique<Stream>(this, key, other, nanotime, seq - 1, true);
+			}
 		}
 
 		// In any case, stop now if this stream is being ignored (null Stream).
@@ -56,14 +112,31 @@ void tcp::Parser::operator()(int64_t nanotime, std::range<const uint8_t*> data)
 			// this map to save space for long-running programs.
 			if (segment.IsFin()) {
 				_streams.erase(key);
+				_ignored.erase(key);
+				if (_streams.find(key.Reversed()) == _streams.end()) {
+					CaptureFilter::Release(key);
+				}
+			} else {
+				_ignored[key] = nanotime;
 			}
 			return;
 		}
 	}
 
+	// Round trip times: the segment is sent this way and ACKs the other
+	stream->Rtt().Sent(nanotime, segment);
+	if (stream->Other()) {
+		stream->Other()->Rtt().Acked(nanotime, segment);
+	}
+
 	// Pass the data along for reassembly
-	auto payload = segment.Payload();
 	if (payload.size() > 0) {
+		// Classify the connection by the first bytes in each direction (or a
+		// retransmission of them, which gets the same answer)
+		if (_classifier && seq == stream->FirstSeq() + 1 && !stream->Attached() && !_classifier(payload)) {
+			Ignore(nanotime, key);
+			return;
+		}
 		stream->Add(nanotime, seq, payload);
 	}
 
@@ -73,7 +146,56 @@ void tcp::Parser::operator()(int64_t nanotime, std::range<const uint8_t*> data)
 	}
 }
 
+// Keep both directions in the map with null streams, so the rest of the
+// connection is dropped after one lookup (until it ends, see above, or goes
+// quiet, see Sweep())
+void tcp::Parser::Ignore(int64_t nanotime, const EndpointPair &key)
+{
+	DiagnosticLog(ignoredConnections, "ignoring %s (not a game)", key.SrcToDst());
+
+	_streams[key.Reversed()].reset();
+	_streams[key].reset();
+	_ignored[key.Reversed()] = nanotime;
+	_ignored[key] = nanotime;
+
+	CaptureFilter::Reject(key);
+}
+
+// Both directions
+void tcp::Parser::Forget(const EndpointPair &key)
+{
+	_streams.erase(key);
+	_streams.erase(key.Reversed());
+	_ignored.erase(key);
+	_ignored.erase(key.Reversed());
+	CaptureFilter::Release(key);
+}
+
+// Drops the ignored directions that have gone quiet. Their FIN or RST may
+// never be seen (live capture filters out all of a rejected IPv6 connection).
+void tcp::Parser::Sweep(int64_t nanotime)
+{
+	_swept = nanotime;
+
+	for (auto it = _ignored.begin(); it != _ignored.end(); ) {
+		if (nanotime - it->second < IGNORED_IDLE_NANOS) {
+			++it;
+			continue;
+		}
+
+		// Unless a SYN has started it over since
+		auto stream = _streams.find(it->first);
+		if (stream != _streams.end() && !stream->second) {
+			_streams.erase(stream);
+			if (_streams.find(it->first.Reversed()) == _streams.end()) {
+				CaptureFilter::Release(it->first);
+			}
+		}
+		it = _ignored.erase(it);
+	}
+}
+
 void tcp::Parser::Remove(Stream *stream)
 {
-	_streams.erase(stream->Endpoints().SrcToDst());
+	_streams.erase(stream->Endpoints());
 }
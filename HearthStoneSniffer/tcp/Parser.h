@@ -1,6 +1,8 @@
 #pragma once
 
 #include "../PacketCapture.h"
+#include "Endpoint.h"
+#include "LinkLayer.h"
 
 #include <cstdint>
 #include "../range.h"
@@ -16,24 +18,43 @@ class Parser : public PacketCapture::Callback
 public:
 	struct Callback
 	{
-		virtual void operator()(int64_t nanotime, std::range<const uint8_t*> data) = 0;
+		// <nanotime> is when <data> was delivered (when the segment that made
+		// it contiguous arrived), <captured> when its own segment was
+		virtual void operator()(int64_t nanotime, int64_t captured, std::range<const uint8_t*> data) = 0;
 		virtual ~Callback() { }
 
 		typedef std::unique_ptr<Callback> Ptr;
 		typedef Ptr (*Factory)(int64_t, Stream*);
 	};
 
-	explicit Parser(Callback::Factory callbackFactory);
+	// Looks at the first payload of each direction and returns false if the
+	// connection should be ignored (true when it can't tell)
+	typedef bool (*Classifier)(std::range<const uint8_t*> data);
+
+	// With <attach>, connections whose SYN wasn't seen (e.g. started before
+	// the capture) are picked up from their first data segment
+	explicit Parser(Callback::Factory callbackFactory, Classifier classifier = nullptr, bool attach = false);
 
 	virtual void operator()(int64_t nanotime, std::range<const uint8_t*> data);
 
+	virtual void SetLinkType(int linkType);
+
 	Callback::Factory Factory() const { return _callbackFactory; }
 
 	void Remove(Stream *stream);
 
 private:
-	std::map<std::string, std::unique_ptr<Stream>> _streams;
+	void Ignore(int64_t nanotime, const EndpointPair &key);
+	void Forget(const EndpointPair &key);
+	void Sweep(int64_t nanotime);
+
+	std::map<EndpointPair, std::unique_ptr<Stream>> _streams; // by direction
+	std::map<EndpointPair, int64_t> _ignored; // the null streams above, to when a segment was last seen
+	int64_t _swept;
 	const Callback::Factory _callbackFactory;
+	const Classifier _classifier;
+	const bool _attach;
+	LinkLayer::Strip _link;
 };
 
 } // namespace tcp
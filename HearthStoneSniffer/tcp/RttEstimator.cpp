@@ -0,0 +1,117 @@
+#include "RttEstimator.h"
+
+#include "../Metrics.h"
+
+static Metrics::Distribution rttTimes("hs_stream_rtt_seconds", "Round trip times measured from ACKs and TCP timestamps.", 1e-9);
+
+// Longer than any round trip, a sample this old is time the other end had nothing to send
+static const int64_t MAX_SAMPLE_NANOS = int64_t(3) * 1000000000;
+
+// Sequence numbers (and TSvals) wrap, so compare them by distance
+static bool before(uint32_t a, uint32_t b)
+{
+	return int32_t(a - b) < 0;
+}
+
+tcp::RttEstimator::RttEstimator()
+	: _outstanding(),
+	  _highest(0),
+	  _sent(false),
+	  _tsVals(),
+	  _samples()
+{
+}
+
+void tcp::RttEstimator::Sent(int64_t nanotime, const Segment &segment)
+{
+	if (segment.HasTimestamps()) {
+		// Only the first segment with each value (the clock ticks much slower
+		// than segments are sent). Pure ACKs are left out: the other end only
+		// echoes them with its next segment, which may be its next data after
+		// an idle spell.
+		auto tsVal = segment.TsVal();
+		auto answered = segment.Payload().size() > 0 || segment.IsSyn() || segment.IsFin();
+		if (answered && (_tsVals.empty() || before(_tsVals.back().first, tsVal))) {
+			if (_tsVals.size() == MAX_OUTSTANDING) {
+				_tsVals.pop_front();
+			}
+			_tsVals.emplace_back(tsVal, nanotime);
+		}
+		return;
+	}
+
+	auto size = segment.Payload().size();
+	if (size == 0) {
+		return;
+	}
+
+	auto seq = segment.SeqNum();
+	auto end = seq + uint32_t(size);
+	auto retransmitted = _sent && before(seq, _highest);
+	if (retransmitted) {
+		for (auto &outstanding : _outstanding) {
+			if (before(seq, outstanding.end)) {
+				outstanding.retransmitted = true;
+			}
+		}
+		if (!before(_highest, end)) {
+			return; // nothing new
+		}
+	}
+
+	if (_outstanding.size() == MAX_OUTSTANDING) {
+		_outstanding.pop_front();
+	}
+	_outstanding.emplace_back(end, nanotime, retransmitted);
+	_highest = end;
+	_sent = true;
+}
+
+void tcp::RttEstimator::Acked(int64_t nanotime, const Segment &segment)
+{
+	if (segment.HasTimestamps()) {
+		auto tsEcr = segment.TsEcr();
+		while (!_tsVals.empty() && !before(tsEcr, _tsVals.front().first)) {
+			auto sent = _tsVals.front();
+			_tsVals.pop_front();
+			if (sent.first == tsEcr) {
+				Record(nanotime - sent.second);
+			}
+		}
+		return;
+	}
+
+	if (!segment.IsAck()) {
+		return;
+	}
+
+	// The newest data this ACK covers gives the sample, unless any of it was sent twice
+	auto ack = segment.AckNum();
+	auto covered = false;
+	auto retransmitted = false;
+	int64_t sentAt = 0;
+	while (!_outstanding.empty() && !before(ack, _outstanding.front().end)) {
+		auto &outstanding = _outstanding.front();
+		covered = true;
+		retransmitted = retransmitted || outstanding.retransmitted;
+		sentAt = outstanding.nanotime;
+		_outstanding.pop_front();
+	}
+
+	if (covered && !retransmitted) {
+		Record(nanotime - sentAt);
+	}
+}
+
+void tcp::RttEstimator::Record(int64_t nanos)
+{
+	if (nanos > MAX_SAMPLE_NANOS) {
+		return;
+	}
+
+	if (!_samples) {
+		_samples.reset(new Histogram());
+	}
+	_samples->RecordSigned(nanos);
+	rttTimes.RecordSigned(nanos);
+}
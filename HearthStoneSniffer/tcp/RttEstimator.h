@@ -0,0 +1,64 @@
+#pragma once
+
+#include "Segment.h"
+#include "../Histogram.h"
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <utility>
+
+namespace tcp {
+
+// Passive round trip times of the data sent in one direction of a
+// connection, as seen from where it's captured.
+//
+// With the timestamps option, a sample is the time from the first data (or
+// SYN or FIN) segment carrying a TSval to the first one from the other end
+// echoing it. Without, it's the time from a data segment to the ACK covering
+// it, and an ACK that covers retransmitted data gives no sample (Karn's rule:
+// it could be for either copy). Samples of more than a few seconds are idle
+// time rather than a round trip, and are dropped.
+class RttEstimator
+{
+public:
+	RttEstimator();
+
+	// A segment sent in this direction
+	void Sent(int64_t nanotime, const Segment &segment);
+
+	// A segment from the other end
+	void Acked(int64_t nanotime, const Segment &segment);
+
+	// In nanoseconds, null before the first sample
+	const Histogram *Samples() const { return _samples.get(); }
+
+private:
+	void Record(int64_t nanos);
+
+	// Data not ACKed yet, oldest first
+	struct Outstanding
+	{
+		Outstanding(uint32_t end, int64_t nanotime, bool retransmitted) : end(end), nanotime(nanotime), retransmitted(retransmitted) { }
+
+		uint32_t end; // sequence number after the data
+		int64_t nanotime;
+		bool retransmitted;
+	};
+	std::deque<Outstanding> _outstanding;
+	uint32_t _highest; // end of all the data sent so far (once _sent)
+	bool _sent;
+
+	// TSvals not echoed yet and when each was first sent, oldest first
+	std::deque<std::pair<uint32_t, int64_t>> _tsVals;
+
+	std::unique_ptr<Histogram> _samples;
+
+	// Bounds the queues when the other end isn't seen (e.g. asymmetric routing)
+	enum { MAX_OUTSTANDING = 256 };
+
+	RttEstimator(const RttEstimator &);
+	RttEstimator &operator=(const RttEstimator &);
+};
+
+} // namespace tcp
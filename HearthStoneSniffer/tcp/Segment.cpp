@@ -3,107 +3,295 @@
 
 #include "Segment.h"
 
+#include "../Diagnostic.h"
 #include "pcap_tcp.h"
 
-tcp::Segment::Segment(std::range<const uint8_t *> frame)
-{
-	//-------------------------------------------------------------------------
-	// Ethernet
-	auto ether = reinterpret_cast<const ether_header *>(frame.begin());
-	ptrdiff_t offset = ETHER_HDRLEN;
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
 
-	if (offset > frame.size()) {
-		wxLogError("truncated Ethernet header (%d bytes)", frame.size());
-		return;
+// Malformed or unexpected traffic can arrive at line rate, so these are rate limited
+static Diagnostic unsupportedLink(wxLOG_Error, "frames of an unsupported link type");
+static Diagnostic truncatedLink(wxLOG_Error, "truncated link-layer headers");
+static Diagnostic truncatedIpv4(wxLOG_Error, "truncated IPv4 headers");
+static Diagnostic truncatedIpv6(wxLOG_Error, "truncated IPv6 headers");
+static Diagnostic ipFragments(wxLOG_Error, "IP fragments (not reassembled)");
+static Diagnostic notIp(wxLOG_Error, "non-IP frames");
+static Diagnostic notTcp(wxLOG_Error, "non-TCP packets");
+static Diagnostic truncatedTcp(wxLOG_Error, "truncated TCP headers");
+static Diagnostic truncatedPayload(wxLOG_Error, "truncated TCP payloads");
+
+namespace {
+	const ptrdiff_t IPV4_HDRLEN = 20; // without options
+	const ptrdiff_t IPV6_HDRLEN = 40;
+	const ptrdiff_t TCP_HDRLEN = 20;  // without options
+
+	// IPv6 extension headers (next header values)
+	enum {
+		IPV6_HOP_BY_HOP = 0,
+		IPV6_ROUTING = 43,
+		IPV6_FRAGMENT = 44,
+		IPV6_AUTH = 51,
+		IPV6_DEST_OPTS = 60,
+		IPV6_MOBILITY = 135,
+	};
+
+	// More than any real packet has, stops a loop of crafted headers (a
+	// packet with this many is still parsed)
+	const int IPV6_MAX_EXTENSIONS = 8;
+
+	// Headers aren't aligned in the frame (e.g. after a VLAN tag), so read them a field at a time
+	uint16_t Read16(const uint8_t *p)
+	{
+		uint16_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return ntohs(v);
 	}
 
-	//-------------------------------------------------------------------------
-	// IP
-	std::string ipSrc, ipDst;
-	u_int8_t ipPayloadType;
-	ptrdiff_t ipPayloadLen;
-
-	switch (ntohs(ether->ether_type)) {
-	case ETHERTYPE_IP: { // IPv4
-			// Check minimum header size before reading the actual length
-			auto ip4HeaderLen = 20; // default (min) size
-			if (offset + ip4HeaderLen > frame.size()) {
-				wxLogError("truncated IPv4 header (%d bytes)", frame.size());
-				return;
+	uint32_t Read32(const uint8_t *p)
+	{
+		uint32_t v;
+		std::memcpy(&v, p, sizeof(v));
+		return ntohl(v);
+	}
+
+	// TCP options (kinds)
+	enum {
+		TCP_OPT_END = 0,
+		TCP_OPT_NOP = 1,
+		TCP_OPT_TIMESTAMPS = 8,
+	};
+
+	// Finds the timestamps option among a TCP header's options [p, end)
+	bool FindTimestamps(const uint8_t *p, const uint8_t *end, uint32_t &tsVal, uint32_t &tsEcr)
+	{
+		while (p < end) {
+			if (p[0] == TCP_OPT_END) {
+				return false;
+			}
+			if (p[0] == TCP_OPT_NOP) {
+				p++;
+				continue;
 			}
 
-			auto ipv4 = reinterpret_cast<const ip *>(frame.begin() + offset);
+			if (end - p < 2 || p[1] < 2 || end - p < p[1]) {
+				return false; // malformed
+			}
+			if (p[0] == TCP_OPT_TIMESTAMPS && p[1] == 10) {
+				tsVal = Read32(p + 2);
+				tsEcr = Read32(p + 6);
+				return true;
+			}
+			p += p[1];
+		}
+		return false;
+	}
+
+	enum IpStatus { IP_OK, IP_NOT_IP, IP_TRUNCATED_V4, IP_TRUNCATED_V6, IP_FRAGMENT };
+
+	// What the segment needs from the IP layer
+	struct IpLayer
+	{
+		const uint8_t *src;   // address bytes, network order
+		const uint8_t *dst;
+		bool v6;
+		uint8_t protocol;     // of the payload (after any extension headers)
+		ptrdiff_t offset;     // of the payload in the frame
+		ptrdiff_t length;     // of the payload, from the IP header
+	};
+
+	IpStatus ParseIp(std::range<const uint8_t *> frame, ptrdiff_t offset, uint16_t etherType, IpLayer &ip)
+	{
+		auto p = frame.begin();
 
-			// Parse out the info we care about
-			ip4HeaderLen = IP_HL(ipv4) * 4;
+		switch (etherType) {
+		case ETHERTYPE_IP: {
+				// Check minimum header size before reading the actual length
+				if (offset + IPV4_HDRLEN > frame.size()) {
+					return IP_TRUNCATED_V4;
+				}
 
-			ipPayloadType = ipv4->ip_p;
-			ipPayloadLen = ntohs(ipv4->ip_len) - ip4HeaderLen;
+				auto header = p + offset;
+				auto headerLen = ptrdiff_t(header[offsetof(struct ip, ip_vhl)] & 0x0f) * 4;
 
-			ipSrc = inet_ntoa(ipv4->ip_src);
-			ipDst = inet_ntoa(ipv4->ip_dst);
+				ip.src = header + offsetof(struct ip, ip_src);
+				ip.dst = header + offsetof(struct ip, ip_dst);
+				ip.v6 = false;
+				ip.protocol = header[offsetof(struct ip, ip_p)];
+				ip.offset = offset + headerLen;
+				ip.length = ptrdiff_t(Read16(header + offsetof(struct ip, ip_len))) - headerLen;
 
-			// Check actual packet size
-			offset += ip4HeaderLen;
-			if (offset > frame.size()) {
-				wxLogError("truncated IPv4 header (%d bytes)", frame.size());
-				return;
+				// Check actual header size
+				if (headerLen < IPV4_HDRLEN || ip.offset > frame.size()) {
+					return IP_TRUNCATED_V4;
+				}
+
+				// Only the first fragment has the TCP header
+				if ((Read16(header + offsetof(struct ip, ip_off)) & IP_OFFMASK) != 0) {
+					return IP_FRAGMENT;
+				}
+				return IP_OK;
 			}
-		}
-		break;
 
-	case ETHERTYPE_IPV6: {
-			// TODO
-			wxLogError("NYI: IPv6");
-			return;
+		case ETHERTYPE_IPV6: {
+				if (offset + IPV6_HDRLEN > frame.size()) {
+					return IP_TRUNCATED_V6;
+				}
+
+				// version/class/flow (4), payload length (2), next header (1), hop limit (1), addresses (2 x 16)
+				auto header = p + offset;
+				ip.src = header + 8;
+				ip.dst = header + 24;
+				ip.v6 = true;
+				ip.protocol = header[6];
+				ip.offset = offset + IPV6_HDRLEN;
+				ip.length = Read16(header + 4);
+
+				// Walk the extension headers up to the upper layer
+				for (int extensions = 0; ; extensions++) {
+					ptrdiff_t extensionLen;
+					switch (ip.protocol) {
+					case IPV6_HOP_BY_HOP:
+					case IPV6_ROUTING:
+					case IPV6_DEST_OPTS:
+					case IPV6_MOBILITY:
+						if (ip.offset + 2 > frame.size()) {
+							return IP_TRUNCATED_V6;
+						}
+						extensionLen = (ptrdiff_t(p[ip.offset + 1]) + 1) * 8;
+						break;
+
+					case IPV6_FRAGMENT:
+						if (ip.offset + 8 > frame.size()) {
+							return IP_TRUNCATED_V6;
+						}
+						if ((Read16(p + ip.offset + 2) & 0xfff8) != 0) {
+							return IP_FRAGMENT;
+						}
+						extensionLen = 8;
+						break;
+
+					case IPV6_AUTH:
+						if (ip.offset + 2 > frame.size()) {
+							return IP_TRUNCATED_V6;
+						}
+						extensionLen = (ptrdiff_t(p[ip.offset + 1]) + 2) * 4;
+						break;
+
+					default:
+						return IP_OK;
+					}
+
+					if (extensions == IPV6_MAX_EXTENSIONS) {
+						return IP_TRUNCATED_V6; // gave up looking for the end
+					}
+
+					ip.protocol = p[ip.offset];
+					ip.offset += extensionLen;
+					ip.length -= extensionLen;
+					if (ip.offset > frame.size() || ip.length < 0) {
+						return IP_TRUNCATED_V6;
+					}
+				}
+			}
+
+		default:
+			return IP_NOT_IP;
 		}
-		break;
+	}
+}
 
-	default:
-		wxLogError("expected IP packet (ether_type: 0x%04x)", ntohs(ether->ether_type));
+tcp::Segment::Segment(std::range<const uint8_t *> frame, LinkLayer::Strip link)
+	: _seq(0),
+	  _ack(0),
+	  _tsVal(0),
+	  _tsEcr(0),
+	  _flags(0),
+	  _timestamps(false),
+	  _ok(false)
+{
+	//-------------------------------------------------------------------------
+	// Link layer (Ethernet, Linux cooked, loopback, ...)
+	ptrdiff_t offset = 0;
+	uint16_t etherType = 0;
+
+	if (!link) {
+		DiagnosticLog(unsupportedLink, "unsupported link type (%d bytes)", frame.size());
+		return;
+	}
+	if (!link(frame, offset, etherType)) {
+		DiagnosticLog(truncatedLink, "truncated link-layer header (%d bytes)", frame.size());
+		return;
+	}
+	if (etherType == 0) {
+		return; // nothing to parse (e.g. a duplicate)
+	}
+
+	//-------------------------------------------------------------------------
+	// IP (v4 or v6)
+	IpLayer ip;
+	switch (ParseIp(frame, offset, etherType, ip)) {
+	case IP_OK:
+		break;
+	case IP_NOT_IP:
+		DiagnosticLog(notIp, "expected IP packet (ether_type: 0x%04x)", etherType);
+		return;
+	case IP_TRUNCATED_V4:
+		DiagnosticLog(truncatedIpv4, "truncated IPv4 header (%d bytes)", frame.size());
+		return;
+	case IP_TRUNCATED_V6:
+		DiagnosticLog(truncatedIpv6, "truncated IPv6 header (%d bytes)", frame.size());
+		return;
+	case IP_FRAGMENT:
+		DiagnosticLog(ipFragments, "IP fragment without a TCP header (%d bytes)", frame.size());
 		return;
 	}
+	offset = ip.offset;
 
 	//-------------------------------------------------------------------------
 	// TCP
-	if (ipPayloadType != IPPROTO_TCP) {
-		wxLogError("expected TCP packet (ip_proto: %d)", ipPayloadType);
+	if (ip.protocol != IPPROTO_TCP) {
+		DiagnosticLog(notTcp, "expected TCP packet (ip_proto: %d)", ip.protocol);
 		return;
 	}
 
 	// Check minimum header size before reading the actual length
-	auto tcpHeaderLen = 20; // default (min) size
-	if (offset + tcpHeaderLen > frame.size()) {
-		wxLogError("truncated TCP header (%d bytes)", frame.size());
+	if (offset + TCP_HDRLEN > frame.size()) {
+		DiagnosticLog(truncatedTcp, "truncated TCP header (%d bytes)", frame.size());
 		return;
 	}
 
-	auto tcp = reinterpret_cast<const tcphdr *>(frame.begin() + offset);
+	auto tcp = frame.begin() + offset;
 
 	// Parse out the info we care about
-	tcpHeaderLen = TH_OFF(tcp) * 4;
+	auto tcpHeaderLen = ptrdiff_t(tcp[offsetof(tcphdr, th_offx2)] >> 4) * 4;
 
 	_endpoints = EndpointPair(
-		Endpoint(std::move(ipSrc), ntohs(tcp->th_sport)),
-		Endpoint(std::move(ipDst), ntohs(tcp->th_dport))
+		Endpoint(ip.v6 ? Address::FromV6(ip.src) : Address::FromV4(ip.src), Read16(tcp + offsetof(tcphdr, th_sport))),
+		Endpoint(ip.v6 ? Address::FromV6(ip.dst) : Address::FromV4(ip.dst), Read16(tcp + offsetof(tcphdr, th_dport)))
 	);
 
-	_seq = ntohl(tcp->th_seq);
-	_flags = tcp->th_flags;
+	_seq = Read32(tcp + offsetof(tcphdr, th_seq));
+	_ack = Read32(tcp + offsetof(tcphdr, th_ack));
+	_flags = tcp[offsetof(tcphdr, th_flags)];
 
 	// Check actual packet size
 	offset += tcpHeaderLen;
 	if (offset > frame.size()) {
-		wxLogError("truncated TCP header (%d bytes)", frame.size());
+		DiagnosticLog(truncatedTcp, "truncated TCP header (%d bytes)", frame.size());
 		return;
 	}
 
+	if (tcpHeaderLen > TCP_HDRLEN) {
+		_timestamps = FindTimestamps(tcp + TCP_HDRLEN, tcp + tcpHeaderLen, _tsVal, _tsEcr);
+	}
+
 	//-------------------------------------------------------------------------
 	// Payload
-	auto payloadLen = ipPayloadLen - tcpHeaderLen;
+	auto payloadLen = ip.length - tcpHeaderLen;
 
-	if (offset + payloadLen > frame.size()) {
-		wxLogError("truncated TCP payload (%d bytes)", frame.size());
+	if (payloadLen < 0 || offset + payloadLen > frame.size()) {
+		DiagnosticLog(truncatedPayload, "truncated TCP payload (%d bytes)", frame.size());
 		return;
 	}
 
@@ -111,3 +299,50 @@ tcp::Segment::Segment(std::range<const uint8_t *> frame)
 
 	_ok = true;
 }
+
+bool tcp::Segment::FlowHash(std::range<const uint8_t *> frame, uint32_t &hash, LinkLayer::Strip link)
+{
+	// Same checks as the constructor, up to where it knows the endpoints
+	ptrdiff_t offset = 0;
+	uint16_t etherType = 0;
+	IpLayer ip;
+	if (!link || !link(frame, offset, etherType) || ParseIp(frame, offset, etherType, ip) != IP_OK ||
+		ip.protocol != IPPROTO_TCP || ip.offset + TCP_HDRLEN > frame.size()) {
+		return false;
+	}
+
+	// (address, port) of each end, in network order. An IPv6 address is
+	// folded to 64 bits first; ends that collide just hash to one shard.
+	auto p = frame.begin();
+	uint16_t srcPort, dstPort;
+	std::memcpy(&srcPort, p + ip.offset + offsetof(tcphdr, th_sport), sizeof(srcPort));
+	std::memcpy(&dstPort, p + ip.offset + offsetof(tcphdr, th_dport), sizeof(dstPort));
+
+	uint64_t a, b;
+	if (!ip.v6) {
+		uint32_t srcIp, dstIp;
+		std::memcpy(&srcIp, ip.src, sizeof(srcIp));
+		std::memcpy(&dstIp, ip.dst, sizeof(dstIp));
+		a = uint64_t(srcIp) << 16 | srcPort;
+		b = uint64_t(dstIp) << 16 | dstPort;
+	} else {
+		uint64_t src[2], dst[2];
+		std::memcpy(src, ip.src, sizeof(src));
+		std::memcpy(dst, ip.dst, sizeof(dst));
+		a = (src[0] * 0x9e3779b97f4a7c15ull ^ src[1]) + srcPort;
+		b = (dst[0] * 0x9e3779b97f4a7c15ull ^ dst[1]) + dstPort;
+	}
+
+	// Order the ends so both directions hash the same
+	if (a > b) {
+		std::swap(a, b);
+	}
+
+	// splitmix64 finalizer
+	auto h = a * 0x9e3779b97f4a7c15ull ^ b;
+	h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ull;
+	h = (h ^ (h >> 27)) * 0x94d049bb133111ebull;
+	h ^= h >> 31;
+	hash = uint32_t(h);
+	return true;
+}
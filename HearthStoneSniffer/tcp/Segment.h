@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Endpoint.h"
+#include "LinkLayer.h"
 
 #include <cstdint>
 #include "../range.h"
@@ -10,7 +11,8 @@ namespace tcp {
 class Segment
 {
 public:
-	Segment(std::range<const uint8_t *> frame);
+	// <link> strips the frame's link-layer header (see LinkLayer::ForLinkType())
+	Segment(std::range<const uint8_t *> frame, LinkLayer::Strip link = &LinkLayer::Ethernet);
 
 	const EndpointPair &Endpoints() const { return _endpoints; }
 
@@ -18,19 +20,35 @@ public:
 	const Endpoint &Dst() const { return _endpoints.Dst(); }
 
 	uint32_t SeqNum() const { return _seq; }
+	uint32_t AckNum() const { return _ack; }
 
 	bool IsSyn() const { return (_flags & TH_SYN) != 0; }
 	bool IsFin() const { return (_flags & TH_FIN) != 0; }
 	bool IsRst() const { return (_flags & TH_RST) != 0; }
+	bool IsAck() const { return (_flags & TH_ACK) != 0; }
+
+	// The timestamps option (RFC 7323), if the segment has one
+	bool HasTimestamps() const { return _timestamps; }
+	uint32_t TsVal() const { return _tsVal; }
+	uint32_t TsEcr() const { return _tsEcr; }
 
 	bool WasParsed() const { return _ok; }
 
 	std::range<const uint8_t *> Payload() const { return _payload; }
 
+	// Hash of the connection <frame> belongs to, the same for both directions
+	// (any value, 0 included). Much cheaper than parsing the segment; returns
+	// false if it wouldn't have endpoints.
+	static bool FlowHash(std::range<const uint8_t *> frame, uint32_t &hash, LinkLayer::Strip link = &LinkLayer::Ethernet);
+
 private:
 	EndpointPair _endpoints;
 	uint32_t _seq;
+	uint32_t _ack;
+	uint32_t _tsVal;
+	uint32_t _tsEcr;
 	uint8_t _flags;
+	bool _timestamps;
 	bool _ok;
 	std::range<const uint8_t *> _payload;
 
@@ -3,28 +3,61 @@
 
 #include "Stream.h"
 
-const std::vector<const uint8_t> EMPTY_VECTOR;
+#include "../AsyncLog.h"
+#include "../Diagnostic.h"
+#include "../Metrics.h"
 
-tcp::Stream::Stream(Parser *parser, const EndpointPair &endpoints, Stream *other, int64_t nanotime, uint32_t seq)
+Histogram tcp::Stream::_holdTimes;
+Histogram tcp::Stream::_rttTimes;
+
+// Retransmissions come in bursts on lossy links
+static Diagnostic duplicateSegments(wxLOG_Info, "duplicate segments dropped");
+static Diagnostic duplicateSizeMismatch(wxLOG_Warning, "duplicate segments with a different size");
+
+static Metrics::Gauge openStreams("hs_streams_open", "TCP streams being reassembled.");
+static Metrics::Counter deliveredBytes("hs_stream_delivered_bytes_total", "Bytes delivered in order by TCP reassembly.");
+static Metrics::Counter cachedSegments("hs_stream_out_of_order_segments_total", "Segments held for reassembly because they arrived out of order.");
+static Metrics::Distribution holdTimes("hs_stream_hold_seconds", "Time out of order segments were held for reassembly.", 1e-9);
+
+tcp::Stream::Stream(Parser *parser, const EndpointPair &endpoints, Stream *other, int64_t nanotime, uint32_t seq, bool attached)
 	: _parser(parser),
 	  _endpoints(endpoints),
 	  _other(other),
 	  _firstSeq(seq),
+	  _attached(attached),
 	  _nextSeq(seq + 1),
 	  _cache(),
+	  _holdTime(),
+	  _rtt(),
 	  _callback(parser->Factory()(nanotime, this))
 {
+	openStreams.Add(1);
+
 	// Link other stream
 	if (_other) {
 		wxCHECK2(!_other->_other, return);
 
-		wxLogVerbose("pairing %s with %s", _endpoints.SrcToDst(), _other->_endpoints.SrcToDst());
+		AsyncLogVerbose("pairing %s with %s", _endpoints.SrcToDst(), _other->_endpoints.SrcToDst());
 		_other->_other = this;
 	}
 }
 
 tcp::Stream::~Stream()
 {
+	openStreams.Add(-1);
+
+	if (_holdTime) {
+		AsyncLogVerbose("%s held %llu segments for reassembly (p50 %llu us, p99 %llu us, max %llu us)", _endpoints.SrcToDst(),
+			_holdTime->Count(), _holdTime->Percentile(0.5) / 1000, _holdTime->Percentile(0.99) / 1000, _holdTime->Max() / 1000);
+		_holdTimes.Merge(*_holdTime);
+	}
+
+	if (auto rtt = _rtt.Samples()) {
+		AsyncLogVerbose("%s round trip %llu samples (p50 %llu us, p99 %llu us, max %llu us)", _endpoints.SrcToDst(),
+			rtt->Count(), rtt->Percentile(0.5) / 1000, rtt->Percentile(0.99) / 1000, rtt->Max() / 1000);
+		_rttTimes.Merge(*rtt);
+	}
+
 	if (_other) {
 		_other->_other = nullptr;
 		_other = nullptr;
@@ -38,13 +71,14 @@ void tcp::Stream::Add(int64_t nanotime, uint32_t seq, std::range<const uint8_t *
 	auto offset = int32_t(seq - _nextSeq);
 	if (offset < 0) {
 		// Duplicate packet that's already been processed (ignore)
-		wxLogVerbose("%s dropping duplicate segment: seq=%d, next=%d, size=%d", _endpoints.SrcToDst(), seq, _nextSeq, data.size());
+		DiagnosticLog(duplicateSegments, "%s dropping duplicate segment: seq=%d, next=%d, size=%d", _endpoints.SrcToDst(), seq, _nextSeq, data.size());
 		return;
 	}
 
 	if (seq == _nextSeq) {
-		(*_callback)(nanotime, data);
+		(*_callback)(nanotime, nanotime, data);
 		_nextSeq += data.size();
+		deliveredBytes.Add(data.size());
 
 		// Check cache for additional data
 		while (1) {
@@ -53,14 +87,22 @@ void tcp::Stream::Add(int64_t nanotime, uint32_t seq, std::range<const uint8_t *
 				return; // wait for more frames
 			}
 
-			if (it->second.size() <= 0) {
+			auto &cached = it->second;
+			if (cached.data.empty()) {
 				Close(nanotime, _nextSeq);
 				return;
 			}
 
-			auto &v = it->second;
-			(*_callback)(nanotime, std::make_range(v.data(), v.data() + v.size()));
-			_nextSeq += it->second.size();
+			if (!_holdTime) {
+				_holdTime.reset(new Histogram());
+			}
+			_holdTime->RecordSigned(nanotime - cached.nanotime);
+			holdTimes.RecordSigned(nanotime - cached.nanotime);
+
+			auto &v = cached.data;
+			(*_callback)(nanotime, cached.nanotime, std::make_range(v.data(), v.data() + v.size()));
+			_nextSeq += v.size();
+			deliveredBytes.Add(v.size());
 
 			_cache.erase(it);
 		}
@@ -69,30 +111,31 @@ void tcp::Stream::Add(int64_t nanotime, uint32_t seq, std::range<const uint8_t *
 	auto current = _cache.find(seq);
 	if (current != _cache.end()) {
 		// There's already data stored there (duplicate packet?)
-		wxLogVerbose("%s dropping duplicate segment: seq=%d, size=%d)", _endpoints.SrcToDst(), seq, current->second.size());
-		if (current->second.size() != data.size()) {
-			wxLogWarning("%s duplicate frames not the same size: seq=%d (%d vs %d)", _endpoints.SrcToDst(), seq, current->second.size(), data.size());
+		DiagnosticLog(duplicateSegments, "%s dropping duplicate segment: seq=%d, size=%d)", _endpoints.SrcToDst(), seq, current->second.data.size());
+		if (current->second.data.size() != data.size()) {
+			DiagnosticLog(duplicateSizeMismatch, "%s duplicate frames not the same size: seq=%d (%d vs %d)", _endpoints.SrcToDst(), seq, current->second.data.size(), data.size());
 		}
 		// TODO: could verify that the data is the same as well
 		return;
 	}
 
 	// Data out of order so save it for later
-	_cache.emplace(seq, std::vector<const uint8_t>(data.begin(), data.end()));
+	cachedSegments.Add();
+	_cache.emplace(seq, Cached(nanotime, std::vector<uint8_t>(data.begin(), data.end())));
 }
 
 void tcp::Stream::Close(int64_t nanotime, uint32_t seq)
 {
 	if (seq != _nextSeq) {
 		// Mark the end of the stream, but wait for missing data
-		auto r = _cache.emplace(seq, EMPTY_VECTOR);
+		auto r = _cache.emplace(seq, Cached(nanotime, std::vector<uint8_t>()));
 		if (!r.second) {
 			// Already a frame in the cache there...
-			if (r.first->second.empty()) {
-				wxLogVerbose("%d duplicate FIN: seq=%d", _endpoints.SrcToDst(), seq);
+			if (r.first->second.data.empty()) {
+				AsyncLogVerbose("%s duplicate FIN: seq=%d", _endpoints.SrcToDst(), seq);
 				return; // just ignore it
 			} else {
-				wxLogError("%s FIN seq matches existing data: seq=%d, size=%d", _endpoints.SrcToDst(), seq, r.first->second.size());
+				AsyncLogError("%s FIN seq matches existing data: seq=%d, size=%d", _endpoints.SrcToDst(), seq, r.first->second.data.size());
 				// Shouldn't happen, so go ahead and close the stream anyway (below)
 			}
 		}
@@ -2,6 +2,8 @@
 
 #include "Endpoint.h"
 #include "Parser.h"
+#include "RttEstimator.h"
+#include "../Histogram.h"
 
 #include <cstdint>
 #include "../range.h"
@@ -9,6 +11,7 @@
 #include <memory>
 #include <ostream>
 #include <string>
+#include <vector>
 
 namespace tcp {
 
@@ -17,7 +20,9 @@ class Parser;
 class Stream
 {
 public:
-	Stream(Parser *parser, const EndpointPair &endpoints, Stream *other, int64_t nanotime, uint32_t seq);
+	// <seq> is the SYN's sequence number, or one before the first data when
+	// <attached> (picked up mid-stream, so the data may start mid-message)
+	Stream(Parser *parser, const EndpointPair &endpoints, Stream *other, int64_t nanotime, uint32_t seq, bool attached = false);
 	~Stream();
 
 	const EndpointPair &Endpoints() const { return _endpoints; }
@@ -26,6 +31,7 @@ public:
 	const Endpoint &Dst() const { return _endpoints.Dst(); }
 
 	uint32_t FirstSeq() const { return _firstSeq; }
+	bool Attached() const { return _attached; }
 
 	void Add(int64_t nanotime, uint32_t seq, std::range<const uint8_t *> data);
 	void Close(int64_t nanotime, uint32_t seq);
@@ -33,13 +39,38 @@ public:
 	Stream * const Other() { return _other; }
 	Parser::Callback * const Callback() { return _callback.get(); }
 
+	// Round trip times of the data sent this way
+	RttEstimator &Rtt() { return _rtt; }
+
+	// Nanoseconds out of order segments of every stream so far were held
+	// for before delivery (streams add theirs when they go away)
+	static const Histogram &HoldTimes() { return _holdTimes; }
+
+	// Round trip times of every stream so far, also added when they go away
+	static const Histogram &RttTimes() { return _rttTimes; }
+
 private:
+	// An out of order segment (or the FIN, with no data) and when it arrived
+	struct Cached
+	{
+		Cached(int64_t nanotime, std::vector<uint8_t> data) : nanotime(nanotime), data(std::move(data)) { }
+
+		int64_t nanotime;
+		std::vector<uint8_t> data;
+	};
+
 	Parser *const _parser;
 	const EndpointPair _endpoints;
 	Stream *_other;
 	const uint32_t _firstSeq;
+	const bool _attached;
 	uint32_t _nextSeq;
-	std::map<uint32_t, const std::vector<const uint8_t>> _cache;
+	std::map<uint32_t, const Cached> _cache;
+	std::unique_ptr<Histogram> _holdTime; // only once a segment was held
+	RttEstimator _rtt;
+
+	static Histogram _holdTimes;
+	static Histogram _rttTimes;
 
 	// This should come last so its constructor is called last and destructor is called first
 	const Parser::Callback::Ptr _callback;
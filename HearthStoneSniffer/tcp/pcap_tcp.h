@@ -35,7 +35,7 @@
 #include <pcap.h>
 
 
-#ifdef MAC_OS_X_VERSION_MIN_REQUIRED
+#if defined(MAC_OS_X_VERSION_MIN_REQUIRED) || defined(__linux__)
 #include <arpa/inet.h>
 #endif
 
@@ -211,7 +211,9 @@ extern u_int32_t ip_finddst(const struct ip *);
 
 
 
+#ifndef IPPROTO_TCP
 #define IPPROTO_TCP             6               /* tcp */
+#endif
 
 
 